@@ -0,0 +1,209 @@
+#include "benchmark.hpp"
+
+#include <map>
+#include <ostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+#include <numeric>
+#include <cmath>
+
+#include "json.hpp"
+
+namespace mls {
+
+// Function-local static: benchmarks register themselves during static initialization
+static std::map<std::string, BenchmarkFunction>& getBenchmarkRegistry() {
+    static std::map<std::string, BenchmarkFunction> s_Registry;
+    return s_Registry;
+}
+
+bool registerBenchmark(const char* name, BenchmarkFunction function) {
+    return getBenchmarkRegistry().emplace(name, function).second;
+}
+
+std::vector<std::string> getBenchmarkNames() {
+    std::vector<std::string> names;
+    for(const auto& benchmark: getBenchmarkRegistry()) {
+        names.emplace_back(benchmark.first);
+    }
+    return names;
+}
+
+static double computeMedian(std::vector<double> values) {
+    if(values.empty()) {
+        return 0.;
+    }
+    auto middle = values.size() / 2;
+    std::nth_element(begin(values), begin(values) + middle, end(values));
+    if(values.size() % 2) {
+        return values[middle];
+    }
+    auto lowerMiddle = *std::max_element(begin(values), begin(values) + middle);
+    return 0.5 * (lowerMiddle + values[middle]);
+}
+
+void computeStatistics(BenchmarkResult& result) {
+    const auto& durations = result.m_Durations;
+    if(durations.empty()) {
+        return;
+    }
+    result.m_fMedian = computeMedian(durations);
+
+    std::vector<double> deviations;
+    deviations.reserve(durations.size());
+    for(auto duration: durations) {
+        deviations.emplace_back(std::abs(duration - result.m_fMedian));
+    }
+    result.m_fMedianAbsoluteDeviation = computeMedian(deviations);
+
+    result.m_fMin = *std::min_element(begin(durations), end(durations));
+    result.m_fMean = std::accumulate(begin(durations), end(durations), 0.) / durations.size();
+}
+
+std::vector<BenchmarkResult> runBenchmarks(const BenchmarkOptions& options, std::ostream& log) {
+    std::vector<BenchmarkResult> results;
+
+    log << std::left << std::setw(48) << "Benchmark" << std::right << std::setw(14) << "median (ms)"
+        << std::setw(10) << "MAD (%)" << std::setw(14) << "ns / item" << std::endl;
+
+    for(const auto& benchmark: getBenchmarkRegistry()) {
+        if(benchmark.first.find(options.m_Filter) == std::string::npos) {
+            continue;
+        }
+        BenchmarkResult result;
+        result.m_Name = benchmark.first;
+
+        BenchmarkState state(options, result);
+        benchmark.second(state);
+
+        const auto relativeMAD = result.m_fMedian > 0. ? 100. * result.m_fMedianAbsoluteDeviation / result.m_fMedian : 0.;
+        log << std::left << std::setw(48) << result.m_Name << std::right << std::fixed
+            << std::setprecision(3) << std::setw(14) << ns2ms(uint64_t(result.m_fMedian))
+            << std::setprecision(1) << std::setw(10) << relativeMAD
+            << std::setprecision(2) << std::setw(14) << result.getMedianPerItem();
+        for(const auto& metric: result.m_Metrics) {
+            log << "  " << metric.first << " = " << std::setprecision(4) << metric.second;
+        }
+        log << std::endl;
+
+        results.emplace_back(std::move(result));
+    }
+
+    return results;
+}
+
+const BenchmarkResult* BenchmarkRun::findResult(const std::string& name) const {
+    for(const auto& result: m_Results) {
+        if(result.m_Name == name) {
+            return &result;
+        }
+    }
+    return nullptr;
+}
+
+void writeBenchmarkRunJSON(std::ostream& out, const BenchmarkRun& run) {
+    out << std::setprecision(17);
+    out << "{\n";
+    out << "  \"date\": ";
+    writeJSONString(out, run.m_Date);
+    out << ",\n  \"git_hash\": ";
+    writeJSONString(out, run.m_GitHash);
+    out << ",\n  \"machine\": {\n    \"fingerprint\": ";
+    writeJSONString(out, run.m_Machine.m_Fingerprint);
+    out << ",\n    \"cpu\": ";
+    writeJSONString(out, run.m_Machine.m_CPUName);
+    out << ",\n    \"logical_cpu_count\": " << run.m_Machine.m_nLogicalCPUCount;
+    out << ",\n    \"os\": ";
+    writeJSONString(out, run.m_Machine.m_OSName);
+    out << ",\n    \"compiler\": ";
+    writeJSONString(out, run.m_Machine.m_CompilerName);
+    out << "\n  },\n";
+    out << "  \"thread_count\": " << run.m_nThreadCount << ",\n";
+    out << "  \"warmup_count\": " << run.m_nWarmupCount << ",\n";
+    out << "  \"repetition_count\": " << run.m_nRepetitionCount << ",\n";
+    out << "  \"benchmarks\": [";
+    for(auto i = size_t(0); i < run.m_Results.size(); ++i) {
+        const auto& result = run.m_Results[i];
+        out << (i ? ",\n" : "\n");
+        out << "    {\n";
+        out << "      \"name\": ";
+        writeJSONString(out, result.m_Name);
+        out << ",\n";
+        out << "      \"items\": " << result.m_nItemCount << ",\n";
+        out << "      \"median_ns\": " << result.m_fMedian << ",\n";
+        out << "      \"mad_ns\": " << result.m_fMedianAbsoluteDeviation << ",\n";
+        out << "      \"min_ns\": " << result.m_fMin << ",\n";
+        out << "      \"mean_ns\": " << result.m_fMean << ",\n";
+        out << "      \"ns_per_item\": " << result.getMedianPerItem() << ",\n";
+        out << "      \"samples_ns\": [";
+        for(auto j = size_t(0); j < result.m_Durations.size(); ++j) {
+            out << (j ? ", " : "") << result.m_Durations[j];
+        }
+        out << "]";
+        if(!result.m_Metrics.empty()) {
+            out << ",\n      \"metrics\": {";
+            for(auto j = size_t(0); j < result.m_Metrics.size(); ++j) {
+                out << (j ? ", " : "");
+                writeJSONString(out, result.m_Metrics[j].first);
+                out << ": " << result.m_Metrics[j].second;
+            }
+            out << "}";
+        }
+        out << "\n";
+        out << "    }";
+    }
+    out << "\n  ]\n";
+    out << "}\n";
+}
+
+bool loadBenchmarkRun(const std::string& path, BenchmarkRun& run, std::string& error) {
+    std::ifstream in(path);
+    if(!in) {
+        error = "Unable to open " + path;
+        return false;
+    }
+    std::stringstream text;
+    text << in.rdbuf();
+
+    JSONValue document;
+    if(!parseJSON(text.str(), document, error)) {
+        error = path + ": " + error;
+        return false;
+    }
+
+    run = BenchmarkRun();
+    run.m_Date = document["date"].asString();
+    run.m_GitHash = document["git_hash"].asString();
+    const auto& machine = document["machine"];
+    run.m_Machine.m_Fingerprint = machine["fingerprint"].asString();
+    run.m_Machine.m_CPUName = machine["cpu"].asString();
+    run.m_Machine.m_nLogicalCPUCount = uint32_t(machine["logical_cpu_count"].asNumber());
+    run.m_Machine.m_OSName = machine["os"].asString();
+    run.m_Machine.m_CompilerName = machine["compiler"].asString();
+    run.m_nThreadCount = uint32_t(document["thread_count"].asNumber());
+    run.m_nWarmupCount = uint32_t(document["warmup_count"].asNumber());
+    run.m_nRepetitionCount = uint32_t(document["repetition_count"].asNumber());
+
+    for(const auto& benchmark: document["benchmarks"].getElements()) {
+        BenchmarkResult result;
+        result.m_Name = benchmark["name"].asString();
+        result.m_nItemCount = std::size_t(benchmark["items"].asNumber());
+        for(const auto& sample: benchmark["samples_ns"].getElements()) {
+            result.m_Durations.emplace_back(sample.asNumber());
+        }
+        for(const auto& metric: benchmark["metrics"].getMembers()) {
+            result.m_Metrics.emplace_back(metric.first, metric.second.asNumber());
+        }
+        if(result.m_Name.empty() || result.m_Durations.empty()) {
+            error = path + ": benchmark without name or samples";
+            return false;
+        }
+        computeStatistics(result);
+        run.m_Results.emplace_back(std::move(result));
+    }
+    return true;
+}
+
+}
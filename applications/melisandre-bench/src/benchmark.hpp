@@ -0,0 +1,139 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <utility>
+#include <iosfwd>
+#include <cstdint>
+
+#include <melisandre/system/time.hpp>
+
+#include "machine.hpp"
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace mls {
+
+// Force the compiler to compute value, so that a benchmarked computation whose result is unused
+// is not optimized away
+template<typename T>
+inline void doNotOptimizeAway(const T& value) {
+#ifdef _MSC_VER
+    const volatile char* pSink = reinterpret_cast<const volatile char*>(&value);
+    (void) *pSink;
+    _ReadWriteBarrier();
+#else
+    asm volatile("" : : "r,m"(value) : "memory");
+#endif
+}
+
+struct BenchmarkOptions {
+    uint32_t m_nWarmupCount = 3u;
+    uint32_t m_nRepetitionCount = 15u;
+    // Only run the benchmarks whose name contains this string
+    std::string m_Filter;
+};
+
+struct BenchmarkResult {
+    std::string m_Name;
+    // Number of items (queries, samples, pixels...) processed by one repetition
+    std::size_t m_nItemCount = 0u;
+    // Duration of each measured repetition, in nanoseconds
+    std::vector<double> m_Durations;
+    // Quality measures of the benchmarked computation (recall of an approximation...), by name
+    std::vector<std::pair<std::string, double>> m_Metrics;
+
+    double m_fMedian = 0.;
+    // Median absolute deviation from the median, a measure of the noise robust to outliers
+    double m_fMedianAbsoluteDeviation = 0.;
+    double m_fMin = 0.;
+    double m_fMean = 0.;
+
+    double getMedianPerItem() const {
+        return m_nItemCount ? m_fMedian / m_nItemCount : m_fMedian;
+    }
+};
+
+// Compute the statistics of result from its durations
+void computeStatistics(BenchmarkResult& result);
+
+// Passed to each benchmark, which prepares its data and then calls measure() once
+class BenchmarkState {
+public:
+    BenchmarkState(const BenchmarkOptions& options, BenchmarkResult& result):
+        m_Options(options), m_Result(result) {
+    }
+
+    // Call f() m_nWarmupCount times, then time m_nRepetitionCount calls. itemCount is the number of
+    // items processed by a call to f(), used to report the time per item.
+    template<typename Functor>
+    void measure(std::size_t itemCount, Functor&& f) {
+        m_Result.m_nItemCount = itemCount;
+        for(auto i = 0u; i < m_Options.m_nWarmupCount; ++i) {
+            f();
+        }
+        m_Result.m_Durations.clear();
+        m_Result.m_Durations.reserve(m_Options.m_nRepetitionCount);
+        for(auto i = 0u; i < m_Options.m_nRepetitionCount; ++i) {
+            Timer timer;
+            f();
+            m_Result.m_Durations.emplace_back(double(timer.getNanoEllapsedTime().count()));
+        }
+        computeStatistics(m_Result);
+    }
+
+    // Report a quality measure of the benchmarked computation, logged and saved with the timings
+    void setMetric(const std::string& name, double value) {
+        m_Result.m_Metrics.emplace_back(name, value);
+    }
+
+private:
+    const BenchmarkOptions& m_Options;
+    BenchmarkResult& m_Result;
+};
+
+using BenchmarkFunction = void (*)(BenchmarkState&);
+
+// Add a benchmark to the list run by runBenchmarks. Use it through MLS_BENCHMARK.
+bool registerBenchmark(const char* name, BenchmarkFunction function);
+
+std::vector<std::string> getBenchmarkNames();
+
+// Run the registered benchmarks matching the filter, in the order of their names
+std::vector<BenchmarkResult> runBenchmarks(const BenchmarkOptions& options, std::ostream& log);
+
+// The results of an execution of the benchmarks, with what is needed to compare it to another one
+struct BenchmarkRun {
+    std::string m_Date;
+    // Commit the benchmarks were built from, set by CMake
+    std::string m_GitHash;
+    MachineInfo m_Machine;
+    uint32_t m_nThreadCount = 0u;
+    uint32_t m_nWarmupCount = 0u;
+    uint32_t m_nRepetitionCount = 0u;
+    std::vector<BenchmarkResult> m_Results;
+
+    // Result of the benchmark named name, nullptr if it has not been run
+    const BenchmarkResult* findResult(const std::string& name) const;
+};
+
+void writeBenchmarkRunJSON(std::ostream& out, const BenchmarkRun& run);
+
+// Read a run written by writeBenchmarkRunJSON. Return false and fill error on failure.
+bool loadBenchmarkRun(const std::string& path, BenchmarkRun& run, std::string& error);
+
+}
+
+// Define and register a benchmark named "group/name":
+//
+// MLS_BENCHMARK(KdTree, Build) {
+//     ... prepare the data ...
+//     state.measure(itemCount, [&]() { ... benchmarked code ... });
+// }
+#define MLS_BENCHMARK(group, name) \
+    static void mlsBenchmark_##group##_##name(::mls::BenchmarkState& state); \
+    static const bool mlsBenchmarkRegistered_##group##_##name = \
+        ::mls::registerBenchmark(#group "/" #name, mlsBenchmark_##group##_##name); \
+    static void mlsBenchmark_##group##_##name(::mls::BenchmarkState& state)
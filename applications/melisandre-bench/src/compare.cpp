@@ -0,0 +1,116 @@
+#include "compare.hpp"
+
+#include <ostream>
+#include <iomanip>
+#include <algorithm>
+#include <cmath>
+
+namespace mls {
+
+double computeMannWhitneyPValue(const std::vector<double>& lhs, const std::vector<double>& rhs) {
+    const auto n1 = double(lhs.size()), n2 = double(rhs.size()), n = n1 + n2;
+    if(lhs.empty() || rhs.empty()) {
+        return 1.;
+    }
+
+    // Rank all the samples together, tied samples get the mean of their ranks
+    std::vector<std::pair<double, bool>> samples; // (value, is from lhs)
+    samples.reserve(lhs.size() + rhs.size());
+    for(auto value: lhs) {
+        samples.emplace_back(value, true);
+    }
+    for(auto value: rhs) {
+        samples.emplace_back(value, false);
+    }
+    std::sort(begin(samples), end(samples));
+
+    auto lhsRankSum = 0.;
+    auto tieCorrection = 0.;
+    for(auto i = size_t(0); i < samples.size();) {
+        auto j = i;
+        while(j < samples.size() && samples[j].first == samples[i].first) {
+            ++j;
+        }
+        const auto tieCount = double(j - i);
+        const auto rank = 0.5 * (i + 1 + j); // Mean of the ranks i + 1 to j
+        for(auto k = i; k < j; ++k) {
+            if(samples[k].second) {
+                lhsRankSum += rank;
+            }
+        }
+        tieCorrection += tieCount * tieCount * tieCount - tieCount;
+        i = j;
+    }
+
+    const auto U = lhsRankSum - 0.5 * n1 * (n1 + 1);
+    const auto mean = 0.5 * n1 * n2;
+    const auto variance = n1 * n2 / 12. * ((n + 1) - tieCorrection / (n * (n - 1)));
+    if(variance <= 0.) {
+        return 1.;
+    }
+    // Continuity correction
+    const auto z = std::max(0., std::abs(U - mean) - 0.5) / std::sqrt(variance);
+    return std::erfc(z / std::sqrt(2.));
+}
+
+std::size_t compareBenchmarkRuns(const BenchmarkRun& baseline, const BenchmarkRun& candidate,
+                                 const ComparisonOptions& options, std::ostream& out) {
+    out << "Baseline:  " << baseline.m_GitHash << " (" << baseline.m_Date << ") on " << baseline.m_Machine.m_CPUName
+        << " [" << baseline.m_Machine.m_Fingerprint << "]" << std::endl;
+    out << "Candidate: " << candidate.m_GitHash << " (" << candidate.m_Date << ") on " << candidate.m_Machine.m_CPUName
+        << " [" << candidate.m_Machine.m_Fingerprint << "]" << std::endl;
+    if(baseline.m_Machine.m_Fingerprint != candidate.m_Machine.m_Fingerprint) {
+        out << "Warning: the runs come from different machines or compilers, timings may not be comparable" << std::endl;
+    }
+    if(baseline.m_nThreadCount != candidate.m_nThreadCount) {
+        out << "Warning: the runs used a different number of threads" << std::endl;
+    }
+    out << std::endl;
+
+    out << std::left << std::setw(48) << "Benchmark" << std::right << std::setw(16) << "baseline (ms)"
+        << std::setw(16) << "candidate (ms)" << std::setw(10) << "speedup" << std::setw(10) << "p-value"
+        << "  " << std::left << "verdict" << std::endl;
+
+    auto regressionCount = size_t(0);
+    for(const auto& result: candidate.m_Results) {
+        const auto baselineResult = baseline.findResult(result.m_Name);
+        out << std::left << std::setw(48) << result.m_Name << std::right << std::fixed;
+        if(!baselineResult) {
+            out << std::setw(16) << "-" << std::setprecision(3) << std::setw(16) << result.m_fMedian * 1e-6
+                << "  new" << std::endl;
+            continue;
+        }
+
+        const auto speedup = baselineResult->m_fMedian / result.m_fMedian;
+        const auto relativeChange = 100. * (result.m_fMedian / baselineResult->m_fMedian - 1.);
+        const auto pValue = computeMannWhitneyPValue(baselineResult->m_Durations, result.m_Durations);
+        const auto isSignificant = pValue < options.m_fSignificanceLevel;
+
+        const char* verdict = "unchanged";
+        if(isSignificant && relativeChange > options.m_fThreshold) {
+            verdict = "REGRESSION";
+            ++regressionCount;
+        } else if(isSignificant && relativeChange < -options.m_fThreshold) {
+            verdict = "faster";
+        } else if(isSignificant) {
+            verdict = "within threshold";
+        }
+
+        out << std::setprecision(3) << std::setw(16) << baselineResult->m_fMedian * 1e-6
+            << std::setw(16) << result.m_fMedian * 1e-6
+            << std::setprecision(2) << std::setw(9) << speedup << "x"
+            << std::setprecision(4) << std::setw(10) << pValue
+            << "  " << verdict << std::endl;
+    }
+
+    for(const auto& result: baseline.m_Results) {
+        if(!candidate.findResult(result.m_Name)) {
+            out << std::left << std::setw(48) << result.m_Name << std::right << "  missing from the candidate" << std::endl;
+        }
+    }
+
+    out << std::endl << regressionCount << " regression(s) above " << std::defaultfloat << options.m_fThreshold << "%" << std::endl;
+    return regressionCount;
+}
+
+}
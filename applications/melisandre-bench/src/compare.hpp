@@ -0,0 +1,27 @@
+#pragma once
+
+#include <iosfwd>
+#include <vector>
+
+#include "benchmark.hpp"
+
+namespace mls {
+
+struct ComparisonOptions {
+    // Relative slowdown of the median, in percent, above which a significant change is a regression
+    double m_fThreshold = 5.;
+    // Significance level of the Mann-Whitney U test
+    double m_fSignificanceLevel = 0.01;
+};
+
+// Two-sided p-value of the Mann-Whitney U test: probability that samples drawn from the same
+// distribution are at least as different as lhs and rhs. Uses the normal approximation with
+// tie correction, accurate from about 8 samples per side.
+double computeMannWhitneyPValue(const std::vector<double>& lhs, const std::vector<double>& rhs);
+
+// Print a table comparing each benchmark of candidate to the same benchmark in baseline and return
+// the number of regressions: benchmarks significantly slower by more than the threshold
+std::size_t compareBenchmarkRuns(const BenchmarkRun& baseline, const BenchmarkRun& candidate,
+                                 const ComparisonOptions& options, std::ostream& out);
+
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <vector>
+
+#include <melisandre/types.hpp>
+#include <melisandre/maths/sampling/Random.hpp>
+
+namespace mls {
+
+// Points uniformly distributed in the unit cube, always the same for a given seed
+inline std::vector<Vec3f> generateUniformPoints(std::size_t count, uint32_t seed) {
+    RandomGenerator rng(seed);
+    std::vector<Vec3f> points;
+    points.reserve(count);
+    for(auto i = size_t(0); i < count; ++i) {
+        points.emplace_back(rng.getFloat3());
+    }
+    return points;
+}
+
+// Radius of the ball that contains on average neighbourCount of count points uniformly distributed
+// in the unit cube
+inline float getBallRadius(std::size_t count, std::size_t neighbourCount) {
+    return std::cbrt(3.f * neighbourCount / (4.f * 3.14159265f * count));
+}
+
+}
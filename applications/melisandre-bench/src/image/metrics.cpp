@@ -0,0 +1,81 @@
+#include "../benchmark.hpp"
+
+#include <melisandre/image/Image.hpp>
+#include <melisandre/maths/sampling/Random.hpp>
+
+namespace mls {
+
+static const auto METRICS_IMAGE_WIDTH = 1920u;
+static const auto METRICS_IMAGE_HEIGHT = 1080u;
+
+// A reference image and a noisy estimate of it, like the output of a renderer
+struct MetricsImages {
+    Image m_Reference;
+    Image m_Image;
+
+    MetricsImages():
+        m_Reference(METRICS_IMAGE_WIDTH, METRICS_IMAGE_HEIGHT),
+        m_Image(METRICS_IMAGE_WIDTH, METRICS_IMAGE_HEIGHT) {
+        RandomGenerator rng;
+        for(auto i = 0u; i < m_Reference.getPixelCount(); ++i) {
+            auto value = Vec3f(rng.getFloat3());
+            m_Reference[i] = Vec4f(value, 1.f);
+            m_Image[i] = Vec4f(value * (0.5f + Vec3f(rng.getFloat3())), 1.f);
+        }
+    }
+};
+
+MLS_BENCHMARK(ImageMetrics, NormalizedRootMeanSquaredError) {
+    MetricsImages images;
+
+    state.measure(images.m_Reference.getPixelCount(), [&]() {
+        doNotOptimizeAway(computeNormalizedRootMeanSquaredError(images.m_Reference, images.m_Image));
+    });
+}
+
+MLS_BENCHMARK(ImageMetrics, RootMeanSquaredError) {
+    MetricsImages images;
+
+    state.measure(images.m_Reference.getPixelCount(), [&]() {
+        doNotOptimizeAway(computeRootMeanSquaredError(images.m_Reference, images.m_Image));
+    });
+}
+
+MLS_BENCHMARK(ImageMetrics, MeanAbsoluteError) {
+    MetricsImages images;
+
+    state.measure(images.m_Reference.getPixelCount(), [&]() {
+        doNotOptimizeAway(computeMeanAbsoluteError(images.m_Reference, images.m_Image));
+    });
+}
+
+MLS_BENCHMARK(ImageMetrics, SquareErrorImage) {
+    MetricsImages images;
+
+    state.measure(images.m_Reference.getPixelCount(), [&]() {
+        Vec3f nrmse;
+        auto errorImage = computeSquareErrorImage(images.m_Reference, images.m_Image, nrmse);
+        doNotOptimizeAway(errorImage.getPixels()[0]);
+    });
+}
+
+MLS_BENCHMARK(ImageMetrics, AbsoluteErrorImage) {
+    MetricsImages images;
+
+    state.measure(images.m_Reference.getPixelCount(), [&]() {
+        auto errorImage = computeAbsoluteErrorImage(images.m_Reference, images.m_Image);
+        doNotOptimizeAway(errorImage.getPixels()[0]);
+    });
+}
+
+MLS_BENCHMARK(ImageMetrics, ImageStatistics) {
+    MetricsImages images;
+
+    state.measure(images.m_Image.getPixelCount(), [&]() {
+        Vec3f sum, mean, variance;
+        computeImageStatistics(images.m_Image, sum, mean, variance);
+        doNotOptimizeAway(variance);
+    });
+}
+
+}
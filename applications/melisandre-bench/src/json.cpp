@@ -0,0 +1,186 @@
+#include "json.hpp"
+
+#include <ostream>
+#include <cstdlib>
+#include <cstring>
+
+namespace mls {
+
+const JSONValue& JSONValue::operator [](const std::string& name) const {
+    static const JSONValue s_Null;
+    for(const auto& member: m_Members) {
+        if(member.first == name) {
+            return member.second;
+        }
+    }
+    return s_Null;
+}
+
+class JSONParser {
+public:
+    JSONParser(const std::string& text):
+        m_Text(text) {
+    }
+
+    bool parse(JSONValue& value, std::string& error) {
+        if(!parseValue(value) || (skipWhitespaces(), m_nPosition != m_Text.size())) {
+            error = "Invalid JSON at offset " + std::to_string(m_nPosition);
+            return false;
+        }
+        return true;
+    }
+
+private:
+    void skipWhitespaces() {
+        while(m_nPosition < m_Text.size() && std::strchr(" \t\r\n", m_Text[m_nPosition])) {
+            ++m_nPosition;
+        }
+    }
+
+    bool consume(char c) {
+        skipWhitespaces();
+        if(m_nPosition < m_Text.size() && m_Text[m_nPosition] == c) {
+            ++m_nPosition;
+            return true;
+        }
+        return false;
+    }
+
+    bool consumeKeyword(const char* keyword) {
+        auto length = std::strlen(keyword);
+        if(m_Text.compare(m_nPosition, length, keyword)) {
+            return false;
+        }
+        m_nPosition += length;
+        return true;
+    }
+
+    bool parseValue(JSONValue& value) {
+        skipWhitespaces();
+        if(m_nPosition == m_Text.size()) {
+            return false;
+        }
+        switch(m_Text[m_nPosition]) {
+        case '{':
+            return parseObject(value);
+        case '[':
+            return parseArray(value);
+        case '"':
+            value.m_Type = JSONValue::Type::String;
+            return parseString(value.m_String);
+        case 't':
+            value.m_Type = JSONValue::Type::Boolean;
+            value.m_bBoolean = true;
+            return consumeKeyword("true");
+        case 'f':
+            value.m_Type = JSONValue::Type::Boolean;
+            value.m_bBoolean = false;
+            return consumeKeyword("false");
+        case 'n':
+            value.m_Type = JSONValue::Type::Null;
+            return consumeKeyword("null");
+        default:
+            return parseNumber(value);
+        }
+    }
+
+    bool parseNumber(JSONValue& value) {
+        const auto begin = m_Text.c_str() + m_nPosition;
+        char* end = nullptr;
+        value.m_fNumber = std::strtod(begin, &end);
+        if(end == begin) {
+            return false;
+        }
+        value.m_Type = JSONValue::Type::Number;
+        m_nPosition += end - begin;
+        return true;
+    }
+
+    // Escaped unicode characters are not supported, they never appear in benchmark results
+    bool parseString(std::string& str) {
+        if(!consume('"')) {
+            return false;
+        }
+        str.clear();
+        while(m_nPosition < m_Text.size()) {
+            auto c = m_Text[m_nPosition++];
+            if(c == '"') {
+                return true;
+            }
+            if(c == '\\') {
+                if(m_nPosition == m_Text.size()) {
+                    return false;
+                }
+                c = m_Text[m_nPosition++];
+                switch(c) {
+                case 'n': c = '\n'; break;
+                case 't': c = '\t'; break;
+                case 'r': c = '\r'; break;
+                case 'b': c = '\b'; break;
+                case 'f': c = '\f'; break;
+                case '"': case '\\': case '/': break;
+                default: return false;
+                }
+            }
+            str += c;
+        }
+        return false;
+    }
+
+    bool parseArray(JSONValue& value) {
+        consume('[');
+        value.m_Type = JSONValue::Type::Array;
+        if(consume(']')) {
+            return true;
+        }
+        do {
+            value.m_Elements.emplace_back();
+            if(!parseValue(value.m_Elements.back())) {
+                return false;
+            }
+        } while(consume(','));
+        return consume(']');
+    }
+
+    bool parseObject(JSONValue& value) {
+        consume('{');
+        value.m_Type = JSONValue::Type::Object;
+        if(consume('}')) {
+            return true;
+        }
+        do {
+            value.m_Members.emplace_back();
+            skipWhitespaces();
+            if(!parseString(value.m_Members.back().first) || !consume(':') ||
+                    !parseValue(value.m_Members.back().second)) {
+                return false;
+            }
+        } while(consume(','));
+        return consume('}');
+    }
+
+    const std::string& m_Text;
+    std::size_t m_nPosition = 0u;
+};
+
+bool parseJSON(const std::string& text, JSONValue& value, std::string& error) {
+    value = JSONValue();
+    return JSONParser(text).parse(value, error);
+}
+
+void writeJSONString(std::ostream& out, const std::string& str) {
+    out << '"';
+    for(auto c: str) {
+        switch(c) {
+        case '"': out << "\\\""; break;
+        case '\\': out << "\\\\"; break;
+        case '\n': out << "\\n"; break;
+        case '\t': out << "\\t"; break;
+        case '\r': out << "\\r"; break;
+        default: out << c;
+        }
+    }
+    out << '"';
+}
+
+}
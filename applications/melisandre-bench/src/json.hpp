@@ -0,0 +1,70 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <utility>
+#include <iosfwd>
+
+namespace mls {
+
+// Minimal JSON document model, enough to read back the results written by the benchmarks
+class JSONValue {
+public:
+    enum class Type {
+        Null, Boolean, Number, String, Array, Object
+    };
+
+    JSONValue() = default;
+
+    Type getType() const {
+        return m_Type;
+    }
+
+    bool isNull() const {
+        return m_Type == Type::Null;
+    }
+
+    double asNumber(double defaultValue = 0.) const {
+        return m_Type == Type::Number ? m_fNumber : defaultValue;
+    }
+
+    bool asBoolean(bool defaultValue = false) const {
+        return m_Type == Type::Boolean ? m_bBoolean : defaultValue;
+    }
+
+    // Empty string if the value is not a string
+    const std::string& asString() const {
+        return m_String;
+    }
+
+    // Elements of an array, empty if the value is not an array
+    const std::vector<JSONValue>& getElements() const {
+        return m_Elements;
+    }
+
+    // Member of an object, a null value if there is no such member
+    const JSONValue& operator [](const std::string& name) const;
+
+    // Members of an object in the order of the document, empty if the value is not an object
+    const std::vector<std::pair<std::string, JSONValue>>& getMembers() const {
+        return m_Members;
+    }
+
+private:
+    friend class JSONParser;
+
+    Type m_Type = Type::Null;
+    bool m_bBoolean = false;
+    double m_fNumber = 0.;
+    std::string m_String;
+    std::vector<JSONValue> m_Elements;
+    std::vector<std::pair<std::string, JSONValue>> m_Members;
+};
+
+// Parse a JSON document. Return false and fill error on syntax error.
+bool parseJSON(const std::string& text, JSONValue& value, std::string& error);
+
+// Write str as a quoted JSON string
+void writeJSONString(std::ostream& out, const std::string& str);
+
+}
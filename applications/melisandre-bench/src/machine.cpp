@@ -0,0 +1,97 @@
+#include "machine.hpp"
+
+#include <thread>
+#include <sstream>
+#include <iomanip>
+#include <cstring>
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#define MLS_HAS_CPUID
+#elif defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#define MLS_HAS_CPUID
+#endif
+
+namespace mls {
+
+#ifdef MLS_HAS_CPUID
+static void cpuid(uint32_t leaf, uint32_t registers[4]) {
+#ifdef _MSC_VER
+    __cpuid(reinterpret_cast<int*>(registers), int(leaf));
+#else
+    __cpuid(leaf, registers[0], registers[1], registers[2], registers[3]);
+#endif
+}
+#endif
+
+// Brand string of the CPU, as reported by cpuid on x86
+static std::string getCPUName() {
+#ifdef MLS_HAS_CPUID
+    uint32_t registers[4];
+    cpuid(0x80000000u, registers);
+    if(registers[0] < 0x80000004u) {
+        return "unknown";
+    }
+    char brand[49] = {};
+    for(auto i = 0u; i < 3u; ++i) {
+        cpuid(0x80000002u + i, registers);
+        std::memcpy(brand + 16 * i, registers, 16);
+    }
+    // The brand string is padded with spaces
+    std::string name(brand);
+    name.erase(0, name.find_first_not_of(' '));
+    name.erase(name.find_last_not_of(' ') + 1);
+    return name;
+#else
+    return "unknown";
+#endif
+}
+
+static std::string getCompilerName() {
+    std::stringstream name;
+#if defined(__clang__)
+    name << "clang " << __clang_major__ << "." << __clang_minor__ << "." << __clang_patchlevel__;
+#elif defined(__GNUC__)
+    name << "gcc " << __GNUC__ << "." << __GNUC_MINOR__ << "." << __GNUC_PATCHLEVEL__;
+#elif defined(_MSC_VER)
+    name << "msvc " << _MSC_FULL_VER;
+#else
+    name << "unknown";
+#endif
+    return name.str();
+}
+
+std::string computeMachineFingerprint(const MachineInfo& info) {
+    std::stringstream description;
+    description << info.m_CPUName << "|" << info.m_nLogicalCPUCount << "|" << info.m_OSName << "|" << info.m_CompilerName;
+
+    // 64 bits FNV-1a hash
+    auto hash = uint64_t(14695981039346656037ull);
+    for(auto c: description.str()) {
+        hash ^= uint8_t(c);
+        hash *= 1099511628211ull;
+    }
+
+    std::stringstream fingerprint;
+    fingerprint << std::hex << std::setw(16) << std::setfill('0') << hash;
+    return fingerprint.str();
+}
+
+MachineInfo getMachineInfo() {
+    MachineInfo info;
+    info.m_CPUName = getCPUName();
+    info.m_nLogicalCPUCount = std::thread::hardware_concurrency();
+#if defined(_WIN32)
+    info.m_OSName = "windows";
+#elif defined(__linux__)
+    info.m_OSName = "linux";
+#else
+    info.m_OSName = "unknown";
+#endif
+    info.m_CompilerName = getCompilerName();
+    info.m_Fingerprint = computeMachineFingerprint(info);
+    return info;
+}
+
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <string>
+#include <cstdint>
+
+namespace mls {
+
+// Description of the machine and build that produced benchmark results. Results are only comparable
+// between runs with the same fingerprint.
+struct MachineInfo {
+    std::string m_CPUName;
+    uint32_t m_nLogicalCPUCount = 0u;
+    std::string m_OSName;
+    std::string m_CompilerName;
+    // Hash of the fields above
+    std::string m_Fingerprint;
+};
+
+MachineInfo getMachineInfo();
+
+std::string computeMachineFingerprint(const MachineInfo& info);
+
+}
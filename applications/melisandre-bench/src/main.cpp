@@ -0,0 +1,149 @@
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <cstdlib>
+
+#include <melisandre/system/files.hpp>
+#include <melisandre/system/threads.hpp>
+
+#include "benchmark.hpp"
+#include "compare.hpp"
+
+#ifndef MLS_GIT_HASH
+#define MLS_GIT_HASH "unknown"
+#endif
+
+using namespace mls;
+
+static void printUsage(const char* program) {
+    std::cerr << "Usage: " << program << " [options]" << std::endl
+              << "       " << program << " --compare <baseline.json> <candidate.json> [comparison options]" << std::endl
+              << "Options:" << std::endl
+              << "  --filter=<str>       only run the benchmarks whose name contains <str>" << std::endl
+              << "  --warmup=<n>         number of untimed calls before measuring (default 3)" << std::endl
+              << "  --repetitions=<n>    number of timed calls (default 15)" << std::endl
+              << "  --json=<file>        write the results to <file> in JSON" << std::endl
+              << "  --store=<dir>        write the results in <dir>, named after the date, commit and machine" << std::endl
+              << "  --baseline=<file>    compare the results to a previous run written in JSON" << std::endl
+              << "  --list               print the names of the benchmarks" << std::endl
+              << "Comparison options:" << std::endl
+              << "  --threshold=<p>      slowdown of the median in percent tolerated before a regression (default 5)" << std::endl
+              << "  --alpha=<a>          significance level of the Mann-Whitney U test (default 0.01)" << std::endl
+              << "The exit code is 2 when a regression is found." << std::endl;
+}
+
+// Return true and set value if arg is "<option><value>"
+static bool parseOption(const std::string& arg, const std::string& option, std::string& value) {
+    if(arg.compare(0, option.size(), option)) {
+        return false;
+    }
+    value = arg.substr(option.size());
+    return true;
+}
+
+static bool writeRun(const std::string& path, const BenchmarkRun& run) {
+    std::ofstream out(path);
+    if(!out) {
+        std::cerr << "Unable to open " << path << std::endl;
+        return false;
+    }
+    writeBenchmarkRunJSON(out, run);
+    return true;
+}
+
+static int compare(const BenchmarkRun& baseline, const BenchmarkRun& candidate, const ComparisonOptions& options) {
+    return compareBenchmarkRuns(baseline, candidate, options, std::cout) ? 2 : EXIT_SUCCESS;
+}
+
+int main(int argc, char** argv) {
+    BenchmarkOptions options;
+    ComparisonOptions comparisonOptions;
+    std::string jsonPath, storeDirectory, baselinePath;
+    std::vector<std::string> comparedPaths;
+    auto compareOnly = false;
+
+    for(auto i = 1; i < argc; ++i) {
+        std::string arg = argv[i], value;
+        if(parseOption(arg, "--filter=", value)) {
+            options.m_Filter = value;
+        } else if(parseOption(arg, "--warmup=", value)) {
+            options.m_nWarmupCount = uint32_t(std::strtoul(value.c_str(), nullptr, 10));
+        } else if(parseOption(arg, "--repetitions=", value)) {
+            options.m_nRepetitionCount = std::max(1u, uint32_t(std::strtoul(value.c_str(), nullptr, 10)));
+        } else if(parseOption(arg, "--json=", value)) {
+            jsonPath = value;
+        } else if(parseOption(arg, "--store=", value)) {
+            storeDirectory = value;
+        } else if(parseOption(arg, "--baseline=", value)) {
+            baselinePath = value;
+        } else if(parseOption(arg, "--threshold=", value)) {
+            comparisonOptions.m_fThreshold = std::strtod(value.c_str(), nullptr);
+        } else if(parseOption(arg, "--alpha=", value)) {
+            comparisonOptions.m_fSignificanceLevel = std::strtod(value.c_str(), nullptr);
+        } else if(arg == "--compare") {
+            compareOnly = true;
+        } else if(compareOnly && arg.compare(0, 2, "--")) {
+            comparedPaths.emplace_back(arg);
+        } else if(arg == "--list") {
+            for(const auto& name: getBenchmarkNames()) {
+                std::cout << name << std::endl;
+            }
+            return EXIT_SUCCESS;
+        } else {
+            printUsage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if(compareOnly) {
+        if(comparedPaths.size() != 2u) {
+            printUsage(argv[0]);
+            return EXIT_FAILURE;
+        }
+        BenchmarkRun baseline, candidate;
+        std::string error;
+        if(!loadBenchmarkRun(comparedPaths[0], baseline, error) || !loadBenchmarkRun(comparedPaths[1], candidate, error)) {
+            std::cerr << error << std::endl;
+            return EXIT_FAILURE;
+        }
+        return compare(baseline, candidate, comparisonOptions);
+    }
+
+    // Load the baseline first to fail early
+    BenchmarkRun baseline;
+    if(!baselinePath.empty()) {
+        std::string error;
+        if(!loadBenchmarkRun(baselinePath, baseline, error)) {
+            std::cerr << error << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    BenchmarkRun run;
+    run.m_Date = getDateString();
+    run.m_GitHash = MLS_GIT_HASH;
+    run.m_Machine = getMachineInfo();
+    run.m_nThreadCount = getSystemThreadCount();
+    run.m_nWarmupCount = options.m_nWarmupCount;
+    run.m_nRepetitionCount = options.m_nRepetitionCount;
+    run.m_Results = runBenchmarks(options, std::cout);
+
+    if(!jsonPath.empty() && !writeRun(jsonPath, run)) {
+        return EXIT_FAILURE;
+    }
+    if(!storeDirectory.empty()) {
+        createDirectory(FilePath(storeDirectory));
+        auto path = FilePath(storeDirectory) + FilePath(run.m_Date + "_" + run.m_GitHash + "_" + run.m_Machine.m_Fingerprint + ".json");
+        if(!writeRun(path.str(), run)) {
+            return EXIT_FAILURE;
+        }
+        std::cout << "Results stored in " << path << std::endl;
+    }
+
+    if(!baselinePath.empty()) {
+        std::cout << std::endl;
+        return compare(baseline, run, comparisonOptions);
+    }
+
+    return EXIT_SUCCESS;
+}
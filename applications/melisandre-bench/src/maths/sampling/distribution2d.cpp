@@ -0,0 +1,49 @@
+#include "../../benchmark.hpp"
+
+#include <cmath>
+#include <melisandre/maths/sampling/distribution2d.h>
+
+namespace mls {
+
+static const auto DISTRIBUTION_WIDTH = size_t(2048);
+static const auto DISTRIBUTION_HEIGHT = size_t(1024);
+static const auto DISTRIBUTION_SAMPLE_COUNT = size_t(1000000);
+
+// Looks like an environment map: a dim sky with a small bright sun
+static float evalEnvironment(uint32_t x, uint32_t y) {
+    auto u = (x + 0.5f) / DISTRIBUTION_WIDTH, v = (y + 0.5f) / DISTRIBUTION_HEIGHT;
+    auto sunDistSquared = (u - 0.3f) * (u - 0.3f) + (v - 0.25f) * (v - 0.25f);
+    return (0.1f + 1000.f * std::exp(-sunDistSquared * 5000.f)) * std::sin(3.14159265f * v);
+}
+
+MLS_BENCHMARK(Distribution2D, Build) {
+    std::vector<real> buffer(getDistribution2DBufferSize(DISTRIBUTION_WIDTH, DISTRIBUTION_HEIGHT));
+
+    state.measure(DISTRIBUTION_WIDTH * DISTRIBUTION_HEIGHT, [&]() {
+        buildDistribution2D(evalEnvironment, buffer.data(), DISTRIBUTION_WIDTH, DISTRIBUTION_HEIGHT);
+        doNotOptimizeAway(buffer[0]);
+    });
+}
+
+MLS_BENCHMARK(Distribution2D, SampleContinuous) {
+    std::vector<real> buffer(getDistribution2DBufferSize(DISTRIBUTION_WIDTH, DISTRIBUTION_HEIGHT));
+    buildDistribution2D(evalEnvironment, buffer.data(), DISTRIBUTION_WIDTH, DISTRIBUTION_HEIGHT);
+
+    RandomGenerator rng;
+    std::vector<real2> uniformSamples;
+    uniformSamples.reserve(DISTRIBUTION_SAMPLE_COUNT);
+    for(auto i = size_t(0); i < DISTRIBUTION_SAMPLE_COUNT; ++i) {
+        uniformSamples.emplace_back(rng.getFloat2());
+    }
+
+    state.measure(uniformSamples.size(), [&]() {
+        auto sum = 0.f;
+        for(const auto& uniformSample: uniformSamples) {
+            auto sample = sampleContinuousDistribution2D(buffer.data(), DISTRIBUTION_WIDTH, DISTRIBUTION_HEIGHT, uniformSample);
+            sum += sample.value().x + sample.density();
+        }
+        doNotOptimizeAway(sum);
+    });
+}
+
+}
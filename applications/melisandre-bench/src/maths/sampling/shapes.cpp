@@ -0,0 +1,72 @@
+#include "../../benchmark.hpp"
+
+#include <melisandre/maths/sampling/shapes.hpp>
+#include <melisandre/maths/sampling/Random.hpp>
+
+namespace mls {
+
+static const auto SHAPE_SAMPLE_COUNT = size_t(1000000);
+
+static std::vector<real2> generateUniformSamples(std::size_t count) {
+    RandomGenerator rng;
+    std::vector<real2> samples;
+    samples.reserve(count);
+    for(auto i = size_t(0); i < count; ++i) {
+        samples.emplace_back(rng.getFloat2());
+    }
+    return samples;
+}
+
+// Measure the sampling of SHAPE_SAMPLE_COUNT directions with sampleDirection(u, v)
+template<typename SampleFunctor>
+static void measureDirectionSampling(BenchmarkState& state, const SampleFunctor& sampleDirection) {
+    const auto uniformSamples = generateUniformSamples(SHAPE_SAMPLE_COUNT);
+
+    state.measure(uniformSamples.size(), [&]() {
+        auto sum = real3(0);
+        for(const auto& uniformSample: uniformSamples) {
+            auto sample = sampleDirection(uniformSample.x, uniformSample.y);
+            sum += sample.value() * sample.density();
+        }
+        doNotOptimizeAway(sum);
+    });
+}
+
+MLS_BENCHMARK(Shapes, UniformSampleSphere) {
+    measureDirectionSampling(state, [](real u, real v) {
+        return uniformSampleSphere(u, v);
+    });
+}
+
+MLS_BENCHMARK(Shapes, CosineSampleSphere) {
+    measureDirectionSampling(state, [](real u, real v) {
+        return cosineSampleSphere(u, v);
+    });
+}
+
+MLS_BENCHMARK(Shapes, UniformSampleHemisphere) {
+    measureDirectionSampling(state, [](real u, real v) {
+        return uniformSampleHemisphere(u, v);
+    });
+}
+
+MLS_BENCHMARK(Shapes, CosineSampleHemisphere) {
+    measureDirectionSampling(state, [](real u, real v) {
+        return cosineSampleHemisphere(u, v);
+    });
+}
+
+MLS_BENCHMARK(Shapes, CosineSampleHemisphereAroundNormal) {
+    const auto N = normalize(real3(1, 2, 3));
+    measureDirectionSampling(state, [&](real u, real v) {
+        return cosineSampleHemisphere(u, v, N);
+    });
+}
+
+MLS_BENCHMARK(Shapes, PowerCosineSampleHemisphere) {
+    measureDirectionSampling(state, [](real u, real v) {
+        return powerCosineSampleHemisphere(u, v, 32.f);
+    });
+}
+
+}
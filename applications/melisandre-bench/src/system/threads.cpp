@@ -0,0 +1,54 @@
+#include "../benchmark.hpp"
+
+#include <thread>
+#include <melisandre/system/threads.hpp>
+
+namespace mls {
+
+static const auto DISPATCH_CALL_COUNT = size_t(1000);
+
+// Dispatch of an empty task to all threads: measures the fixed cost of a parallel call
+
+MLS_BENCHMARK(Threads, LaunchThreadsDispatch) {
+    const auto threadCount = getSystemThreadCount();
+
+    state.measure(DISPATCH_CALL_COUNT, [&]() {
+        for(auto i = size_t(0); i < DISPATCH_CALL_COUNT; ++i) {
+            launchThreads([](uint32_t threadID) {
+                doNotOptimizeAway(threadID);
+            }, threadCount);
+        }
+    });
+}
+
+// What launchThreads did before the thread pool: spawn and join one thread per task
+MLS_BENCHMARK(Threads, SpawnJoinDispatch) {
+    const auto threadCount = getSystemThreadCount();
+
+    state.measure(DISPATCH_CALL_COUNT, [&]() {
+        for(auto i = size_t(0); i < DISPATCH_CALL_COUNT; ++i) {
+            std::vector<std::thread> threads;
+            threads.reserve(threadCount);
+            for(auto threadID = 0u; threadID < threadCount; ++threadID) {
+                threads.emplace_back([threadID]() {
+                    doNotOptimizeAway(threadID);
+                });
+            }
+            for(auto& thread: threads) {
+                thread.join();
+            }
+        }
+    });
+}
+
+MLS_BENCHMARK(Threads, ParallelForDispatch) {
+    state.measure(DISPATCH_CALL_COUNT, [&]() {
+        for(auto i = size_t(0); i < DISPATCH_CALL_COUNT; ++i) {
+            parallelFor(range(1024u), 0u, [](const Range<uint32_t>& r) {
+                doNotOptimizeAway(r);
+            });
+        }
+    });
+}
+
+}
@@ -0,0 +1,145 @@
+#include "../benchmark.hpp"
+#include "../data.hpp"
+
+#include <melisandre/utils/HashGrid.hpp>
+
+namespace mls {
+
+struct BenchmarkParticle {
+    Vec3f m_Position;
+};
+
+inline const Vec3f& getPosition(const BenchmarkParticle& particle) {
+    return particle.m_Position;
+}
+
+inline bool isValid(const BenchmarkParticle& particle) {
+    return true;
+}
+
+static const auto HASHGRID_PARTICLE_COUNT = size_t(200000);
+static const auto HASHGRID_QUERY_COUNT = size_t(20000);
+
+static std::vector<BenchmarkParticle> generateParticles(std::size_t count, uint32_t seed) {
+    std::vector<BenchmarkParticle> particles;
+    particles.reserve(count);
+    for(const auto& point: generateUniformPoints(count, seed)) {
+        particles.push_back({ point });
+    }
+    return particles;
+}
+
+MLS_BENCHMARK(HashGrid, Build) {
+    const auto particles = generateParticles(HASHGRID_PARTICLE_COUNT, 0u);
+    const auto radius = getBallRadius(particles.size(), 32u);
+    HashGrid grid;
+    grid.Reserve(int(particles.size()));
+
+    state.measure(particles.size(), [&]() {
+        grid.build(particles.data(), uint32_t(particles.size()), radius);
+    });
+}
+
+// Build of a grid of particles much larger than the caches, like the photon maps of progressive photon mapping
+MLS_BENCHMARK(HashGrid, BuildLarge) {
+    const auto particles = generateParticles(20 * HASHGRID_PARTICLE_COUNT, 0u);
+    const auto radius = getBallRadius(particles.size(), 32u);
+    HashGrid grid;
+    grid.Reserve(int(particles.size()));
+
+    state.measure(particles.size(), [&]() {
+        grid.build(particles.data(), uint32_t(particles.size()), radius);
+    });
+}
+
+static void benchmarkProcess(BenchmarkState& state, HashGridLayout layout, std::size_t particleCount) {
+    const auto particles = generateParticles(particleCount, 0u);
+    const auto queries = generateUniformPoints(HASHGRID_QUERY_COUNT, 1u);
+    const auto radius = getBallRadius(particles.size(), 32u);
+    HashGrid grid(layout);
+    grid.Reserve(int(particles.size()));
+    grid.build(particles.data(), uint32_t(particles.size()), radius);
+
+    state.measure(queries.size(), [&]() {
+        auto sum = 0.f;
+        for(const auto& query: queries) {
+            grid.process(particles.data(), query, [&](const BenchmarkParticle& particle) {
+                sum += particle.m_Position.x;
+            });
+        }
+        doNotOptimizeAway(sum);
+    });
+}
+
+MLS_BENCHMARK(HashGrid, Process) {
+    benchmarkProcess(state, HashGridLayout::Indirect, HASHGRID_PARTICLE_COUNT);
+}
+
+MLS_BENCHMARK(HashGrid, ReorderedProcess) {
+    benchmarkProcess(state, HashGridLayout::Reordered, HASHGRID_PARTICLE_COUNT);
+}
+
+MLS_BENCHMARK(HashGrid, ProcessLarge) {
+    benchmarkProcess(state, HashGridLayout::Indirect, 20 * HASHGRID_PARTICLE_COUNT);
+}
+
+MLS_BENCHMARK(HashGrid, ReorderedProcessLarge) {
+    benchmarkProcess(state, HashGridLayout::Reordered, 20 * HASHGRID_PARTICLE_COUNT);
+}
+
+// Queries in parallel and in Morton order, each summing in its own slot. The radius of the queries is
+// radiusScale times the radius of the build, like the shrinking radii of progressive photon mapping.
+// reservedCellCount is 0 to let the build choose the number of cells.
+static void benchmarkProcessBatch(BenchmarkState& state, HashGridLayout layout, std::size_t particleCount,
+                                  float radiusScale = 1.f, int reservedCellCount = -1) {
+    const auto particles = generateParticles(particleCount, 0u);
+    const auto queries = generateUniformPoints(HASHGRID_QUERY_COUNT, 1u);
+    const auto radius = getBallRadius(particles.size(), 32u);
+    HashGrid grid(layout);
+    grid.Reserve(reservedCellCount < 0 ? int(particles.size()) : reservedCellCount);
+    grid.build(particles.data(), uint32_t(particles.size()), radius);
+    std::vector<float> sums(queries.size());
+    const std::vector<float> queryRadii(queries.size(), radiusScale * radius);
+    state.setMetric("cellCount", float(grid.getCellCount()));
+
+    state.measure(queries.size(), [&]() {
+        std::fill(begin(sums), end(sums), 0.f);
+        grid.processBatch(particles.data(), queries.data(), queryRadii.data(), uint32_t(queries.size()), [&](uint32_t query, const BenchmarkParticle& particle) {
+            sums[query] += particle.m_Position.x;
+        });
+        doNotOptimizeAway(sums.data());
+    });
+}
+
+MLS_BENCHMARK(HashGrid, ProcessBatch) {
+    benchmarkProcessBatch(state, HashGridLayout::Indirect, HASHGRID_PARTICLE_COUNT);
+}
+
+MLS_BENCHMARK(HashGrid, ReorderedProcessBatch) {
+    benchmarkProcessBatch(state, HashGridLayout::Reordered, HASHGRID_PARTICLE_COUNT);
+}
+
+MLS_BENCHMARK(HashGrid, ReorderedProcessBatchAutoSized) {
+    benchmarkProcessBatch(state, HashGridLayout::Reordered, HASHGRID_PARTICLE_COUNT, 1.f, 0);
+}
+
+MLS_BENCHMARK(HashGrid, ReorderedProcessBatchHalfRadius) {
+    benchmarkProcessBatch(state, HashGridLayout::Reordered, HASHGRID_PARTICLE_COUNT, 0.5f, 0);
+}
+
+MLS_BENCHMARK(HashGrid, ReorderedProcessBatchLarge) {
+    benchmarkProcessBatch(state, HashGridLayout::Reordered, 20 * HASHGRID_PARTICLE_COUNT);
+}
+
+MLS_BENCHMARK(HashGrid, ReorderedBuild) {
+    const auto particles = generateParticles(HASHGRID_PARTICLE_COUNT, 0u);
+    const auto radius = getBallRadius(particles.size(), 32u);
+    HashGrid grid(HashGridLayout::Reordered);
+    grid.Reserve(int(particles.size()));
+
+    state.measure(particles.size(), [&]() {
+        grid.build(particles.data(), uint32_t(particles.size()), radius);
+    });
+}
+
+}
@@ -0,0 +1,288 @@
+#include "../benchmark.hpp"
+#include "../data.hpp"
+
+#include <melisandre/utils/KdTree.hpp>
+#include <melisandre/utils/DynamicKdTree.hpp>
+
+#include <algorithm>
+
+namespace mls {
+
+static const auto KDTREE_POINT_COUNT = size_t(200000);
+static const auto KDTREE_QUERY_COUNT = size_t(20000);
+
+MLS_BENCHMARK(KdTree, Build) {
+    const auto points = generateUniformPoints(KDTREE_POINT_COUNT, 0u);
+    KdTree tree;
+
+    state.measure(points.size(), [&]() {
+        tree.build(points.size(), [&](uint32_t i) { return points[i]; });
+        doNotOptimizeAway(tree.size());
+    });
+}
+
+static void benchmarkSearch(BenchmarkState& state, KdTreeLayout layout) {
+    const auto points = generateUniformPoints(KDTREE_POINT_COUNT, 0u);
+    const auto queries = generateUniformPoints(KDTREE_QUERY_COUNT, 1u);
+    const auto radius = getBallRadius(points.size(), 32u);
+    KdTree tree(layout);
+    tree.build(points.size(), [&](uint32_t i) { return points[i]; });
+
+    state.measure(queries.size(), [&]() {
+        auto count = 0u;
+        for(const auto& query: queries) {
+            tree.search(query, radius * radius, [&](uint32_t index, const Vec3f& position, float distSquared, float& maxDistSquared) {
+                ++count;
+            });
+        }
+        doNotOptimizeAway(count);
+    });
+}
+
+static void benchmarkSearchNearestNeighbour(BenchmarkState& state, KdTreeLayout layout) {
+    const auto points = generateUniformPoints(KDTREE_POINT_COUNT, 0u);
+    const auto queries = generateUniformPoints(KDTREE_QUERY_COUNT, 1u);
+    KdTree tree(layout);
+    tree.build(points.size(), [&](uint32_t i) { return points[i]; });
+
+    state.measure(queries.size(), [&]() {
+        auto sum = 0u;
+        for(const auto& query: queries) {
+            float distSquared;
+            sum += tree.searchNearestNeighbour(query, distSquared);
+        }
+        doNotOptimizeAway(sum);
+    });
+}
+
+static void benchmarkSearchKNearestNeighbours(BenchmarkState& state, KdTreeLayout layout) {
+    const auto points = generateUniformPoints(KDTREE_POINT_COUNT, 0u);
+    const auto queries = generateUniformPoints(KDTREE_QUERY_COUNT, 1u);
+    KdTree tree(layout);
+    tree.build(points.size(), [&](uint32_t i) { return points[i]; });
+
+    state.measure(queries.size(), [&]() {
+        auto sum = 0.f;
+        for(const auto& query: queries) {
+            tree.searchKNearestNeighbours(query, 16u, [&](uint32_t index, const Vec3f& position, float distSquared) {
+                sum += distSquared;
+            });
+        }
+        doNotOptimizeAway(sum);
+    });
+}
+
+MLS_BENCHMARK(KdTree, Search) {
+    benchmarkSearch(state, KdTreeLayout::PointPerNode);
+}
+
+MLS_BENCHMARK(KdTree, SearchNearestNeighbour) {
+    benchmarkSearchNearestNeighbour(state, KdTreeLayout::PointPerNode);
+}
+
+MLS_BENCHMARK(KdTree, SearchKNearestNeighbours) {
+    benchmarkSearchKNearestNeighbours(state, KdTreeLayout::PointPerNode);
+}
+
+MLS_BENCHMARK(KdTree, BucketedBuild) {
+    const auto points = generateUniformPoints(KDTREE_POINT_COUNT, 0u);
+    KdTree tree(KdTreeLayout::Bucketed);
+
+    state.measure(points.size(), [&]() {
+        tree.build(points.size(), [&](uint32_t i) { return points[i]; });
+        doNotOptimizeAway(tree.size());
+    });
+}
+
+MLS_BENCHMARK(KdTree, BucketedSearch) {
+    benchmarkSearch(state, KdTreeLayout::Bucketed);
+}
+
+MLS_BENCHMARK(KdTree, BucketedSearchNearestNeighbour) {
+    benchmarkSearchNearestNeighbour(state, KdTreeLayout::Bucketed);
+}
+
+MLS_BENCHMARK(KdTree, BucketedSearchKNearestNeighbours) {
+    benchmarkSearchKNearestNeighbours(state, KdTreeLayout::Bucketed);
+}
+
+MLS_BENCHMARK(KdTree, BucketedSearchBatch) {
+    const auto points = generateUniformPoints(KDTREE_POINT_COUNT, 0u);
+    const auto queries = generateUniformPoints(KDTREE_QUERY_COUNT, 1u);
+    const auto radius = getBallRadius(points.size(), 32u);
+    KdTree tree(KdTreeLayout::Bucketed);
+    tree.build(points.size(), [&](uint32_t i) { return points[i]; });
+    KdTreeBatchResults results;
+
+    state.measure(queries.size(), [&]() {
+        tree.searchBatch(queries.data(), queries.size(), radius * radius, results);
+        doNotOptimizeAway(results.m_Indices.size());
+    });
+}
+
+MLS_BENCHMARK(KdTree, BucketedKNearestBatch) {
+    const auto points = generateUniformPoints(KDTREE_POINT_COUNT, 0u);
+    const auto queries = generateUniformPoints(KDTREE_QUERY_COUNT, 1u);
+    KdTree tree(KdTreeLayout::Bucketed);
+    tree.build(points.size(), [&](uint32_t i) { return points[i]; });
+    KdTreeBatchResults results;
+
+    state.measure(queries.size(), [&]() {
+        tree.kNearestBatch(queries.data(), queries.size(), 16u, results);
+        doNotOptimizeAway(results.m_Indices.size());
+    });
+}
+
+// Measure the K nearest neighbours queries with an approximation, and their recall: the fraction of
+// the exact neighbours which are found
+static void benchmarkApproximateKNearestNeighbours(BenchmarkState& state, const KdTreeApproximation& approximation) {
+    const auto K = size_t(16);
+    const auto points = generateUniformPoints(KDTREE_POINT_COUNT, 0u);
+    const auto queries = generateUniformPoints(KDTREE_QUERY_COUNT, 1u);
+    KdTree tree(KdTreeLayout::Bucketed);
+    tree.build(points.size(), [&](uint32_t i) { return points[i]; });
+    KdTreeBatchResults exactResults, results;
+    tree.kNearestBatch(queries.data(), queries.size(), K, exactResults);
+
+    state.measure(queries.size(), [&]() {
+        tree.kNearestBatch(queries.data(), queries.size(), K, results, approximation);
+        doNotOptimizeAway(results.m_Indices.size());
+    });
+
+    auto foundCount = size_t(0);
+    for(auto query = 0u; query < queries.size(); ++query) {
+        const auto exactBegin = begin(exactResults.m_Indices) + exactResults.m_Offsets[query];
+        const auto exactEnd = begin(exactResults.m_Indices) + exactResults.m_Offsets[query + 1];
+        for(auto i = results.m_Offsets[query]; i < results.m_Offsets[query + 1]; ++i) {
+            foundCount += std::find(exactBegin, exactEnd, results.m_Indices[i]) != exactEnd;
+        }
+    }
+    state.setMetric("recall", double(foundCount) / exactResults.m_Indices.size());
+}
+
+MLS_BENCHMARK(KdTree, BucketedKNearestBatchEpsilon0_5) {
+    KdTreeApproximation approximation;
+    approximation.m_fEpsilon = 0.5f;
+    benchmarkApproximateKNearestNeighbours(state, approximation);
+}
+
+MLS_BENCHMARK(KdTree, BucketedKNearestBatchEpsilon1) {
+    KdTreeApproximation approximation;
+    approximation.m_fEpsilon = 1.f;
+    benchmarkApproximateKNearestNeighbours(state, approximation);
+}
+
+MLS_BENCHMARK(KdTree, BucketedKNearestBatchMaxLeaves4) {
+    KdTreeApproximation approximation;
+    approximation.m_nMaxVisitedLeafCount = 4u;
+    benchmarkApproximateKNearestNeighbours(state, approximation);
+}
+
+// Points with normals, for the gathers which only accept the neighbours of similar orientation
+static std::vector<Vec3f> generateNormals(std::size_t count, uint32_t seed) {
+    auto normals = generateUniformPoints(count, seed);
+    for(auto& normal: normals) {
+        normal = normalize(2.f * normal - Vec3f(1.f));
+    }
+    return normals;
+}
+
+// Minimal cosine between the normals of a query and its neighbours
+static const auto KDTREE_NORMAL_MIN_COSINE = 0.9f;
+// Scale of the normals in the 6D points, so that a normal deviation of one radian counts as a position
+// offset of this distance
+static const auto KDTREE_NORMAL_SCALE = 0.5f;
+
+// The K nearest neighbours of similar normal, filtered by the predicate in a 3D KdTree. The rejections
+// of the predicate are reported per query.
+MLS_BENCHMARK(KdTree, BucketedSearchKNearestNeighboursNormalPredicate) {
+    const auto points = generateUniformPoints(KDTREE_POINT_COUNT, 0u);
+    const auto normals = generateNormals(KDTREE_POINT_COUNT, 2u);
+    const auto queries = generateUniformPoints(KDTREE_QUERY_COUNT, 1u);
+    const auto queryNormals = generateNormals(KDTREE_QUERY_COUNT, 3u);
+    KdTree tree(KdTreeLayout::Bucketed);
+    tree.build(points.size(), [&](uint32_t i) { return points[i]; });
+
+    auto rejectionCount = size_t(0);
+    state.measure(queries.size(), [&]() {
+        auto sum = 0.f;
+        rejectionCount = 0u;
+        for(auto i = 0u; i < queries.size(); ++i) {
+            tree.searchKNearestNeighbours(queries[i], 16u, [&](uint32_t index) {
+                const auto accepted = dot(normals[index], queryNormals[i]) >= KDTREE_NORMAL_MIN_COSINE;
+                rejectionCount += !accepted;
+                return accepted;
+            }, [&](uint32_t index, const Vec3f& position, float distSquared) {
+                sum += distSquared;
+            });
+        }
+        doNotOptimizeAway(sum);
+    });
+    state.setMetric("rejections/query", double(rejectionCount) / queries.size());
+}
+
+// The same gather in a KdTree of positions concatenated with scaled normals, which prunes most of the
+// neighbours of dissimilar orientation in the tree itself
+MLS_BENCHMARK(KdTree6f, BucketedSearchKNearestNeighboursNormalPredicate) {
+    const auto points = generateUniformPoints(KDTREE_POINT_COUNT, 0u);
+    const auto normals = generateNormals(KDTREE_POINT_COUNT, 2u);
+    const auto queries = generateUniformPoints(KDTREE_QUERY_COUNT, 1u);
+    const auto queryNormals = generateNormals(KDTREE_QUERY_COUNT, 3u);
+    auto getPoint = [](const Vec3f& position, const Vec3f& normal) {
+        const auto scaledNormal = KDTREE_NORMAL_SCALE * normal;
+        return KdTree6f::Point { { position.x, position.y, position.z, scaledNormal.x, scaledNormal.y, scaledNormal.z } };
+    };
+    KdTree6f tree(KdTreeLayout::Bucketed);
+    tree.build(points.size(), [&](uint32_t i) { return getPoint(points[i], normals[i]); });
+
+    auto rejectionCount = size_t(0);
+    state.measure(queries.size(), [&]() {
+        auto sum = 0.f;
+        rejectionCount = 0u;
+        for(auto i = 0u; i < queries.size(); ++i) {
+            tree.searchKNearestNeighbours(getPoint(queries[i], queryNormals[i]), 16u, [&](uint32_t index) {
+                const auto accepted = dot(normals[index], queryNormals[i]) >= KDTREE_NORMAL_MIN_COSINE;
+                rejectionCount += !accepted;
+                return accepted;
+            }, [&](uint32_t index, const KdTree6f::Point& point, float distSquared) {
+                sum += distSquared;
+            });
+        }
+        doNotOptimizeAway(sum);
+    });
+    state.setMetric("rejections/query", double(rejectionCount) / queries.size());
+}
+
+MLS_BENCHMARK(DynamicKdTree, Insert) {
+    const auto points = generateUniformPoints(KDTREE_POINT_COUNT, 0u);
+    DynamicKdTree tree;
+
+    state.measure(points.size(), [&]() {
+        tree.clear();
+        for(auto i = 0u; i < points.size(); ++i) {
+            tree.insert(i, points[i]);
+        }
+        doNotOptimizeAway(tree.size());
+    });
+}
+
+MLS_BENCHMARK(DynamicKdTree, SearchKNearestNeighbours) {
+    const auto points = generateUniformPoints(KDTREE_POINT_COUNT, 0u);
+    const auto queries = generateUniformPoints(KDTREE_QUERY_COUNT, 1u);
+    DynamicKdTree tree;
+    for(auto i = 0u; i < points.size(); ++i) {
+        tree.insert(i, points[i]);
+    }
+
+    state.measure(queries.size(), [&]() {
+        auto sum = 0.f;
+        for(const auto& query: queries) {
+            tree.searchKNearestNeighbours(query, 16u, [&](uint32_t index, const Vec3f& position, float distSquared) {
+                sum += distSquared;
+            });
+        }
+        doNotOptimizeAway(sum);
+    });
+}
+
+}
@@ -0,0 +1,92 @@
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <vector>
+
+#include <melisandre/system/memory.hpp>
+
+namespace mls {
+
+struct DestructionCounter {
+    int* m_pCount;
+
+    explicit DestructionCounter(int* pCount = nullptr): m_pCount(pCount) {
+    }
+
+    ~DestructionCounter() {
+        if(m_pCount) {
+            ++*m_pCount;
+        }
+    }
+};
+
+TEST(MemoryTest, WarmArenaDoesNotAllocateBlocks) {
+    ScratchArena arena(1024);
+    auto destructionCount = 0;
+
+    for(auto frame = 0u; frame < 4u; ++frame) {
+        ScratchArenaScope scope(arena);
+
+        ArenaVector<uint32_t> values(arena);
+        for(auto i = 0u; i < 1000u; ++i) {
+            values.push_back(i);
+        }
+        EXPECT_EQ(999u, values.back());
+
+        auto counter = makeUnique<DestructionCounter>(arena, &destructionCount);
+        auto array = makeUniqueArray<DestructionCounter>(arena, 16);
+        array[3].m_pCount = &destructionCount;
+    }
+
+    EXPECT_EQ(8, destructionCount);
+    // Blocks are only allocated during the first frame
+    auto blockAllocationCount = arena.getBlockAllocationCount();
+    {
+        ScratchArenaScope scope(arena);
+        ArenaVector<uint32_t> values(arena);
+        values.resize(1000u);
+    }
+    EXPECT_EQ(blockAllocationCount, arena.getBlockAllocationCount());
+}
+
+TEST(MemoryTest, OutermostScopeTrimsArena) {
+    ScratchArena arena(1024, 64 * 1024);
+    {
+        ScratchArenaScope scope(arena);
+        arena.allocate<char>(1000);
+        {
+            ScratchArenaScope innerScope(arena);
+            arena.allocate<char>(1024 * 1024);
+        }
+        // Inner scopes keep the blocks for the next allocations of the outer one
+        EXPECT_GT(arena.getCapacity(), std::size_t(1024 * 1024));
+    }
+    EXPECT_LE(arena.getCapacity(), std::size_t(64 * 1024));
+
+    ScratchArenaScope scope(arena);
+    EXPECT_NE(nullptr, arena.allocate<char>(100));
+}
+
+TEST(MemoryTest, LargePageAllocatorAlignsSmallAndLargeBuffers) {
+    for(auto count: { std::size_t(100), HUGE_PAGE_SIZE + 100 }) {
+        std::vector<uint32_t, LargePageAllocator<uint32_t>> values(count, 7u);
+        EXPECT_EQ(0u, reinterpret_cast<std::uintptr_t>(values.data()) % CACHE_LINE_SIZE);
+        values.back() = 3u;
+        EXPECT_EQ(7u, values.front());
+        EXPECT_EQ(3u, values.back());
+    }
+}
+
+TEST(MemoryTest, PageSizeAllocatorKeepsItsPageSize) {
+    using Vector = std::vector<uint32_t, PageSizeAllocator<uint32_t>>;
+    Vector large(HUGE_PAGE_SIZE + 100, 7u, PageSizeAllocator<uint32_t>(PageSize::Large));
+    Vector small(100, 3u);
+    EXPECT_EQ(0u, reinterpret_cast<std::uintptr_t>(large.data()) % CACHE_LINE_SIZE);
+    EXPECT_EQ(PageSize::Large, Vector(large).get_allocator().getPageSize());
+
+    small = large;
+    EXPECT_EQ(PageSize::Default, small.get_allocator().getPageSize());
+    EXPECT_EQ(7u, small.back());
+}
+
+}
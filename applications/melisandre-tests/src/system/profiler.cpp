@@ -0,0 +1,41 @@
+#include <gtest/gtest.h>
+
+#include <sstream>
+#include <melisandre/system/profiler.hpp>
+#include <melisandre/system/threads.hpp>
+
+namespace mls {
+
+static std::size_t countOccurences(const std::string& str, const std::string& pattern) {
+    auto count = std::size_t(0);
+    for(auto pos = str.find(pattern); pos != std::string::npos; pos = str.find(pattern, pos + 1)) {
+        ++count;
+    }
+    return count;
+}
+
+TEST(ProfilerTest, ChromeTraceContainsNestedScopesOfAllThreads) {
+    clearProfilerEvents();
+
+    launchThreads([&](uint32_t threadID) {
+        ProfilerScope outer("ProfilerTest outer");
+        for(auto i = 0u; i < 3u; ++i) {
+            ProfilerScope inner("ProfilerTest inner");
+        }
+    }, 4u);
+
+    std::stringstream trace;
+    writeChromeTrace(trace);
+    const auto json = trace.str();
+
+    ASSERT_EQ('{', json.front());
+    ASSERT_EQ(4u, countOccurences(json, "\"name\":\"ProfilerTest outer\""));
+    ASSERT_EQ(12u, countOccurences(json, "\"name\":\"ProfilerTest inner\""));
+
+    clearProfilerEvents();
+    std::stringstream emptyTrace;
+    writeChromeTrace(emptyTrace);
+    ASSERT_EQ(0u, countOccurences(emptyTrace.str(), "ProfilerTest"));
+}
+
+}
@@ -0,0 +1,193 @@
+#include <gtest/gtest.h>
+
+#include <melisandre/system/threads.hpp>
+
+namespace mls {
+
+TEST(ThreadsTest, LaunchThreadsCallsEachThreadIDOnce) {
+    const auto threadCount = 2 * getSystemThreadCount() + 1;
+    std::vector<std::atomic<uint32_t>> callCounts(threadCount);
+    for(auto& count: callCounts) {
+        count = 0u;
+    }
+
+    launchThreads([&](uint32_t threadID) {
+        ++callCounts[threadID];
+    }, threadCount);
+
+    for(const auto& count: callCounts) {
+        ASSERT_EQ(1u, count.load());
+    }
+}
+
+TEST(ThreadsTest, ParallelForCoversRangeOnce) {
+    const auto size = 100003u;
+    std::vector<std::atomic<uint32_t>> callCounts(size);
+    for(auto& count: callCounts) {
+        count = 0u;
+    }
+
+    parallelFor(range(size), 7u, [&](const Range<uint32_t>& subRange) {
+        for(auto i: subRange) {
+            ++callCounts[i];
+        }
+    });
+
+    for(const auto& count: callCounts) {
+        ASSERT_EQ(1u, count.load());
+    }
+}
+
+TEST(ThreadsTest, NestedParallelFor) {
+    const auto outerSize = 64u, innerSize = 1000u;
+    std::atomic<uint32_t> callCount { 0u };
+    // Sum of the flat indices i * innerSize + j, each processed once
+    std::atomic<uint64_t> indexSum { 0u };
+
+    parallelFor(range(outerSize), 1u, [&](const Range<uint32_t>& outer) {
+        for(auto i: outer) {
+            parallelFor(range(innerSize), 16u, [&](const Range<uint32_t>& inner) {
+                for(auto j: inner) {
+                    ++callCount;
+                    indexSum += uint64_t(i) * innerSize + j;
+                }
+            });
+        }
+    });
+
+    const auto totalSize = uint64_t(outerSize) * innerSize;
+    ASSERT_EQ(outerSize * innerSize, callCount.load());
+    ASSERT_EQ(totalSize * (totalSize - 1) / 2, indexSum.load());
+}
+
+TEST(ThreadsTest, ParallelReduceSum) {
+    const auto size = 1000000u;
+    auto sum = parallelReduce(range(size), uint64_t(0), [](const Range<uint32_t>& subRange) {
+        uint64_t partialSum = 0u;
+        for(auto i: subRange) {
+            partialSum += i;
+        }
+        return partialSum;
+    }, [](uint64_t lhs, uint64_t rhs) {
+        return lhs + rhs;
+    });
+
+    ASSERT_EQ(uint64_t(size) * (size - 1) / 2, sum);
+}
+
+TEST(ThreadsTest, PerThreadStorageValuesDoNotShareCacheLines) {
+    PerThreadStorage<Vec3f> values(5u, Vec3f(1.f));
+    for(auto i = 1u; i < values.getThreadCount(); ++i) {
+        auto previous = reinterpret_cast<std::uintptr_t>(&values[i - 1]);
+        auto current = reinterpret_cast<std::uintptr_t>(&values[i]);
+        ASSERT_EQ(0u, current % CACHE_LINE_SIZE);
+        ASSERT_GE(current - previous, CACHE_LINE_SIZE);
+    }
+    ASSERT_EQ(Vec3f(5.f), values.sum());
+}
+
+TEST(ThreadsTest, TreeReduceDoesNotDependOnEvaluationOrder) {
+    // Floating point values whose sum changes with the order of the additions
+    std::vector<float> values { 1e8f, 1.f, -1e8f, 1.f, 3.f, 1e-3f, 7.f };
+    auto sum = treeReduce(values.size(), [&](std::size_t i) {
+        return values[i];
+    }, std::plus<float>());
+    auto expected = (values[0] + (values[1] + values[2])) + ((values[3] + values[4]) + (values[5] + values[6]));
+    ASSERT_EQ(expected, sum);
+}
+
+TEST(ThreadsTest, ParallelReduceDeterministMatchesChunkedTreeSum) {
+    const auto size = 100000u, chunkSize = 1000u;
+    std::vector<float> values(size);
+    for(auto i: range(size)) {
+        values[i] = (i % 2 ? 1e4f : 1e-4f) * (i % 7 + 1);
+    }
+
+    auto sumChunk = [&](const Range<uint32_t>& chunk) {
+        auto partialSum = 0.f;
+        for(auto i: chunk) {
+            partialSum += values[i];
+        }
+        return partialSum;
+    };
+
+    std::vector<float> chunkSums;
+    for(auto chunkBegin = 0u; chunkBegin < size; chunkBegin += chunkSize) {
+        chunkSums.emplace_back(sumChunk(Range<uint32_t>(chunkBegin, std::min(chunkBegin + chunkSize, size))));
+    }
+    auto expected = treeReduce(chunkSums.size(), [&](std::size_t i) {
+        return chunkSums[i];
+    }, std::plus<float>());
+
+    for(auto run = 0u; run < 8u; ++run) {
+        auto sum = parallelReduceDeterminist(range(size), 0.f, sumChunk, std::plus<float>(), chunkSize);
+        ASSERT_EQ(expected, sum);
+    }
+}
+
+TEST(ThreadsTest, PinnedBlocksRunOnTheSameThread) {
+    const auto blockCount = getPinnedBlockCount();
+    std::vector<std::thread::id> blockThreads(blockCount);
+
+    processTasksPinned(blockCount * 100u, [&](std::size_t taskID, uint32_t blockID) {
+        blockThreads[blockID] = std::this_thread::get_id();
+    });
+
+    for(auto run = 0u; run < 4u; ++run) {
+        std::vector<uint32_t> taskCounts(blockCount, 0u);
+        processTasksPinned(blockCount * 100u, [&](std::size_t taskID, uint32_t blockID) {
+            ASSERT_EQ(blockThreads[blockID], std::this_thread::get_id());
+            ++taskCounts[blockID];
+        });
+        for(auto count: taskCounts) {
+            ASSERT_EQ(100u, count);
+        }
+    }
+}
+
+TEST(ThreadsTest, ThreadContextIsPrivateToEachThread) {
+    const auto threadCount = 4u;
+    std::vector<uint32_t> threadIDs(threadCount);
+    std::vector<uint8_t> debugFlags(threadCount); // Not vector<bool>: its elements share bytes
+
+    std::vector<std::thread> threads;
+    for(auto i = 0u; i < threadCount; ++i) {
+        threads.emplace_back([&, i]() {
+            CurrentThreadDebugFlagRAII debugFlag(i % 2u == 0u);
+            threadIDs[i] = getCurrentThreadID();
+            debugFlags[i] = isCurrentThreadDebugFlagEnabled();
+        });
+    }
+    for(auto& thread: threads) {
+        thread.join();
+    }
+
+    for(auto i = 0u; i < threadCount; ++i) {
+        ASSERT_EQ(i % 2u == 0u, bool(debugFlags[i]));
+        for(auto j = i + 1; j < threadCount; ++j) {
+            ASSERT_NE(threadIDs[i], threadIDs[j]);
+        }
+    }
+    ASSERT_FALSE(isCurrentThreadDebugFlagEnabled());
+}
+
+TEST(ThreadsTest, ScratchArenaScopeReusesMemory) {
+    ScratchArena arena(256);
+
+    float* first = nullptr;
+    {
+        ScratchArenaScope scope(arena);
+        first = arena.allocate<float>(16);
+        auto big = arena.allocate<double>(1024);
+        ASSERT_EQ(0u, reinterpret_cast<std::uintptr_t>(big) % alignof(double));
+    }
+    const auto capacity = arena.getCapacity();
+    {
+        ScratchArenaScope scope(arena);
+        ASSERT_EQ(first, arena.allocate<float>(16));
+        arena.allocate<double>(1024);
+    }
+    ASSERT_EQ(capacity, arena.getCapacity());
+}
+
+}
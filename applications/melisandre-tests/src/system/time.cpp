@@ -0,0 +1,35 @@
+#include <gtest/gtest.h>
+
+#include <melisandre/system/time.hpp>
+
+namespace mls {
+
+TEST(TimeTest, TaskTimerSumsItemsAndCountersOverThreads) {
+    const auto threadCount = 4u;
+    TaskTimer timer({ "Task0", "Task1" }, threadCount, true);
+
+    launchThreads([&](uint32_t threadID) {
+        for(auto i = 0u; i < 2u; ++i) {
+            auto scope = timer.start(1, threadID, 10u);
+            volatile auto sum = 0u;
+            for(auto j = 0u; j < 10000u; ++j) {
+                sum += j;
+            }
+        }
+    }, threadCount);
+
+    EXPECT_EQ(0u, timer.getItemCount(0));
+    EXPECT_EQ(2u * 10u * threadCount, timer.getItemCount(1));
+
+    PerfCounterValues values;
+    if(readCurrentThreadPerfCounters(values) && (getCurrentThreadPerfCounterFlags() & PERF_COUNTER_INSTRUCTIONS)) {
+        EXPECT_EQ(0u, timer.getPerfCounters(0).m_nInstructions);
+        EXPECT_LT(0u, timer.getPerfCounters(1).m_nInstructions);
+    }
+
+    const auto statistics = computeTaskStatistics<Microseconds>(timer);
+    ASSERT_EQ(2u, statistics.size());
+    EXPECT_EQ(timer.getItemCount(1), statistics[1].m_nItemCount);
+}
+
+}
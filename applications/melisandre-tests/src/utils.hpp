@@ -1,7 +1,12 @@
 #pragma once
 
 #include <vector>
+#include <random>
+#include <utility>
+#include <algorithm>
+#include <limits>
 #include <melisandre/maths/types.hpp>
+#include <melisandre/maths/geometry.hpp>
 
 namespace mls {
 
@@ -20,4 +25,37 @@ inline std::vector<float2> makeUVGridTest(size_t width, size_t height) {
     return uvGrid;
 }
 
+// Points uniformly distributed in the unit cube, drawn from rng
+inline std::vector<float3> makeUniformPointsTest(size_t count, std::mt19937& rng) {
+    std::uniform_real_distribution<float> uniform(0.f, 1.f);
+    std::vector<float3> points(count);
+    for(auto& point: points) {
+        point = float3(uniform(rng), uniform(rng), uniform(rng));
+    }
+    return points;
+}
+
+// Squared distances and indices of the points i such that isAccepted(i), at a squared distance of at most
+// maxDistanceSquared from point, by increasing distance then index
+template<typename IsAccepted>
+inline std::vector<std::pair<float, uint32_t>> searchBruteForceTest(const std::vector<float3>& points, const float3& point,
+                                                                    float maxDistanceSquared, IsAccepted isAccepted) {
+    std::vector<std::pair<float, uint32_t>> neighbours;
+    for(auto i = 0u; i < points.size(); ++i) {
+        if(isAccepted(i)) {
+            const auto distSquared = sqr_distance(point, points[i]);
+            if(distSquared <= maxDistanceSquared) {
+                neighbours.emplace_back(distSquared, i);
+            }
+        }
+    }
+    std::sort(begin(neighbours), end(neighbours));
+    return neighbours;
+}
+
+inline std::vector<std::pair<float, uint32_t>> searchBruteForceTest(const std::vector<float3>& points, const float3& point,
+                                                                    float maxDistanceSquared = std::numeric_limits<float>::infinity()) {
+    return searchBruteForceTest(points, point, maxDistanceSquared, [](uint32_t) { return true; });
+}
+
 }
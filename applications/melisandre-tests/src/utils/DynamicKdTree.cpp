@@ -0,0 +1,72 @@
+#include <gtest/gtest.h>
+
+#include <random>
+#include <melisandre/utils/DynamicKdTree.hpp>
+
+#include "../utils.hpp"
+
+namespace mls {
+
+TEST(DynamicKdTreeTest, QueriesMatchBruteForceAfterInsertionsAndRemovals) {
+    const auto indexCount = 3000u;
+    std::mt19937 rng(23);
+    std::uniform_real_distribution<float> uniform(0.f, 1.f);
+    std::uniform_int_distribution<uint32_t> randomIndex(0u, indexCount - 1u);
+
+    for(auto layout: { KdTreeLayout::PointPerNode, KdTreeLayout::Bucketed }) {
+        DynamicKdTree tree(layout);
+        // Position of each index in the set, NaN if absent
+        std::vector<Vec3f> positions(indexCount, Vec3f(std::numeric_limits<float>::quiet_NaN()));
+        auto contains = [&](uint32_t i) { return positions[i] == positions[i]; };
+        // One query every 500 steps
+        const auto queries = makeUniformPointsTest(40u, rng);
+
+        for(auto step = 0u; step < 20000u; ++step) {
+            const auto index = randomIndex(rng);
+            // Insert more than remove at the beginning, then the opposite
+            if(uniform(rng) < (step < 10000u ? 0.2f : 0.7f)) {
+                EXPECT_EQ(contains(index), tree.remove(index));
+                positions[index] = Vec3f(std::numeric_limits<float>::quiet_NaN());
+            } else {
+                positions[index] = Vec3f(uniform(rng), uniform(rng), uniform(rng));
+                tree.insert(index, positions[index]);
+            }
+
+            if(step % 500u) {
+                continue;
+            }
+            const auto expectedSize = size_t(std::count_if(begin(positions), end(positions), [](const Vec3f& p) { return p == p; }));
+            ASSERT_EQ(expectedSize, tree.size());
+
+            const auto& point = queries[step / 500u];
+            const auto expected = searchBruteForceTest(positions, point, std::numeric_limits<float>::infinity(), contains);
+            auto expectedCount = 0u;
+            for(const auto& neighbour: expected) {
+                expectedCount += neighbour.first < 0.01f;
+            }
+
+            auto count = 0u;
+            tree.search(point, 0.01f, [&](uint32_t i, const Vec3f& position, float, float&) {
+                EXPECT_EQ(positions[i], position);
+                ++count;
+            });
+            EXPECT_EQ(expectedCount, count);
+
+            float distSquared;
+            const auto nearest = tree.searchNearestNeighbour(point, distSquared);
+            if(!expected.empty()) {
+                EXPECT_EQ(expected[0].first, distSquared);
+                EXPECT_EQ(sqr_distance(point, positions[nearest]), distSquared);
+            }
+
+            auto neighbour = 0u;
+            tree.searchKNearestNeighbours(point, 10u, [&](uint32_t i, const Vec3f&, float distSquared) {
+                EXPECT_EQ(expected[neighbour].first, distSquared);
+                ++neighbour;
+            });
+            EXPECT_EQ(std::min(size_t(10u), expected.size()), neighbour);
+        }
+    }
+}
+
+}
@@ -0,0 +1,108 @@
+#include <gtest/gtest.h>
+
+#include <random>
+#include <algorithm>
+#include <melisandre/utils/HashGrid.hpp>
+
+#include "../utils.hpp"
+
+namespace mls {
+
+struct TestParticle {
+    Vec3f m_Position;
+    bool m_bValid;
+};
+
+inline const Vec3f& getPosition(const TestParticle& particle) {
+    return particle.m_Position;
+}
+
+inline bool isValid(const TestParticle& particle) {
+    return particle.m_bValid;
+}
+
+TEST(HashGridTest, QueriesMatchBruteForce) {
+    std::mt19937 rng(31);
+    std::uniform_real_distribution<float> uniform(0.f, 1.f);
+
+    // Enough particles for the build to be split in several chunks. With few cells, the Reordered layout
+    // skips the particles of the colliding cells. 0 cells lets the build choose the number of cells: for
+    // a few particles with a large radius, neighbour cells of a query then often share a bucket.
+    struct Configuration {
+        uint32_t m_nParticleCount;
+        float m_fRadius;
+        HashGridLayout m_Layout;
+        int m_nCellCount;
+    };
+    const Configuration configurations[] = {
+        { 100000u, 0.02f, HashGridLayout::Indirect, 0 },
+        { 100000u, 0.02f, HashGridLayout::Reordered, 0 },
+        { 100000u, 0.02f, HashGridLayout::Indirect, 100000 },
+        { 100000u, 0.02f, HashGridLayout::Reordered, 61 },
+        { 50u, 0.1f, HashGridLayout::Indirect, 0 },
+        { 200u, 0.1f, HashGridLayout::Indirect, 0 },
+        { 50u, 0.1f, HashGridLayout::Reordered, 0 }
+    };
+    for(const auto& configuration: configurations) {
+        const auto positions = makeUniformPointsTest(configuration.m_nParticleCount, rng);
+        std::vector<TestParticle> particles(positions.size());
+        for(auto i = 0u; i < particles.size(); ++i) {
+            particles[i] = TestParticle { positions[i], uniform(rng) < 0.9f };
+        }
+        auto isValidIndex = [&](uint32_t i) { return particles[i].m_bValid; };
+        const auto radius = configuration.m_fRadius;
+
+        HashGrid grid(configuration.m_Layout);
+        grid.Reserve(configuration.m_nCellCount);
+        grid.build(particles.data(), uint32_t(particles.size()), radius);
+
+        if(configuration.m_nCellCount) {
+            EXPECT_EQ(configuration.m_nCellCount, grid.getCellCount());
+        } else if(particles.size() > 10000u) {
+            // Fewer cells of size 2 * radius in the bounding box than particles
+            EXPECT_GT(grid.getCellCount(), 10000);
+            EXPECT_LT(grid.getCellCount(), int(particles.size()));
+        } else {
+            EXPECT_LE(grid.getCellCount(), int(particles.size()));
+        }
+
+        const auto queries = makeUniformPointsTest(200u, rng);
+        std::vector<float> queryRadii(queries.size());
+        for(auto query = 0u; query < queries.size(); ++query) {
+            queryRadii[query] = query % 2u ? radius : radius * uniform(rng);
+        }
+        // Each query of the batch is processed by a single thread, so it can fill its own vector
+        std::vector<std::vector<uint32_t>> batchFound(queries.size());
+        std::vector<int> batchCounts(queries.size());
+        grid.processBatch(particles.data(), queries.data(), queryRadii.data(), uint32_t(queries.size()),
+                          [&](uint32_t query, const TestParticle& particle) {
+            batchFound[query].push_back(uint32_t(&particle - particles.data()));
+        }, batchCounts.data());
+
+        for(auto query = 0u; query < queries.size(); ++query) {
+            const auto& point = queries[query];
+            auto getExpected = [&](float queryRadius) {
+                std::vector<uint32_t> expected;
+                for(const auto& neighbour: searchBruteForceTest(positions, point, sqr(queryRadius), isValidIndex)) {
+                    expected.push_back(neighbour.second);
+                }
+                std::sort(begin(expected), end(expected));
+                return expected;
+            };
+            std::vector<uint32_t> found;
+            const auto count = grid.process(particles.data(), point, [&](const TestParticle& particle) {
+                found.push_back(uint32_t(&particle - particles.data()));
+            });
+            EXPECT_EQ(int(found.size()), count);
+            std::sort(begin(found), end(found));
+            EXPECT_EQ(getExpected(radius), found);
+
+            const auto expected = getExpected(queryRadii[query]);
+            EXPECT_EQ(int(expected.size()), batchCounts[query]);
+            std::sort(begin(batchFound[query]), end(batchFound[query]));
+            EXPECT_EQ(expected, batchFound[query]);
+        }
+    }
+}
+
+}
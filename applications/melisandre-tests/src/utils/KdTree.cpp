@@ -0,0 +1,361 @@
+#include <gtest/gtest.h>
+
+#include <random>
+#include <fstream>
+#include <cstdio>
+#include <algorithm>
+#include <utility>
+#include <melisandre/utils/KdTree.hpp>
+
+#include "../utils.hpp"
+
+namespace mls {
+
+TEST(KdTreeTest, ParallelBuildMatchesBruteForceQueries) {
+    // Large enough to use the parallel partition, with duplicated positions
+    const auto count = 100000u;
+    std::mt19937 rng(7);
+    auto positions = makeUniformPointsTest(count, rng);
+    for(auto& position: positions) {
+        position.z = std::floor(8.f * position.z) / 8.f;
+    }
+    for(auto i = 0u; i < count / 10u; ++i) {
+        positions[i] = positions[count - 1 - i];
+    }
+
+    KdTree tree;
+    tree.build(count, [&](uint32_t i) { return positions[i]; }, [](uint32_t i) { return i % 5u != 0u; });
+    ASSERT_EQ(count - count / 5u, tree.size());
+
+    // Each node but the root has one parent
+    auto edgeCount = 0u;
+    tree.depthFirstTraversal([&](uint32_t, uint32_t) { ++edgeCount; });
+    EXPECT_EQ(tree.size() - 1, edgeCount);
+
+    for(const auto& point: makeUniformPointsTest(100u, rng)) {
+        const auto radiusSquared = 0.001f;
+        const auto expected = searchBruteForceTest(positions, point, std::numeric_limits<float>::infinity(),
+                                                   [](uint32_t i) { return i % 5u != 0u; });
+        const auto expectedCount = uint32_t(std::count_if(begin(expected), end(expected), [&](const std::pair<float, uint32_t>& neighbour) {
+            return neighbour.first < radiusSquared;
+        }));
+
+        auto foundCount = 0u;
+        tree.search(point, radiusSquared, [&](uint32_t i, const Vec3f&, float, float&) { ++foundCount; });
+        EXPECT_EQ(expectedCount, foundCount);
+
+        float distSquared;
+        tree.searchNearestNeighbour(point, distSquared);
+        EXPECT_EQ(expected[0].first, distSquared);
+    }
+}
+
+TEST(KdTreeTest, BucketedLayoutMatchesBruteForceQueries) {
+    // Sizes around the bucket capacity, and one large enough to use the parallel partition
+    std::mt19937 rng(11);
+    for(auto count: { 1u, 16u, 17u, 33u, 1000u, 100000u }) {
+        auto positions = makeUniformPointsTest(count, rng);
+        for(auto& position: positions) {
+            position.z = std::floor(8.f * position.z) / 8.f;
+        }
+
+        KdTree tree(KdTreeLayout::Bucketed);
+        tree.build(count, [&](uint32_t i) { return positions[i]; });
+        ASSERT_EQ(count, tree.size());
+
+        for(const auto& point: makeUniformPointsTest(20u, rng)) {
+            const auto radiusSquared = 0.01f;
+            const auto K = 8u;
+            const auto expected = searchBruteForceTest(positions, point);
+
+            auto expectedCount = 0u;
+            for(const auto& neighbour: expected) {
+                expectedCount += neighbour.first < radiusSquared;
+            }
+            auto foundCount = 0u;
+            tree.search(point, radiusSquared, [&](uint32_t i, const Vec3f& position, float distSquared, float&) {
+                EXPECT_EQ(positions[i], position);
+                EXPECT_EQ(sqr_distance(point, positions[i]), distSquared);
+                ++foundCount;
+            });
+            EXPECT_EQ(expectedCount, foundCount);
+
+            float distSquared;
+            const auto nearest = tree.searchNearestNeighbour(point, distSquared);
+            EXPECT_EQ(expected[0].first, distSquared);
+            EXPECT_EQ(sqr_distance(point, positions[nearest]), distSquared);
+
+            std::vector<float> neighbourDistancesSquared;
+            tree.searchKNearestNeighbours(point, K, [&](uint32_t i, const Vec3f&, float distSquared) {
+                EXPECT_EQ(sqr_distance(point, positions[i]), distSquared);
+                neighbourDistancesSquared.emplace_back(distSquared);
+            });
+            std::sort(begin(neighbourDistancesSquared), end(neighbourDistancesSquared));
+            ASSERT_EQ(std::min(K, count), neighbourDistancesSquared.size());
+            for(auto i = 0u; i < neighbourDistancesSquared.size(); ++i) {
+                EXPECT_EQ(expected[i].first, neighbourDistancesSquared[i]);
+            }
+        }
+    }
+}
+
+TEST(KdTreeTest, KNearestNeighboursMatchBruteForce) {
+    const auto count = 5000u;
+    std::mt19937 rng(13);
+    const auto positions = makeUniformPointsTest(count, rng);
+    // Every third element is rejected by the predicate
+    auto isAccepted = [](uint32_t i) { return i % 3u != 0u; };
+
+    for(auto layout: { KdTreeLayout::PointPerNode, KdTreeLayout::Bucketed }) {
+        KdTree tree(layout);
+        tree.build(count, [&](uint32_t i) { return positions[i]; });
+
+        // Sizes of the sorted neighbour lists and of the heap
+        for(auto K: { 1u, 5u, 20u, 100u }) {
+            for(const auto& point: makeUniformPointsTest(20u, rng)) {
+                const auto expected = searchBruteForceTest(positions, point, std::numeric_limits<float>::infinity(), isAccepted);
+                std::vector<float> expectedDistancesSquared;
+                for(auto i = 0u; i < K; ++i) {
+                    expectedDistancesSquared.emplace_back(expected[i].first);
+                }
+
+                std::vector<float> distancesSquared;
+                tree.searchKNearestNeighbours(point, K, isAccepted, [&](uint32_t i, const Vec3f& position, float distSquared) {
+                    EXPECT_TRUE(isAccepted(i));
+                    EXPECT_EQ(positions[i], position);
+                    distancesSquared.emplace_back(distSquared);
+                });
+                std::sort(begin(distancesSquared), end(distancesSquared));
+                EXPECT_EQ(expectedDistancesSquared, distancesSquared);
+            }
+        }
+    }
+}
+
+TEST(KdTreeTest, BatchQueriesMatchSingleQueries) {
+    std::mt19937 rng(17);
+    const auto positions = makeUniformPointsTest(20000u, rng);
+    const auto queries = makeUniformPointsTest(3000u, rng);
+
+    KdTree tree(KdTreeLayout::Bucketed);
+    tree.build(positions.size(), [&](uint32_t i) { return positions[i]; });
+
+    // The second batch reuses the buffers of the first one, with fewer queries and larger balls
+    KdTreeBatchResults results;
+    const std::pair<size_t, float> batches[] = { { queries.size(), 0.002f }, { queries.size() / 3u, 0.004f } };
+    for(const auto& batch: batches) {
+        const auto queryCount = batch.first;
+        const auto radiusSquared = batch.second;
+        tree.searchBatch(queries.data(), queryCount, radiusSquared, results);
+        ASSERT_EQ(queryCount, results.getQueryCount());
+        for(auto i = 0u; i < queryCount; ++i) {
+            std::vector<uint32_t> expectedIndices;
+            tree.search(queries[i], radiusSquared, [&](uint32_t index, const Vec3f&, float, float&) {
+                expectedIndices.emplace_back(index);
+            });
+            std::vector<uint32_t> indices(begin(results.m_Indices) + results.m_Offsets[i],
+                                          begin(results.m_Indices) + results.m_Offsets[i + 1]);
+            std::sort(begin(expectedIndices), end(expectedIndices));
+            std::sort(begin(indices), end(indices));
+            EXPECT_EQ(expectedIndices, indices);
+            for(auto j = results.m_Offsets[i]; j < results.m_Offsets[i + 1]; ++j) {
+                EXPECT_EQ(sqr_distance(queries[i], positions[results.m_Indices[j]]), results.m_DistancesSquared[j]);
+            }
+        }
+    }
+
+    const auto K = 10u;
+    tree.kNearestBatch(queries.data(), queries.size(), K, results);
+    ASSERT_EQ(queries.size() * K, results.m_Indices.size());
+    for(auto i = 0u; i < queries.size(); ++i) {
+        ASSERT_EQ(K, results.getResultCount(i));
+        auto j = results.m_Offsets[i];
+        tree.searchKNearestNeighbours(queries[i], K, [&](uint32_t index, const Vec3f&, float distSquared) {
+            EXPECT_EQ(distSquared, results.m_DistancesSquared[j]);
+            ++j;
+        });
+    }
+
+    tree.nearestBatch(queries.data(), queries.size(), results);
+    ASSERT_EQ(queries.size(), results.m_Indices.size());
+    for(auto i = 0u; i < queries.size(); ++i) {
+        float distSquared;
+        EXPECT_EQ(tree.searchNearestNeighbour(queries[i], distSquared), results.m_Indices[i]);
+        EXPECT_EQ(distSquared, results.m_DistancesSquared[i]);
+    }
+}
+
+TEST(KdTreeTest, ApproximateQueriesAreWithinEpsilon) {
+    std::mt19937 rng(23);
+    const auto positions = makeUniformPointsTest(5000u, rng);
+    const auto K = size_t(8);
+
+    for(auto layout: { KdTreeLayout::PointPerNode, KdTreeLayout::Bucketed }) {
+        KdTree tree(layout);
+        tree.build(positions.size(), [&](uint32_t i) { return positions[i]; });
+        KdTreeApproximation exact, approximation, leafLimit;
+        approximation.m_fEpsilon = 0.5f;
+        leafLimit.m_nMaxVisitedLeafCount = 2u;
+        const auto maxRatio = (1.f + approximation.m_fEpsilon) * (1.f + approximation.m_fEpsilon);
+        auto all = [](uint32_t) { return true; };
+
+        for(const auto& point: makeUniformPointsTest(200u, rng)) {
+            float expectedDistSquared, distSquared;
+            const auto expectedIndex = tree.searchNearestNeighbour(point, expectedDistSquared);
+            EXPECT_EQ(expectedIndex, tree.searchNearestNeighbour(point, distSquared, all, exact));
+            tree.searchNearestNeighbour(point, distSquared, all, approximation);
+            EXPECT_LE(distSquared, maxRatio * expectedDistSquared);
+            EXPECT_NE(std::numeric_limits<uint32_t>::max(), tree.searchNearestNeighbour(point, distSquared, all, leafLimit));
+            EXPECT_GE(distSquared, expectedDistSquared);
+
+            // The i-th approximate neighbour is at most (1 + epsilon) times farther than the i-th exact one
+            std::vector<float> expectedDistances, distances;
+            tree.searchKNearestNeighbours(point, K, [&](uint32_t, const Vec3f&, float d) { expectedDistances.push_back(d); });
+            tree.searchKNearestNeighbours(point, K, all, [&](uint32_t, const Vec3f&, float d) { distances.push_back(d); }, approximation);
+            ASSERT_EQ(expectedDistances.size(), distances.size());
+            for(auto i = 0u; i < K; ++i) {
+                EXPECT_LE(distances[i], maxRatio * expectedDistances[i]);
+            }
+        }
+    }
+}
+
+TEST(KdTreeTest, HigherDimensionsAndDoublesMatchBruteForce) {
+    std::mt19937 rng(29);
+    // Positions concatenated with unit normals
+    const auto positions = makeUniformPointsTest(4000u, rng), directions = makeUniformPointsTest(4000u, rng);
+    std::vector<KdTree6f::Point> points(positions.size());
+    for(auto i = 0u; i < points.size(); ++i) {
+        const auto normal = normalize(directions[i] - Vec3f(0.5f));
+        points[i] = KdTree6f::Point { { positions[i].x, positions[i].y, positions[i].z, normal.x, normal.y, normal.z } };
+    }
+    auto getDistanceSquared = [](const KdTree6f::Point& lhs, const KdTree6f::Point& rhs) {
+        auto distSquared = 0.f;
+        for(auto axis = 0u; axis < 6u; ++axis) {
+            distSquared += (lhs[axis] - rhs[axis]) * (lhs[axis] - rhs[axis]);
+        }
+        return distSquared;
+    };
+
+    for(auto layout: { KdTreeLayout::PointPerNode, KdTreeLayout::Bucketed }) {
+        KdTree6f tree(layout);
+        tree.build(points.size(), [&](uint32_t i) { return points[i]; });
+        KdTreeND<double, 3u> doubleTree(layout);
+        doubleTree.build(points.size(), [&](uint32_t i) { return double3(points[i][0], points[i][1], points[i][2]); });
+
+        for(auto query = 0u; query < 100u; ++query) {
+            const auto& point = points[query];
+            std::vector<uint32_t> expected;
+            for(auto i = 0u; i < points.size(); ++i) {
+                if(getDistanceSquared(points[i], point) < 0.04f) {
+                    expected.push_back(i);
+                }
+            }
+            std::vector<uint32_t> found;
+            tree.search(point, 0.04f, [&](uint32_t i, const KdTree6f::Point&, float distSquared, float&) {
+                EXPECT_EQ(getDistanceSquared(points[i], point), distSquared);
+                found.push_back(i);
+            });
+            std::sort(begin(found), end(found));
+            EXPECT_EQ(expected, found);
+
+            std::vector<float> distances;
+            for(const auto& other: points) {
+                distances.push_back(getDistanceSquared(other, point));
+            }
+            std::sort(begin(distances), end(distances));
+            auto rank = 0u;
+            tree.searchKNearestNeighbours(point, 8u, [&](uint32_t, const KdTree6f::Point&, float distSquared) {
+                EXPECT_EQ(distances[rank++], distSquared);
+            });
+            EXPECT_EQ(8u, rank);
+
+            double distSquared;
+            const double3 position(point[0], point[1], point[2]);
+            const auto nearest = doubleTree.searchNearestNeighbour(position + double3(1e-3), distSquared);
+            for(auto i = 0u; i < points.size(); ++i) {
+                EXPECT_GE(sqr_distance(double3(points[i][0], points[i][1], points[i][2]), position + double3(1e-3)), distSquared);
+            }
+            EXPECT_LT(nearest, points.size());
+        }
+    }
+
+    // A snapshot can only be mapped by a KdTree of the same type
+    const auto filepath = std::string("KdTreeTest_snapshot6f.kdtree");
+    KdTree6f tree;
+    tree.build(points.size(), [&](uint32_t i) { return points[i]; });
+    ASSERT_TRUE(tree.save(filepath));
+    KdTree6f mappedTree;
+    EXPECT_TRUE(mappedTree.map(filepath));
+    EXPECT_EQ(tree.size(), mappedTree.size());
+    KdTree otherTree;
+    EXPECT_FALSE(otherTree.map(filepath));
+    std::remove(filepath.c_str());
+}
+
+TEST(KdTreeTest, MappedSnapshotMatchesSavedTree) {
+    std::mt19937 rng(19);
+    const auto positions = makeUniformPointsTest(5000u, rng);
+    const auto filepath = std::string("KdTreeTest_snapshot.kdtree");
+
+    for(auto layout: { KdTreeLayout::PointPerNode, KdTreeLayout::Bucketed }) {
+        KdTree tree(layout);
+        tree.build(positions.size(), [&](uint32_t i) { return positions[i]; });
+        ASSERT_TRUE(tree.save(filepath));
+
+        KdTree mappedTree;
+        ASSERT_TRUE(mappedTree.map(filepath));
+        EXPECT_TRUE(mappedTree.isMapped());
+        EXPECT_EQ(layout, mappedTree.getLayout());
+        EXPECT_EQ(tree.size(), mappedTree.size());
+
+        // Copies share the mapping
+        const auto copiedTree = mappedTree;
+        for(const auto& point: makeUniformPointsTest(100u, rng)) {
+            float expectedDistSquared, distSquared;
+            const auto expectedIndex = tree.searchNearestNeighbour(point, expectedDistSquared);
+            EXPECT_EQ(expectedIndex, mappedTree.searchNearestNeighbour(point, distSquared));
+            EXPECT_EQ(expectedIndex, copiedTree.searchNearestNeighbour(point, distSquared));
+
+            auto expectedCount = 0u, count = 0u;
+            tree.search(point, 0.01f, [&](uint32_t, const Vec3f&, float, float&) { ++expectedCount; });
+            mappedTree.search(point, 0.01f, [&](uint32_t, const Vec3f&, float, float&) { ++count; });
+            EXPECT_EQ(expectedCount, count);
+        }
+    }
+
+    // Snapshots whose nodes reference nodes or items outside of the file are rejected. The nodes are
+    // the first section of the file, after the header, at offset 64.
+    auto mapCorruptedSnapshot = [&](KdTreeLayout layout, uint32_t count, const KdTree::KdNode& root) {
+        KdTree tree(layout);
+        tree.build(count, [&](uint32_t i) { return positions[i]; });
+        EXPECT_TRUE(tree.save(filepath));
+        {
+            std::fstream file(filepath, std::ios_base::binary | std::ios_base::in | std::ios_base::out);
+            file.seekp(64);
+            file.write(reinterpret_cast<const char*>(&root), sizeof(root));
+        }
+        KdTree mappedTree;
+        EXPECT_FALSE(mappedTree.map(filepath));
+        EXPECT_TRUE(mappedTree.empty());
+    };
+    KdTree::KdNode root;
+    root.setAsInnerNode(0.5f, 0u);
+    root.m_bHasLeftChild = true;
+    root.m_nRightChildIndex = 3u;
+    mapCorruptedSnapshot(KdTreeLayout::PointPerNode, 3u, root);
+    root.setAsBucket(4u, 8u);
+    mapCorruptedSnapshot(KdTreeLayout::Bucketed, 8u, root);
+
+    // Files which are not KdTree snapshots are rejected
+    {
+        std::ofstream out(filepath, std::ios_base::binary);
+        out << "This is not a KdTree, but it is long enough to contain a header";
+    }
+    KdTree tree;
+    EXPECT_FALSE(tree.map(filepath));
+    EXPECT_TRUE(tree.empty());
+    std::remove(filepath.c_str());
+}
+
+}
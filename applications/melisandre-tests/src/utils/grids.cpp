@@ -0,0 +1,57 @@
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <melisandre/utils/MultiDimensionalArray.hpp>
+#include <melisandre/utils/Grid3D.hpp>
+
+namespace mls {
+
+static bool isCacheLineAligned(const void* ptr) {
+    return reinterpret_cast<std::uintptr_t>(ptr) % CACHE_LINE_SIZE == 0u;
+}
+
+TEST(GridsTest, PaddedRowsStartOnCacheLines) {
+    Array2d<float> array(RowPadding::CacheLine, 13, 7);
+    EXPECT_EQ(16u, array.getRowPitch());
+    for(auto y = 0u; y < 7u; ++y) {
+        EXPECT_TRUE(isCacheLineAligned(&array(0u, y)));
+        for(auto x = 0u; x < 13u; ++x) {
+            array(x, y) = float(x + 13 * y);
+        }
+    }
+    for(auto y = 0u; y < 7u; ++y) {
+        EXPECT_EQ(float(13 * y + 12), array(12u, y));
+    }
+
+    Grid3D<Vec3f> grid(5, 3, 2, Vec3f(1.f), RowPadding::CacheLine);
+    EXPECT_EQ(16u, grid.getRowPitch());
+    auto count = 0u;
+    grid.forEach([&](uint32_t x, uint32_t y, uint32_t z, const Vec3f& value) {
+        EXPECT_TRUE(isCacheLineAligned(grid.getRowPtr(y, z)));
+        EXPECT_EQ(Vec3i(x, y, z), grid.coords(grid.offset(x, y, z)));
+        EXPECT_EQ(1.f, value.x);
+        ++count;
+    });
+    EXPECT_EQ(5u * 3u * 2u, count);
+}
+
+TEST(GridsTest, PinnedFirstTouchWritesAllElements) {
+    Grid3D<float> grid(67, 31, 29, 2.f, RowPadding::None, FirstTouchPolicy::PinnedWorkers);
+    ASSERT_EQ(67u * 31u * 29u, grid.size());
+    for(const auto& value: grid) {
+        ASSERT_EQ(2.f, value);
+    }
+
+    Array2d<uint32_t> array(RowPadding::CacheLine, FirstTouchPolicy::PinnedWorkers, 301, 203);
+    for(const auto& value: array) {
+        ASSERT_EQ(0u, value);
+    }
+    // The elements added by a resize are value-initialized by the calling thread
+    std::fill(array.begin(), array.end(), 5u);
+    array.resize(401, 203);
+    for(const auto& value: array) {
+        ASSERT_EQ(0u, value);
+    }
+}
+
+}
@@ -13,6 +13,8 @@
 #include <melisandre/viewer/gui.hpp>
 
 #include <melisandre/itertools/range.hpp>
+#include <melisandre/system/memory.hpp>
+#include <melisandre/system/threads.hpp>
 
 namespace mls
 {
@@ -159,11 +161,21 @@ class ComputeGraph
 public:
     typedef size_t NodeID;
 
+    // Containers used by the traversals, allocated in the scratch arena of the thread
+    using NodeSet = std::unordered_set<NodeID, std::hash<NodeID>, std::equal_to<NodeID>, ArenaAllocator<NodeID>>;
+    using NodeStack = std::stack<NodeID, ArenaVector<NodeID>>;
+
     ComputeGraph(const std::string& name) {}
 
     // @todo: there is a bug here in the toposort, find it
-    void compute(const std::unordered_set<NodeID>& visitSet) {
-        std::unordered_map<NodeID, size_t> parentCount;
+    void compute(const NodeSet& visitSet) {
+        auto& arena = visitSet.get_allocator().getArena();
+        ScratchArenaScope arenaScope(arena);
+
+        using ParentCountMap = std::unordered_map<NodeID, size_t, std::hash<NodeID>, std::equal_to<NodeID>,
+                                                  ArenaAllocator<std::pair<const NodeID, size_t>>>;
+        ParentCountMap parentCount(visitSet.size(), std::hash<NodeID>(), std::equal_to<NodeID>(),
+                                   ArenaAllocator<std::pair<const NodeID, size_t>>(arena));
         for (auto node : visitSet) {
             const auto& links = m_Nodes[node].inputLinks;
             parentCount[node] = std::count_if(begin(links), end(links), [&](const auto& linkIdx) {
@@ -171,7 +183,7 @@ public:
             });
         }
 
-        std::stack<NodeID> visitStack;
+        auto visitStack = makeNodeStack(arena);
         for (auto pair : parentCount) {
             if (pair.second == 0u) {
                 visitStack.emplace(pair.first);
@@ -196,18 +208,26 @@ public:
     }
 
     void compute() {
+        auto& arena = getCurrentThreadScratchArena();
+        ScratchArenaScope arenaScope(arena);
         auto r = range(size(m_Nodes));
-        compute(std::unordered_set<NodeID> { std::begin(r), std::end(r) });
+        auto visitSet = makeNodeSet(arena);
+        visitSet.insert(std::begin(r), std::end(r));
+        compute(visitSet);
     }
 
     void computeForward(NodeID srcNode) {
-        std::unordered_set<NodeID> visitSet;
+        auto& arena = getCurrentThreadScratchArena();
+        ScratchArenaScope arenaScope(arena);
+        auto visitSet = makeNodeSet(arena);
         depthFirstForwardNodeSearch(srcNode, [&](auto node) { return false; }, visitSet);
         compute(visitSet);
     }
 
     void computeBackward(NodeID srcNode) {
-        std::unordered_set<NodeID> visitSet;
+        auto& arena = getCurrentThreadScratchArena();
+        ScratchArenaScope arenaScope(arena);
+        auto visitSet = makeNodeSet(arena);
         depthFirstBackwardNodeSearch(srcNode, [&](auto node) { return false; }, visitSet);
         compute(visitSet);
     }
@@ -215,6 +235,14 @@ public:
     void drawGUI(size_t width, size_t height, bool* pOpened = nullptr);
 
 private:
+    static NodeSet makeNodeSet(ScratchArena& arena) {
+        return NodeSet(0u, std::hash<NodeID>(), std::equal_to<NodeID>(), ArenaAllocator<NodeID>(arena));
+    }
+
+    static NodeStack makeNodeStack(ScratchArena& arena) {
+        return NodeStack(ArenaVector<NodeID>(ArenaAllocator<NodeID>(arena)));
+    }
+
     struct NodeLink
     {
         size_t srcNodeIdx, srcNodeSlotIdx, dstNodeIdx, dstNodeSlotIdx;
@@ -236,8 +264,8 @@ private:
     int addLink(size_t srcNode, size_t outputIdx, size_t dstNode, size_t inputIdx);
 
     template<typename Functor>
-    bool depthFirstForwardNodeSearch(size_t srcNode, Functor&& predicate, std::unordered_set<NodeID>& visitSet) {
-        std::stack<NodeID> visitStack;
+    bool depthFirstForwardNodeSearch(size_t srcNode, Functor&& predicate, NodeSet& visitSet) {
+        auto visitStack = makeNodeStack(visitSet.get_allocator().getArena());
 
         visitStack.emplace(srcNode);
         visitSet.emplace(srcNode);
@@ -265,7 +293,9 @@ private:
 
     template<typename Functor>
     bool depthFirstForwardNodeSearch(size_t srcNode, Functor&& predicate) {
-        std::unordered_set<NodeID> visitSet;
+        auto& arena = getCurrentThreadScratchArena();
+        ScratchArenaScope arenaScope(arena);
+        auto visitSet = makeNodeSet(arena);
         return depthFirstForwardNodeSearch(srcNode, std::forward<Functor&&>(predicate), visitSet);
     }
 
@@ -276,8 +306,8 @@ private:
     }
 
     template<typename Functor>
-    bool depthFirstBackwardNodeSearch(size_t srcNode, Functor&& predicate, std::unordered_set<NodeID>& visitSet) {
-        std::stack<NodeID> visitStack;
+    bool depthFirstBackwardNodeSearch(size_t srcNode, Functor&& predicate, NodeSet& visitSet) {
+        auto visitStack = makeNodeStack(visitSet.get_allocator().getArena());
 
         visitStack.emplace(srcNode);
         visitSet.emplace(srcNode);
@@ -305,7 +335,9 @@ private:
 
     template<typename Functor>
     bool depthFirstBackwardNodeSearch(size_t srcNode, Functor&& predicate) {
-        std::unordered_set<NodeID> visitSet;
+        auto& arena = getCurrentThreadScratchArena();
+        ScratchArenaScope arenaScope(arena);
+        auto visitSet = makeNodeSet(arena);
         return depthFirstBackwardNodeSearch(srcNode, std::forward<Functor&&>(predicate), visitSet);
     }
 
@@ -7,6 +7,7 @@
 #include <embree2/rtcore.h>
 
 #include <iostream>
+#include <fstream>
 
 #pragma warning(push, 0)
 #include <OpenEXR/ImfInputFile.h>
@@ -19,6 +20,7 @@
 #include <melisandre/viewer/gui.hpp>
 #include <melisandre/maths/geometry.hpp>
 #include <melisandre/opengl/GLScreenFramebuffer.hpp>
+#include <melisandre/system/profiler.hpp>
 
 #include "ComputeGraph.hpp"
 
@@ -325,6 +327,8 @@ int main(int argc, char* argv[])
     int currentItem = 0;
 
     while (!done) {
+        MLS_PROFILE_SCOPE("Frame");
+
         windowManager.handleEvents();
 
         //// WINDOW 1: GRAPH
@@ -432,6 +436,11 @@ int main(int argc, char* argv[])
         }
         viewController.moveLocal(localTranslationVector, localRotationVector);
     }
+
+#ifdef MLS_ENABLE_PROFILER
+    std::ofstream traceFile("melisandre-viewer-trace.json");
+    writeChromeTrace(traceFile);
+#endif
         
 
     return 0;
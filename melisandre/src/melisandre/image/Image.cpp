@@ -457,6 +457,43 @@ namespace mls {
         }
     }
 
+    // Sums of squared errors and squared reference values, reduced deterministically over the pixels
+    struct SquareErrorSums {
+        Vec3f m_SumOfSquareError = zero<Vec3f>();
+        Vec3f m_RcpScaling = zero<Vec3f>();
+        uint32_t m_nFirstInvalidPixel = std::numeric_limits<uint32_t>::max(); // First pixel with NaN or inf error
+
+        friend SquareErrorSums operator +(const SquareErrorSums& lhs, const SquareErrorSums& rhs) {
+            SquareErrorSums result;
+            result.m_SumOfSquareError = lhs.m_SumOfSquareError + rhs.m_SumOfSquareError;
+            result.m_RcpScaling = lhs.m_RcpScaling + rhs.m_RcpScaling;
+            result.m_nFirstInvalidPixel = std::min(lhs.m_nFirstInvalidPixel, rhs.m_nFirstInvalidPixel);
+            return result;
+        }
+    };
+
+    static Vec3f normalizedDifference(Vec4f vRef, Vec4f vImage) {
+        if(vRef.a) vRef /= vRef.a;
+        if(vImage.a) vImage /= vImage.a;
+        return Vec3f(vRef) - Vec3f(vImage);
+    }
+
+    static Vec3f computeNMSE(const SquareErrorSums& sums) {
+        Vec3f rmse = sums.m_SumOfSquareError / sums.m_RcpScaling;
+
+        for(auto i: range(3)) {
+            if(sums.m_RcpScaling[i] == 0.f) {
+                if(sums.m_SumOfSquareError[i] == 0.f) {
+                    rmse[i] = 0.f;
+                } else {
+                    rmse[i] = std::numeric_limits<float>::max();
+                }
+            }
+        }
+
+        return rmse;
+    }
+
     static Vec3f computeNMSE(const Image& reference, const Image& image) {
         assert(reference.getSize() == image.getSize());
 
@@ -464,55 +501,37 @@ namespace mls {
         auto pRef = reference.getPixels();
         auto pImage = image.getPixels();
 
-        Vec3f sumOfSquareError = zero<Vec3f>();
-        Vec3f rcpScaling = zero<Vec3f>();
-
-        bool NaNDetected = false;
-        for(auto i: range(size)) {
-            auto vRef = *pRef;
-            auto vImage = *pImage;
-
-            // normalize values
-            if(vRef.a) vRef /= vRef.a;
-            if(vImage.a) vImage /= vImage.a;
+        const auto sums = parallelReduceDeterminist(range(size), SquareErrorSums(), [&](const Range<uint32_t>& pixels) {
+            SquareErrorSums partialSums;
+            for(auto i: pixels) {
+                const auto diff = normalizedDifference(pRef[i], pImage[i]);
 
-            const auto diff = Vec3f(vRef) - Vec3f(vImage);
+                if(!reduceLogicalOr(mls::isnan(diff)) && !reduceLogicalOr(mls::isinf(diff))) {
+                    auto vRef = pRef[i];
+                    if(vRef.a) vRef /= vRef.a;
 
-            if(!reduceLogicalOr(mls::isnan(diff)) && !reduceLogicalOr(mls::isinf(diff))) {
-                sumOfSquareError += sqr(diff);
-                rcpScaling += sqr(Vec3f(vRef));
-            } else {
-                if(!NaNDetected) {
-                    Vec2u pixel = getPixel(i, image.getSize());
-                    BNZ_START_DEBUG_LOG;
-                    debugLog() << "NaN or inf detected while evaluating RMSE for pixelID = " << i <<  " (x = " << pixel.x << ", y = " << pixel.y << ")" << std::endl;
-                    debugLog() << "Reference value = " << *pRef << std::endl;
-                    debugLog() << "Image value = " << *pImage << std::endl;
-                    debugLog() << "diff = " << diff << std::endl;
-                    NaNDetected = true;
+                    partialSums.m_SumOfSquareError += sqr(diff);
+                    partialSums.m_RcpScaling += sqr(Vec3f(vRef));
+                } else {
+                    partialSums.m_nFirstInvalidPixel = std::min(partialSums.m_nFirstInvalidPixel, i);
                 }
             }
-            ++pRef;
-            ++pImage;
-        }
+            return partialSums;
+        }, std::plus<SquareErrorSums>());
+
+        if(sums.m_nFirstInvalidPixel < size) {
+            const auto i = sums.m_nFirstInvalidPixel;
+            Vec2u pixel = getPixel(i, image.getSize());
+            BNZ_START_DEBUG_LOG;
+            debugLog() << "NaN or inf detected while evaluating RMSE for pixelID = " << i <<  " (x = " << pixel.x << ", y = " << pixel.y << ")" << std::endl;
+            debugLog() << "Reference value = " << pRef[i] << std::endl;
+            debugLog() << "Image value = " << pImage[i] << std::endl;
+            debugLog() << "diff = " << normalizedDifference(pRef[i], pImage[i]) << std::endl;
 
-        if(NaNDetected) {
             std::cerr << "NaN or inf detected in computeRMSE. See Debug Log for more information." << std::endl;
         }
 
-        Vec3f rmse = sumOfSquareError / rcpScaling;
-
-        for(auto i: range(3)) {
-            if(rcpScaling[i] == 0.f) {
-                if(sumOfSquareError[i] == 0.f) {
-                    rmse[i] = 0.f;
-                } else {
-                    rmse[i] = std::numeric_limits<float>::max();
-                }
-            }
-        }
-
-        return rmse;
+        return computeNMSE(sums);
     }
 
     Vec3f computeNormalizedRootMeanSquaredError(const Image& reference, const Image& image) {
@@ -526,23 +545,13 @@ namespace mls {
         auto pRef = reference.getPixels();
         auto pImage = image.getPixels();
 
-        Vec3f sumOfSquareError = zero<Vec3f>();
-
-        for(auto i: range(size)) {
-            auto vRef = *pRef;
-            auto vImage = *pImage;
-
-            // normalize values
-            if(vRef.a) vRef /= vRef.a;
-            if(vImage.a) vImage /= vImage.a;
-
-            const auto diff = Vec3f(vRef) - Vec3f(vImage);
-
-            sumOfSquareError += sqr(diff);
-
-            ++pRef;
-            ++pImage;
-        }
+        Vec3f sumOfSquareError = parallelReduceDeterminist(range(size), zero<Vec3f>(), [&](const Range<uint32_t>& pixels) {
+            Vec3f partialSum = zero<Vec3f>();
+            for(auto i: pixels) {
+                partialSum += sqr(normalizedDifference(pRef[i], pImage[i]));
+            }
+            return partialSum;
+        }, std::plus<Vec3f>());
 
         return sumOfSquareError / float(reference.getPixelCount());
     }
@@ -558,23 +567,13 @@ namespace mls {
         auto pRef = reference.getPixels();
         auto pImage = image.getPixels();
 
-        Vec3f sumOfAbsError = zero<Vec3f>();
-
-        for(auto i: range(size)) {
-            auto vRef = *pRef;
-            auto vImage = *pImage;
-
-            // normalize values
-            if(vRef.a) vRef /= vRef.a;
-            if(vImage.a) vImage /= vImage.a;
-
-            const auto diff = Vec3f(vRef) - Vec3f(vImage);
-
-            sumOfAbsError += abs(diff);
-
-            ++pRef;
-            ++pImage;
-        }
+        Vec3f sumOfAbsError = parallelReduceDeterminist(range(size), zero<Vec3f>(), [&](const Range<uint32_t>& pixels) {
+            Vec3f partialSum = zero<Vec3f>();
+            for(auto i: pixels) {
+                partialSum += abs(normalizedDifference(pRef[i], pImage[i]));
+            }
+            return partialSum;
+        }, std::plus<Vec3f>());
 
         return sumOfAbsError / float(reference.getPixelCount());
     }
@@ -588,44 +587,24 @@ namespace mls {
         auto pRef = reference.getPixels();
         auto pImage = image.getPixels();
 
-        Vec3f sumOfSquareError = zero<Vec3f>();
-        Vec3f rcpScaling = zero<Vec3f>();
+        const auto sums = parallelReduceDeterminist(range(size), SquareErrorSums(), [&](const Range<uint32_t>& pixels) {
+            SquareErrorSums partialSums;
+            for(auto i: pixels) {
+                auto vRef = pRef[i];
+                if(vRef.a) vRef /= vRef.a;
 
-        for(auto i = 0u; i < size; ++i) {
-            auto vRef = *pRef;
-            auto vImage = *pImage;
-
-            if(vRef.a) vRef /= vRef.a;
-            if(vImage.a) vImage /= vImage.a;
-
-            const auto diff = Vec3f(vRef) - Vec3f(vImage);
-            const auto sqrDiff = sqr(diff);
-
-            const auto sqrRef = sqr(Vec3f(vRef));
-
-            auto value = sqrDiff;
-
-            squareErrorImage[i] = Vec4f(value, 1.f);
-
-            sumOfSquareError += sqrDiff;
-            rcpScaling += sqrRef;
-
-            ++pRef;
-            ++pImage;
-        }
+                const auto sqrDiff = sqr(normalizedDifference(pRef[i], pImage[i]));
+                const auto sqrRef = sqr(Vec3f(vRef));
 
-        Vec3f rmse = sumOfSquareError / rcpScaling;
+                squareErrorImage[i] = Vec4f(sqrDiff, 1.f);
 
-        for(auto i: range(3)) {
-            if(rcpScaling[i] == 0.f) {
-                if(sumOfSquareError[i] == 0.f) {
-                    rmse[i] = 0.f;
-                } else {
-                    rmse[i] = std::numeric_limits<float>::max();
-                }
+                partialSums.m_SumOfSquareError += sqrDiff;
+                partialSums.m_RcpScaling += sqrRef;
             }
-        }
-        nrmse = sqrt(rmse);
+            return partialSums;
+        }, std::plus<SquareErrorSums>());
+
+        nrmse = sqrt(computeNMSE(sums));
 
         return squareErrorImage;
     }
@@ -639,36 +618,54 @@ namespace mls {
         auto pRef = reference.getPixels();
         auto pImage = image.getPixels();
 
-        for(auto i = 0u; i < size; ++i) {
-            auto vRef = *pRef;
-            auto vImage = *pImage;
-
-            if(vRef.a) vRef /= vRef.a;
-            if(vImage.a) vImage /= vImage.a;
+        parallelFor(range(size), 0u, [&](const Range<uint32_t>& pixels) {
+            for(auto i: pixels) {
+                auto vRef = pRef[i];
+                auto vImage = pImage[i];
 
-            const auto diff = Vec3f(vRef) - Vec3f(vImage);
-            auto value = abs(diff);
+                if(vRef.a) vRef /= vRef.a;
+                if(vImage.a) vImage /= vImage.a;
 
-            absoluteErrorImage[i] = Vec4f(value, 1.f);
+                const auto diff = Vec3f(vRef) - Vec3f(vImage);
+                auto value = abs(diff);
 
-            ++pRef;
-            ++pImage;
-        }
+                absoluteErrorImage[i] = Vec4f(value, 1.f);
+            }
+        });
 
         return absoluteErrorImage;
     }
 
+    struct ValueSums {
+        Vec3f m_Sum = zero<Vec3f>();
+        Vec3f m_SumOfSquares = zero<Vec3f>();
+
+        friend ValueSums operator +(const ValueSums& lhs, const ValueSums& rhs) {
+            ValueSums result;
+            result.m_Sum = lhs.m_Sum + rhs.m_Sum;
+            result.m_SumOfSquares = lhs.m_SumOfSquares + rhs.m_SumOfSquares;
+            return result;
+        }
+    };
+
     void computeImageStatistics(const Image& image, Vec3f& sum, Vec3f& mean, Vec3f& variance) {
-        sum = zero<Vec3f>();
-        mean = zero<Vec3f>();
-        variance = zero<Vec3f>();
-        for(const auto& value: image) {
-            if(value.a) {
-                auto tmp = Vec3f(value) / value.a;
-                sum += tmp;
-                variance += sqr(tmp);
+        auto pPixels = image.getPixels();
+
+        const auto sums = parallelReduceDeterminist(range(image.getPixelCount()), ValueSums(), [&](const Range<uint32_t>& pixels) {
+            ValueSums partialSums;
+            for(auto i: pixels) {
+                const auto& value = pPixels[i];
+                if(value.a) {
+                    auto tmp = Vec3f(value) / value.a;
+                    partialSums.m_Sum += tmp;
+                    partialSums.m_SumOfSquares += sqr(tmp);
+                }
             }
-        }
+            return partialSums;
+        }, std::plus<ValueSums>());
+
+        sum = sums.m_Sum;
+        variance = sums.m_SumOfSquares;
         mean = sum / float(image.getPixelCount());
         variance = variance / float(image.getPixelCount()) - sqr(mean);
     }
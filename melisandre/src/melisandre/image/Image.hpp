@@ -5,6 +5,7 @@
 
 #include <melisandre/types.hpp>
 #include <melisandre/system/memory.hpp>
+#include <melisandre/system/threads.hpp>
 #include <melisandre/system/files.hpp>
 
 #include <melisandre/opengl/utils/GLTexture.hpp>
@@ -13,20 +14,37 @@ namespace mls {
 
     class Framebuffer;
 
+    // The pixels are stored in a cache line aligned buffer, in huge pages for large images constructed with
+    // PageSize::Large, with packed rows since they are uploaded as is to OpenGL and addressed by pixel index.
+    // The pixels of a new image are written by the constructing thread, or by the workers of
+    // processTasksPinned with FirstTouchPolicy::PinnedWorkers.
     class Image {
+        using PixelVector = std::vector<Vec4f, UninitializedAllocator<PageSizeAllocator<Vec4f>>>;
     public:
-        typedef std::vector<Vec4f>::iterator iterator;
-        typedef std::vector<Vec4f>::const_iterator const_iterator;
+        typedef PixelVector::iterator iterator;
+        typedef PixelVector::const_iterator const_iterator;
 
         Image() = default;
 
-        Image(uint32_t w, uint32_t h, const Vec4f* pixels = nullptr) :
-            m_nWidth(w), m_nHeight(h), m_Pixels(m_nWidth * m_nHeight) {
+        Image(uint32_t w, uint32_t h, const Vec4f* pixels = nullptr, PageSize pageSize = PageSize::Default) :
+            m_nWidth(w), m_nHeight(h), m_Pixels(PageSizeAllocator<Vec4f>(pageSize)) {
             if (pixels) {
-                std::copy(pixels, pixels + m_Pixels.size(), std::begin(m_Pixels));
+                m_Pixels.assign(pixels, pixels + m_nWidth * m_nHeight);
+            } else {
+                m_Pixels.assign(m_nWidth * m_nHeight, Vec4f());
             }
         }
+
+        Image(uint32_t w, uint32_t h, FirstTouchPolicy firstTouch, PageSize pageSize = PageSize::Default) :
+            m_nWidth(w), m_nHeight(h), m_Pixels(PageSizeAllocator<Vec4f>(pageSize)) {
+            assignFirstTouch(m_Pixels, m_nWidth * m_nHeight, Vec4f(), firstTouch);
+        }
         
+        // The page size is kept by setSize and copy assignments
+        PageSize getPageSize() const {
+            return m_Pixels.get_allocator().getPageSize();
+        }
+
         uint32_t getWidth() const {
             return m_nWidth;
         }
@@ -40,7 +58,7 @@ namespace mls {
         }
 
         void setSize(uint32_t w, uint32_t h) {
-            m_Pixels.resize(w * h);
+            m_Pixels.resize(w * h, Vec4f());
             m_nWidth = w;
             m_nHeight = h;
         }
@@ -156,7 +174,7 @@ namespace mls {
 
     private:
         uint32_t m_nWidth = 0, m_nHeight = 0;
-        std::vector<Vec4f> m_Pixels;
+        PixelVector m_Pixels;
     };
 
     inline void fillTexture(GLTexture2D& texture, const Image& image) {
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstdint>
+
+#include "types.hpp"
+#include "aabb.hpp"
+
+namespace mls {
+
+// Number of bits of each coordinate in a 3D Morton code
+static const uint32_t MORTON_BITS_PER_AXIS = 10u;
+
+/**
+ * @brief spreadBitsBy3 insert two zero bits before each of the 10 lowest bits of value.
+ */
+inline uint32_t spreadBitsBy3(uint32_t value) {
+    value &= 0x3ffu;
+    value = (value | (value << 16)) & 0x030000ffu;
+    value = (value | (value << 8)) & 0x0300f00fu;
+    value = (value | (value << 4)) & 0x030c30c3u;
+    value = (value | (value << 2)) & 0x09249249u;
+    return value;
+}
+
+/**
+ * @brief computeMortonCode interleave the bits of 3D coordinates in [0, 1024[: sorting by Morton
+ * code orders the coordinates along a Z-order curve, which keeps close coordinates close in memory.
+ */
+inline uint32_t computeMortonCode(const uint3& coords) {
+    return spreadBitsBy3(coords.x) | (spreadBitsBy3(coords.y) << 1) | (spreadBitsBy3(coords.z) << 2);
+}
+
+/**
+ * @brief computeMortonCode compute the Morton code of a position quantized on a grid of 1024^3
+ * cells covering bound.
+ */
+inline uint32_t computeMortonCode(const float3& position, const BBox3f& bound) {
+    const auto maxCoord = float((1u << MORTON_BITS_PER_AXIS) - 1u);
+    const auto extent = bound.upper() - bound.lower();
+    auto coords = uint3(0u);
+    for(auto axis = 0u; axis < 3u; ++axis) {
+        if(extent[axis] > 0.f) {
+            coords[axis] = uint32_t(clamp(maxCoord * (position[axis] - bound.lower()[axis]) / extent[axis], 0.f, maxCoord));
+        }
+    }
+    return computeMortonCode(coords);
+}
+
+}
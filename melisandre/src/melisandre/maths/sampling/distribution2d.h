@@ -1,6 +1,7 @@
 #pragma once
 
 #include "distribution1d.h"
+#include <melisandre/system/threads.hpp>
 
 namespace mls
 {
@@ -8,18 +9,22 @@ namespace mls
         return height + 1 + height * (width + 1);
     }
 
+    // Rows are built in parallel: function(x, y) may be called concurrently from several threads
     template<typename Functor>
     void buildDistribution2D(const Functor& function, real* pBuffer, size_t width, size_t height) {
         auto rowCDFSize = width + 1;
         auto colCDFSize = height + 1;
 
-        auto ptr = pBuffer + colCDFSize;
-        for (auto y = 0u; y < height; ++y) {
-            buildDistribution1D([&](uint32_t x) {
-                return function(x, y);
-            }, ptr, width, pBuffer + y);
-            ptr += rowCDFSize;
-        }
+        // Enough rows per chunk to amortize the cost of a task
+        auto grainSize = std::max(1u, uint32_t(4096 / rowCDFSize));
+
+        parallelFor(range(uint32_t(height)), grainSize, [&](const Range<uint32_t>& rows) {
+            for (auto y: rows) {
+                buildDistribution1D([&](uint32_t x) {
+                    return function(x, y);
+                }, pBuffer + colCDFSize + y * rowCDFSize, width, pBuffer + y);
+            }
+        });
 
         buildDistribution1D([&](uint32_t y) { return pBuffer[y]; }, pBuffer, height);
     }
@@ -0,0 +1,144 @@
+#pragma once
+
+#include <cstdint>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define MLS_SIMD_USE_SSE
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+namespace mls {
+
+// Four floats processed by the same instructions: SSE on x86, a scalar loop elsewhere.
+// Only the operations needed by the batched distance tests of the spatial structures are provided.
+class SimdFloat4 {
+public:
+    static const uint32_t SIZE = 4u;
+
+    SimdFloat4() = default;
+
+    explicit SimdFloat4(float value) {
+#ifdef MLS_SIMD_USE_SSE
+        m_Values = _mm_set1_ps(value);
+#else
+        for(auto i = 0u; i < SIZE; ++i) {
+            m_Values[i] = value;
+        }
+#endif
+    }
+
+    // pValues does not need to be aligned
+    static SimdFloat4 load(const float* pValues) {
+        SimdFloat4 result;
+#ifdef MLS_SIMD_USE_SSE
+        result.m_Values = _mm_loadu_ps(pValues);
+#else
+        for(auto i = 0u; i < SIZE; ++i) {
+            result.m_Values[i] = pValues[i];
+        }
+#endif
+        return result;
+    }
+
+    void store(float* pValues) const {
+#ifdef MLS_SIMD_USE_SSE
+        _mm_storeu_ps(pValues, m_Values);
+#else
+        for(auto i = 0u; i < SIZE; ++i) {
+            pValues[i] = m_Values[i];
+        }
+#endif
+    }
+
+    friend SimdFloat4 operator +(const SimdFloat4& lhs, const SimdFloat4& rhs) {
+#ifdef MLS_SIMD_USE_SSE
+        return SimdFloat4(_mm_add_ps(lhs.m_Values, rhs.m_Values));
+#else
+        return apply(lhs, rhs, [](float a, float b) { return a + b; });
+#endif
+    }
+
+    friend SimdFloat4 operator -(const SimdFloat4& lhs, const SimdFloat4& rhs) {
+#ifdef MLS_SIMD_USE_SSE
+        return SimdFloat4(_mm_sub_ps(lhs.m_Values, rhs.m_Values));
+#else
+        return apply(lhs, rhs, [](float a, float b) { return a - b; });
+#endif
+    }
+
+    friend SimdFloat4 operator *(const SimdFloat4& lhs, const SimdFloat4& rhs) {
+#ifdef MLS_SIMD_USE_SSE
+        return SimdFloat4(_mm_mul_ps(lhs.m_Values, rhs.m_Values));
+#else
+        return apply(lhs, rhs, [](float a, float b) { return a * b; });
+#endif
+    }
+
+    // Bit i of the result is set if lhs[i] < rhs[i]
+    friend uint32_t lessThanMask(const SimdFloat4& lhs, const SimdFloat4& rhs) {
+#ifdef MLS_SIMD_USE_SSE
+        return uint32_t(_mm_movemask_ps(_mm_cmplt_ps(lhs.m_Values, rhs.m_Values)));
+#else
+        auto mask = 0u;
+        for(auto i = 0u; i < SIZE; ++i) {
+            mask |= uint32_t(lhs.m_Values[i] < rhs.m_Values[i]) << i;
+        }
+        return mask;
+#endif
+    }
+
+    // Bit i of the result is set if lhs[i] <= rhs[i]
+    friend uint32_t lessEqualMask(const SimdFloat4& lhs, const SimdFloat4& rhs) {
+#ifdef MLS_SIMD_USE_SSE
+        return uint32_t(_mm_movemask_ps(_mm_cmple_ps(lhs.m_Values, rhs.m_Values)));
+#else
+        auto mask = 0u;
+        for(auto i = 0u; i < SIZE; ++i) {
+            mask |= uint32_t(lhs.m_Values[i] <= rhs.m_Values[i]) << i;
+        }
+        return mask;
+#endif
+    }
+
+private:
+#ifdef MLS_SIMD_USE_SSE
+    explicit SimdFloat4(__m128 values): m_Values(values) {
+    }
+
+    __m128 m_Values;
+#else
+    template<typename Functor>
+    static SimdFloat4 apply(const SimdFloat4& lhs, const SimdFloat4& rhs, Functor f) {
+        SimdFloat4 result;
+        for(auto i = 0u; i < SIZE; ++i) {
+            result.m_Values[i] = f(lhs.m_Values[i], rhs.m_Values[i]);
+        }
+        return result;
+    }
+
+    float m_Values[SIZE];
+#endif
+};
+
+// Mask with the count lowest bits set, count in [0, 32[
+inline uint32_t getLowBitsMask(uint32_t count) {
+    return (1u << count) - 1u;
+}
+
+// Index of the lowest set bit of mask, which must not be 0. Used to iterate over the lanes of a mask:
+// for(; mask; mask &= mask - 1) { auto lane = findLowestSetBit(mask); ... }
+inline uint32_t findLowestSetBit(uint32_t mask) {
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return uint32_t(index);
+#else
+    return uint32_t(__builtin_ctz(mask));
+#endif
+}
+
+}
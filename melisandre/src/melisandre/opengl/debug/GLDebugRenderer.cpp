@@ -1,5 +1,6 @@
 #include "GLDebugRenderer.hpp"
 #include <melisandre/maths/maths.hpp>
+#include <melisandre/system/threads.hpp>
 
 namespace mls {
 
@@ -38,9 +39,13 @@ void GLDebugRenderer::render(const Mat4f& vpMatrix, const Mat4f& vMatrix) {
 
     m_Program.use();
 
+    // The transformed instances are copied in the scratch arena to not allocate each frame
+    auto& arena = getCurrentThreadScratchArena();
     for(auto pStream: m_Streams) {
-        std::vector<GLDebugObjectInstance> copy;
-        copy = pStream->m_ArrowInstances;
+        ScratchArenaScope arenaScope(arena);
+        ArenaVector<GLDebugObjectInstance> copy(arena);
+        copy.reserve(std::max(pStream->m_ArrowInstances.size(), pStream->m_SphereInstances.size()));
+        copy.assign(begin(pStream->m_ArrowInstances), end(pStream->m_ArrowInstances));
         for (auto& inst : copy) {
             inst.mvpMatrix = translate(scale(vpMatrix * inst.mvpMatrix, Vec3f(3.f, 1.f, 3.f)), Vec3f(0, 1, 0));
             inst.mvMatrix = translate(scale(vpMatrix * inst.mvpMatrix, Vec3f(3.f, 1.f, 3.f)), Vec3f(0, 1, 0));
@@ -49,7 +54,7 @@ void GLDebugRenderer::render(const Mat4f& vpMatrix, const Mat4f& vMatrix) {
         m_InstanceBuffer.setData(copy, GL_STREAM_DRAW);
         m_Cone.draw(m_InstanceBuffer.size());
 
-        copy = pStream->m_SphereInstances;
+        copy.assign(begin(pStream->m_SphereInstances), end(pStream->m_SphereInstances));
         for(auto& inst: copy) {
             inst.mvpMatrix = vpMatrix * inst.mvpMatrix;
             inst.mvMatrix = vMatrix * inst.mvMatrix;
@@ -58,7 +63,7 @@ void GLDebugRenderer::render(const Mat4f& vpMatrix, const Mat4f& vMatrix) {
         m_InstanceBuffer.setData(copy, GL_STREAM_DRAW);
         m_Sphere.draw(m_InstanceBuffer.size());
 
-        copy = pStream->m_ArrowInstances;
+        copy.assign(begin(pStream->m_ArrowInstances), end(pStream->m_ArrowInstances));
         for (auto& inst : copy) {
             inst.mvpMatrix = vpMatrix * inst.mvpMatrix;
             inst.mvMatrix = vMatrix * inst.mvMatrix;
@@ -113,7 +113,8 @@ public:
         glNamedBufferDataEXT(glId(), m_Size * sizeof(T), data, usage);
     }
 
-    void setData(const std::vector<T>& data, GLenum usage) {
+    template<typename Allocator>
+    void setData(const std::vector<T, Allocator>& data, GLenum usage) {
         setData(data.size(), data.data(), usage);
     }
 };
@@ -8,6 +8,9 @@
 #include <dirent.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 #else
 
@@ -80,22 +83,22 @@ private:
     DIR* m_pDir;
 };
 
-inline bool exists(const FilePath& path) {
+bool exists(const FilePath& path) {
     struct stat s;
     return 0 == stat(path.c_str(), &s);
 }
 
-inline bool isDirectory(const FilePath& path) {
+bool isDirectory(const FilePath& path) {
     struct stat s;
     return 0 == stat(path.c_str(), &s) && S_ISDIR(s.st_mode);
 }
 
-inline bool isRegularFile(const FilePath& path) {
+bool isRegularFile(const FilePath& path) {
     struct stat s;
     return 0 == stat(path.c_str(), &s) && S_ISREG(s.st_mode);
 }
 
-inline void createDirectory(const FilePath& path) {
+void createDirectory(const FilePath& path) {
     mkdir(path.c_str(), S_IRUSR | S_IWUSR | S_IXUSR | S_IROTH | S_IWOTH | S_IXOTH);
 }
 
@@ -107,6 +110,36 @@ std::vector<FilePath> getContainedFiles(const FilePath& directoryPath, bool rela
 
 }
 
+bool MappedFile::open(const FilePath& path) {
+    close();
+    auto fd = ::open(path.c_str(), O_RDONLY);
+    if(fd < 0) {
+        return false;
+    }
+    struct stat s;
+    if(fstat(fd, &s) || s.st_size <= 0) {
+        ::close(fd);
+        return false;
+    }
+    auto ptr = mmap(nullptr, std::size_t(s.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+    // The mapping remains valid after the file descriptor is closed
+    ::close(fd);
+    if(ptr == MAP_FAILED) {
+        return false;
+    }
+    m_pData = ptr;
+    m_nSize = std::size_t(s.st_size);
+    return true;
+}
+
+void MappedFile::close() {
+    if(m_pData) {
+        munmap(const_cast<void*>(m_pData), m_nSize);
+        m_pData = nullptr;
+        m_nSize = 0;
+    }
+}
+
 #else
 
 #ifdef _WIN32
@@ -165,6 +198,44 @@ std::vector<FilePath> getContainedFiles(const FilePath& directoryPath, bool extr
     return files;
 }
 
+bool MappedFile::open(const FilePath& path) {
+    close();
+    auto file = CreateFile(path.c_str(), GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+    if(file == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    LARGE_INTEGER fileSize;
+    if(!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart <= 0) {
+        CloseHandle(file);
+        return false;
+    }
+    auto mapping = CreateFileMapping(file, 0, PAGE_READONLY, 0, 0, 0);
+    auto ptr = mapping ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+    if(!ptr) {
+        if(mapping) {
+            CloseHandle(mapping);
+        }
+        CloseHandle(file);
+        return false;
+    }
+    m_pFileHandle = file;
+    m_pMappingHandle = mapping;
+    m_pData = ptr;
+    m_nSize = std::size_t(fileSize.QuadPart);
+    return true;
+}
+
+void MappedFile::close() {
+    if(m_pData) {
+        UnmapViewOfFile(m_pData);
+        CloseHandle(m_pMappingHandle);
+        CloseHandle(m_pFileHandle);
+        m_pData = nullptr;
+        m_pMappingHandle = m_pFileHandle = nullptr;
+        m_nSize = 0;
+    }
+}
+
 #endif
 
 #endif
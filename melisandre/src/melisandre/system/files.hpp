@@ -145,4 +145,42 @@ void foreachFile(const FilePath& directoryPath, const std::function<void(const F
 
 std::vector<FilePath> getContainedFiles(const FilePath& directoryPath, bool extractRelativePath = true);
 
+// Read-only mapping of a file in memory: the pages are loaded by the system when they are accessed
+class MappedFile {
+public:
+    MappedFile() = default;
+
+    ~MappedFile() {
+        close();
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator =(const MappedFile&) = delete;
+
+    // Map the file pointed by path, return false on failure
+    bool open(const FilePath& path);
+
+    void close();
+
+    bool isOpen() const {
+        return m_pData != nullptr;
+    }
+
+    const void* data() const {
+        return m_pData;
+    }
+
+    std::size_t size() const {
+        return m_nSize;
+    }
+
+private:
+    const void* m_pData = nullptr;
+    std::size_t m_nSize = 0;
+#ifdef _WIN32
+    void* m_pFileHandle = nullptr;
+    void* m_pMappingHandle = nullptr;
+#endif
+};
+
 }
\ No newline at end of file
@@ -0,0 +1,86 @@
+#include "memory.hpp"
+
+#include <atomic>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+namespace mls {
+
+// Set when a huge page allocation failed, to not pay a failing system call for each allocation
+static std::atomic<bool> s_bExplicitHugePagesUnavailable { false };
+
+#ifdef _WIN32
+
+void* largePageMalloc(std::size_t size) {
+    if(!s_bExplicitHugePagesUnavailable.load(std::memory_order_relaxed)) {
+        // Requires the SeLockMemoryPrivilege, which is rarely granted
+        auto largePageSize = GetLargePageMinimum();
+        if(largePageSize) {
+            auto ptr = VirtualAlloc(nullptr, roundUpToMultiple(size, largePageSize),
+                                    MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+            if(ptr) {
+                return ptr;
+            }
+        }
+        s_bExplicitHugePagesUnavailable.store(true, std::memory_order_relaxed);
+    }
+    return VirtualAlloc(nullptr, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+}
+
+void largePageFree(void* ptr, std::size_t) {
+    if(ptr) {
+        VirtualFree(ptr, 0, MEM_RELEASE);
+    }
+}
+
+#else
+
+void* largePageMalloc(std::size_t size) {
+    size = roundUpToMultiple(size, HUGE_PAGE_SIZE);
+#ifdef MAP_HUGETLB
+    // Explicit huge pages, only available if the administrator reserved some (vm.nr_hugepages)
+    if(!s_bExplicitHugePagesUnavailable.load(std::memory_order_relaxed)) {
+        auto ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if(ptr != MAP_FAILED) {
+            return ptr;
+        }
+        s_bExplicitHugePagesUnavailable.store(true, std::memory_order_relaxed);
+    }
+#endif
+    // Fallback on regular pages aligned on a huge page, that the kernel can back with transparent huge
+    // pages: over-allocate and unmap the unaligned head and tail
+    auto mappedSize = size + HUGE_PAGE_SIZE;
+    auto mapped = mmap(nullptr, mappedSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(mapped == MAP_FAILED) {
+        return nullptr;
+    }
+    auto address = reinterpret_cast<std::uintptr_t>(mapped);
+    auto alignedAddress = roundUpToMultiple(address, HUGE_PAGE_SIZE);
+    if(alignedAddress > address) {
+        munmap(mapped, alignedAddress - address);
+    }
+    if(address + mappedSize > alignedAddress + size) {
+        munmap(reinterpret_cast<void*>(alignedAddress + size), address + mappedSize - alignedAddress - size);
+    }
+    auto ptr = reinterpret_cast<void*>(alignedAddress);
+#ifdef MADV_HUGEPAGE
+    // Only a hint: fails silently if transparent huge pages are disabled
+    madvise(ptr, size, MADV_HUGEPAGE);
+#endif
+    return ptr;
+}
+
+void largePageFree(void* ptr, std::size_t size) {
+    if(ptr) {
+        munmap(ptr, roundUpToMultiple(size, HUGE_PAGE_SIZE));
+    }
+}
+
+#endif
+
+}
@@ -1,6 +1,17 @@
 #pragma once
 
 #include <memory>
+#include <cstdlib>
+#include <new>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <algorithm>
+#include <type_traits>
+
+#ifdef _WIN32
+#include <malloc.h>
+#endif
 
 namespace mls {
 
@@ -25,4 +36,508 @@ Unique<T[]> makeUniqueArray(size_t size) {
     return Unique<T[]>(new T[size]);
 }
 
+// Size of a cache line on the targeted architectures. Data written by different threads
+// should not share a cache line to avoid false sharing.
+static const std::size_t CACHE_LINE_SIZE = 64;
+
+inline std::size_t roundUpToMultiple(std::size_t size, std::size_t alignment) {
+    return ((size + alignment - 1) / alignment) * alignment;
+}
+
+// Row layout of the multidimensional containers (MultiDimensionalArray, Grid3D)
+enum class RowPadding {
+    None, // Rows are packed
+    CacheLine // Rows are padded so that each one starts on a cache line
+};
+
+// Number of elements of size elementSize stored for a row of count elements, so that the size in bytes
+// of the stored row is a multiple of alignment (a power of two). The padding is at most alignment bytes.
+inline std::size_t computePaddedRowLength(std::size_t count, std::size_t elementSize,
+                                          std::size_t alignment = CACHE_LINE_SIZE) {
+    // Largest power of two dividing elementSize
+    auto elementAlignment = std::min(elementSize & (~elementSize + 1), alignment);
+    return roundUpToMultiple(count, alignment / elementAlignment);
+}
+
+inline std::size_t computeRowLength(std::size_t count, std::size_t elementSize, RowPadding padding) {
+    return padding == RowPadding::CacheLine ? computePaddedRowLength(count, elementSize) : count;
+}
+
+// Allocate size bytes aligned on alignment, which must be a power of two multiple of sizeof(void*).
+// Returns nullptr on failure. The memory must be released with alignedFree.
+inline void* alignedMalloc(std::size_t size, std::size_t alignment) {
+#ifdef _WIN32
+    return _aligned_malloc(size, alignment);
+#else
+    void* ptr = nullptr;
+    if(posix_memalign(&ptr, alignment, size)) {
+        return nullptr;
+    }
+    return ptr;
+#endif
+}
+
+inline void alignedFree(void* ptr) {
+#ifdef _WIN32
+    _aligned_free(ptr);
+#else
+    free(ptr);
+#endif
+}
+
+// Size of the huge pages on the targeted architectures (x86-64 Linux)
+static const std::size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+// Allocate size bytes directly from the OS, in huge pages when possible to reduce TLB misses on large
+// buffers. Explicit huge pages (MAP_HUGETLB on Linux, MEM_LARGE_PAGES on Windows) are tried first, then
+// regular pages aligned on HUGE_PAGE_SIZE and advised for transparent huge pages. The memory is zeroed.
+// Returns nullptr on failure. The memory must be released with largePageFree and the same size.
+void* largePageMalloc(std::size_t size);
+
+void largePageFree(void* ptr, std::size_t size);
+
+// A STL allocator returning memory blocks aligned on Alignment. The size of each block is rounded up
+// to a multiple of Alignment so that two blocks never share an alignment unit (e.g. a cache line).
+template<typename T, std::size_t Alignment = CACHE_LINE_SIZE>
+class AlignedAllocator {
+    static_assert(Alignment >= alignof(T), "Alignment must be at least the alignment of T.");
+    static_assert((Alignment & (Alignment - 1)) == 0 && Alignment % sizeof(void*) == 0,
+                  "Alignment must be a power of two multiple of sizeof(void*).");
+public:
+    using value_type = T;
+
+    template<typename U>
+    struct rebind {
+        using other = AlignedAllocator<U, Alignment>;
+    };
+
+    AlignedAllocator() = default;
+
+    template<typename U>
+    AlignedAllocator(const AlignedAllocator<U, Alignment>&) {
+    }
+
+    T* allocate(std::size_t count) {
+        auto ptr = alignedMalloc(roundUpToMultiple(count * sizeof(T), Alignment), Alignment);
+        if(!ptr) {
+            throw std::bad_alloc();
+        }
+        return static_cast<T*>(ptr);
+    }
+
+    void deallocate(T* ptr, std::size_t) {
+        alignedFree(ptr);
+    }
+
+    template<typename U>
+    bool operator ==(const AlignedAllocator<U, Alignment>&) const {
+        return true;
+    }
+
+    template<typename U>
+    bool operator !=(const AlignedAllocator<U, Alignment>&) const {
+        return false;
+    }
+};
+
+// A STL allocator for multi-megabyte buffers: blocks of at least HUGE_PAGE_SIZE bytes are allocated with
+// largePageMalloc, smaller ones are cache line aligned like with AlignedAllocator.
+template<typename T>
+class LargePageAllocator {
+    static_assert(CACHE_LINE_SIZE >= alignof(T), "T cannot be aligned more than a cache line.");
+public:
+    using value_type = T;
+
+    template<typename U>
+    struct rebind {
+        using other = LargePageAllocator<U>;
+    };
+
+    LargePageAllocator() = default;
+
+    template<typename U>
+    LargePageAllocator(const LargePageAllocator<U>&) {
+    }
+
+    T* allocate(std::size_t count) {
+        const auto size = count * sizeof(T);
+        auto ptr = size >= HUGE_PAGE_SIZE ?
+                    largePageMalloc(size) :
+                    alignedMalloc(roundUpToMultiple(size, CACHE_LINE_SIZE), CACHE_LINE_SIZE);
+        if(!ptr) {
+            throw std::bad_alloc();
+        }
+        return static_cast<T*>(ptr);
+    }
+
+    void deallocate(T* ptr, std::size_t count) {
+        const auto size = count * sizeof(T);
+        if(size >= HUGE_PAGE_SIZE) {
+            largePageFree(ptr, size);
+        } else {
+            alignedFree(ptr);
+        }
+    }
+
+    template<typename U>
+    bool operator ==(const LargePageAllocator<U>&) const {
+        return true;
+    }
+
+    template<typename U>
+    bool operator !=(const LargePageAllocator<U>&) const {
+        return false;
+    }
+};
+
+// An allocator adaptor which does not write the elements constructed without arguments when they are
+// trivially copyable (other types are default-initialized): resizing a vector does not touch its new
+// elements, whose pages can then be first touched by other threads (see assignFirstTouch). The
+// containers using it must write the elements they add with resize(count).
+template<typename Alloc>
+class UninitializedAllocator: public Alloc {
+    using Traits = std::allocator_traits<Alloc>;
+public:
+    template<typename U>
+    struct rebind {
+        using other = UninitializedAllocator<typename Traits::template rebind_alloc<U>>;
+    };
+
+    UninitializedAllocator() = default;
+
+    UninitializedAllocator(const Alloc& allocator):
+        Alloc(allocator) {
+    }
+
+    template<typename OtherAlloc>
+    UninitializedAllocator(const UninitializedAllocator<OtherAlloc>& other):
+        Alloc(static_cast<const OtherAlloc&>(other)) {
+    }
+
+    template<typename U>
+    void construct(U* ptr) {
+        constructWithoutArguments(ptr, std::is_trivially_copyable<U>());
+    }
+
+    template<typename U, typename... Args>
+    void construct(U* ptr, Args&&... args) {
+        Traits::construct(static_cast<Alloc&>(*this), ptr, std::forward<Args>(args)...);
+    }
+
+private:
+    template<typename U>
+    void constructWithoutArguments(U* ptr, std::true_type) {
+    }
+
+    template<typename U>
+    void constructWithoutArguments(U* ptr, std::false_type) {
+        ::new(static_cast<void*>(ptr)) U;
+    }
+};
+
+// Pages backing the buffers of a PageSizeAllocator
+enum class PageSize {
+    Default, // Cache line aligned heap memory, like AlignedAllocator
+    Large // Huge pages for the blocks of at least HUGE_PAGE_SIZE bytes, like LargePageAllocator
+};
+
+// A STL allocator whose page size is chosen at runtime, for the containers that let each instance opt in
+// for large pages. Allocators of different page sizes are not equal: a copy assigned container keeps its
+// page size.
+template<typename T>
+class PageSizeAllocator {
+public:
+    using value_type = T;
+
+    template<typename U>
+    struct rebind {
+        using other = PageSizeAllocator<U>;
+    };
+
+    PageSizeAllocator() = default;
+
+    explicit PageSizeAllocator(PageSize pageSize):
+        m_PageSize(pageSize) {
+    }
+
+    template<typename U>
+    PageSizeAllocator(const PageSizeAllocator<U>& other):
+        m_PageSize(other.getPageSize()) {
+    }
+
+    PageSize getPageSize() const {
+        return m_PageSize;
+    }
+
+    T* allocate(std::size_t count) {
+        return m_PageSize == PageSize::Large ?
+                    LargePageAllocator<T>().allocate(count) : AlignedAllocator<T>().allocate(count);
+    }
+
+    void deallocate(T* ptr, std::size_t count) {
+        if(m_PageSize == PageSize::Large) {
+            LargePageAllocator<T>().deallocate(ptr, count);
+        } else {
+            AlignedAllocator<T>().deallocate(ptr, count);
+        }
+    }
+
+    template<typename U>
+    bool operator ==(const PageSizeAllocator<U>& other) const {
+        return m_PageSize == other.getPageSize();
+    }
+
+    template<typename U>
+    bool operator !=(const PageSizeAllocator<U>& other) const {
+        return m_PageSize != other.getPageSize();
+    }
+
+private:
+    PageSize m_PageSize = PageSize::Default;
+};
+
+// A monotonic buffer for short-lived temporary allocations. Memory is handed out by bumping an offset
+// in a list of blocks and is only given back by rewind() or reset(); the blocks are kept and reused,
+// so a warm arena does not allocate. The end of the outermost ScratchArenaScope trims the arena to
+// getMaxRetainedSize() bytes, so that a peak of usage does not stay allocated for the lifetime of the
+// arena. Not thread-safe: use one arena per thread.
+class ScratchArena {
+public:
+    static const std::size_t DEFAULT_MAX_RETAINED_SIZE = 4 * 1024 * 1024;
+
+    // Position in the arena, used to free everything allocated after it
+    struct Marker {
+        std::size_t m_nBlockIndex;
+        std::size_t m_nOffset;
+    };
+
+    explicit ScratchArena(std::size_t blockSize = 64 * 1024, std::size_t maxRetainedSize = DEFAULT_MAX_RETAINED_SIZE):
+        m_nBlockSize(blockSize), m_nMaxRetainedSize(maxRetainedSize) {
+    }
+
+    ~ScratchArena() {
+        for(const auto& block: m_Blocks) {
+            alignedFree(block.m_pData);
+        }
+    }
+
+    ScratchArena(const ScratchArena&) = delete;
+    ScratchArena& operator =(const ScratchArena&) = delete;
+
+    // Alignment must be a power of two
+    void* allocate(std::size_t size, std::size_t alignment = alignof(std::max_align_t)) {
+        while(m_nCurrentBlock < m_Blocks.size()) {
+            auto ptr = allocateInBlock(m_Blocks[m_nCurrentBlock], size, alignment);
+            if(ptr) {
+                return ptr;
+            }
+            ++m_nCurrentBlock;
+            m_nOffset = 0u;
+            // Blocks too small for this allocation are dropped so the next one can be larger
+            while(m_nCurrentBlock < m_Blocks.size() && m_Blocks[m_nCurrentBlock].m_nSize < size + alignment) {
+                alignedFree(m_Blocks[m_nCurrentBlock].m_pData);
+                m_Blocks.erase(begin(m_Blocks) + m_nCurrentBlock);
+            }
+        }
+        auto blockSize = std::max(roundUpToMultiple(size + alignment, CACHE_LINE_SIZE),
+                                  m_Blocks.empty() ? m_nBlockSize : 2 * m_Blocks.back().m_nSize);
+        auto data = static_cast<char*>(alignedMalloc(blockSize, CACHE_LINE_SIZE));
+        if(!data) {
+            throw std::bad_alloc();
+        }
+        m_Blocks.push_back({ data, blockSize });
+        ++m_nBlockAllocationCount;
+        m_nCurrentBlock = m_Blocks.size() - 1;
+        m_nOffset = 0u;
+        return allocateInBlock(m_Blocks.back(), size, alignment);
+    }
+
+    // Uninitialized storage for count objects of type T
+    template<typename T>
+    T* allocate(std::size_t count) {
+        return static_cast<T*>(allocate(count * sizeof(T), alignof(T)));
+    }
+
+    Marker getMarker() const {
+        return { m_nCurrentBlock, m_nOffset };
+    }
+
+    // Free everything allocated since marker was obtained
+    void rewind(const Marker& marker) {
+        m_nCurrentBlock = marker.m_nBlockIndex;
+        m_nOffset = marker.m_nOffset;
+    }
+
+    void reset() {
+        rewind({ 0u, 0u });
+    }
+
+    // Free the unused blocks, the largest first, until the capacity is at most maxRetainedSize. The blocks
+    // holding allocations are kept.
+    void trim(std::size_t maxRetainedSize) {
+        const auto usedBlockCount = std::min(m_Blocks.size(), m_nCurrentBlock + (m_nOffset ? 1u : 0u));
+        auto capacity = getCapacity();
+        while(capacity > maxRetainedSize && m_Blocks.size() > usedBlockCount) {
+            capacity -= m_Blocks.back().m_nSize;
+            alignedFree(m_Blocks.back().m_pData);
+            m_Blocks.pop_back();
+        }
+    }
+
+    std::size_t getMaxRetainedSize() const {
+        return m_nMaxRetainedSize;
+    }
+
+    // Total size of the blocks owned by the arena
+    std::size_t getCapacity() const {
+        auto capacity = std::size_t(0);
+        for(const auto& block: m_Blocks) {
+            capacity += block.m_nSize;
+        }
+        return capacity;
+    }
+
+    // Number of blocks allocated on the heap since the creation of the arena. It stops increasing once
+    // the arena is large enough for its peak usage.
+    std::size_t getBlockAllocationCount() const {
+        return m_nBlockAllocationCount;
+    }
+
+private:
+    struct Block {
+        char* m_pData;
+        std::size_t m_nSize;
+    };
+
+    void* allocateInBlock(const Block& block, std::size_t size, std::size_t alignment) {
+        auto address = reinterpret_cast<std::uintptr_t>(block.m_pData) + m_nOffset;
+        auto offset = m_nOffset + ((alignment - address % alignment) % alignment);
+        if(offset + size > block.m_nSize) {
+            return nullptr;
+        }
+        m_nOffset = offset + size;
+        return block.m_pData + offset;
+    }
+
+    std::size_t m_nBlockSize;
+    std::size_t m_nMaxRetainedSize;
+    std::vector<Block> m_Blocks;
+    std::size_t m_nCurrentBlock = 0u;
+    std::size_t m_nOffset = 0u;
+    std::size_t m_nBlockAllocationCount = 0u;
+};
+
+// Rewind an arena to its current position at the end of the scope
+class ScratchArenaScope {
+public:
+    explicit ScratchArenaScope(ScratchArena& arena):
+        m_Arena(arena), m_Marker(arena.getMarker()) {
+    }
+
+    ~ScratchArenaScope() {
+        m_Arena.rewind(m_Marker);
+        // The arena is empty at the end of the outermost scope
+        if(!m_Marker.m_nBlockIndex && !m_Marker.m_nOffset) {
+            m_Arena.trim(m_Arena.getMaxRetainedSize());
+        }
+    }
+
+    ScratchArenaScope(const ScratchArenaScope&) = delete;
+    ScratchArenaScope& operator =(const ScratchArenaScope&) = delete;
+
+private:
+    ScratchArena& m_Arena;
+    ScratchArena::Marker m_Marker;
+};
+
+// A STL allocator taking its memory from a ScratchArena. deallocate() does nothing: the memory is given
+// back when the arena is rewound, so the containers using it must not outlive the enclosing
+// ScratchArenaScope. A growing container leaves its previous buffers in the arena; reserve() when the
+// size is known.
+template<typename T>
+class ArenaAllocator {
+public:
+    using value_type = T;
+
+    template<typename U>
+    struct rebind {
+        using other = ArenaAllocator<U>;
+    };
+
+    ArenaAllocator(ScratchArena& arena):
+        m_pArena(&arena) {
+    }
+
+    template<typename U>
+    ArenaAllocator(const ArenaAllocator<U>& allocator):
+        m_pArena(&allocator.getArena()) {
+    }
+
+    T* allocate(std::size_t count) {
+        return m_pArena->allocate<T>(count);
+    }
+
+    void deallocate(T*, std::size_t) {
+    }
+
+    ScratchArena& getArena() const {
+        return *m_pArena;
+    }
+
+    template<typename U>
+    bool operator ==(const ArenaAllocator<U>& rhs) const {
+        return m_pArena == &rhs.getArena();
+    }
+
+    template<typename U>
+    bool operator !=(const ArenaAllocator<U>& rhs) const {
+        return m_pArena != &rhs.getArena();
+    }
+
+private:
+    ScratchArena* m_pArena;
+};
+
+template<typename T>
+using ArenaVector = std::vector<T, ArenaAllocator<T>>;
+
+// Deleter of the objects created in an arena by makeUnique: only call the destructors, the memory
+// belongs to the arena
+template<typename T>
+struct ArenaDeleter {
+    void operator ()(T* ptr) const {
+        ptr->~T();
+    }
+};
+
+template<typename T>
+struct ArenaDeleter<T[]> {
+    std::size_t m_nCount = 0u;
+
+    void operator ()(T* ptr) const {
+        for(auto i = std::size_t(0); i < m_nCount; ++i) {
+            ptr[i].~T();
+        }
+    }
+};
+
+template<typename T>
+using ArenaUnique = std::unique_ptr<T, ArenaDeleter<T>>;
+
+// Create an object in arena. It must be destroyed before the arena is rewound past it.
+template<typename T, typename... Ts>
+ArenaUnique<T> makeUnique(ScratchArena& arena, Ts&&... ts) {
+    return ArenaUnique<T>(new(arena.allocate<T>(1)) T(std::forward<Ts>(ts)...));
+}
+
+// Create an array of size default-initialized objects in arena, like makeUniqueArray(size)
+template<typename T>
+ArenaUnique<T[]> makeUniqueArray(ScratchArena& arena, size_t size) {
+    auto ptr = arena.allocate<T>(size);
+    for(auto i = size_t(0); i < size; ++i) {
+        new(ptr + i) T;
+    }
+    return ArenaUnique<T[]>(ptr, ArenaDeleter<T[]>{ size });
+}
+
 }
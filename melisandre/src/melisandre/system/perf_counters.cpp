@@ -0,0 +1,141 @@
+#include "perf_counters.hpp"
+
+#ifdef __linux__
+#include <cstring>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+namespace mls {
+
+#ifdef __linux__
+
+// Group of counters of a thread, read in one system call. The cycle counter leads the group so that
+// all the counters are scheduled together on the PMU.
+class PerfCounterGroup {
+public:
+    PerfCounterGroup() {
+        const uint64_t cacheReadMiss = (uint64_t(PERF_COUNT_HW_CACHE_OP_READ) << 8) |
+                (uint64_t(PERF_COUNT_HW_CACHE_RESULT_MISS) << 16);
+        const struct {
+            uint32_t m_nType;
+            uint64_t m_nConfig;
+            uint32_t m_nFlag;
+        } events[] = {
+            { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, PERF_COUNTER_CYCLES },
+            { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNTER_INSTRUCTIONS },
+            { PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | cacheReadMiss, PERF_COUNTER_L1D_MISSES },
+            { PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_LL | cacheReadMiss, PERF_COUNTER_LLC_MISSES },
+            { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES, PERF_COUNTER_BRANCH_MISSES }
+        };
+
+        for(const auto& event: events) {
+            auto fd = openEvent(event.m_nType, event.m_nConfig, m_nLeaderFD);
+            if(fd < 0) {
+                if(m_nLeaderFD < 0) {
+                    return; // No cycle counter: consider that nothing is available
+                }
+                continue;
+            }
+            if(m_nLeaderFD < 0) {
+                m_nLeaderFD = fd;
+            } else {
+                m_FDs[m_nEventCount] = fd;
+            }
+            m_EventFlags[m_nEventCount++] = event.m_nFlag;
+            m_nFlags |= event.m_nFlag;
+        }
+        ioctl(m_nLeaderFD, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+        ioctl(m_nLeaderFD, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    }
+
+    ~PerfCounterGroup() {
+        for(auto i = 1u; i < m_nEventCount; ++i) {
+            close(m_FDs[i]);
+        }
+        if(m_nLeaderFD >= 0) {
+            close(m_nLeaderFD);
+        }
+    }
+
+    PerfCounterGroup(const PerfCounterGroup&) = delete;
+    PerfCounterGroup& operator =(const PerfCounterGroup&) = delete;
+
+    uint32_t getFlags() const {
+        return m_nFlags;
+    }
+
+    bool read(PerfCounterValues& values) const {
+        if(m_nLeaderFD < 0) {
+            return false;
+        }
+        // Layout of PERF_FORMAT_GROUP: the number of counters followed by their values
+        uint64_t buffer[1 + EVENT_COUNT];
+        if(::read(m_nLeaderFD, buffer, sizeof(buffer)) < ssize_t(sizeof(uint64_t) * (1 + m_nEventCount))) {
+            return false;
+        }
+        values = PerfCounterValues();
+        for(auto i = 0u; i < m_nEventCount; ++i) {
+            switch(m_EventFlags[i]) {
+            case PERF_COUNTER_CYCLES: values.m_nCycles = buffer[1 + i]; break;
+            case PERF_COUNTER_INSTRUCTIONS: values.m_nInstructions = buffer[1 + i]; break;
+            case PERF_COUNTER_L1D_MISSES: values.m_nL1DataMisses = buffer[1 + i]; break;
+            case PERF_COUNTER_LLC_MISSES: values.m_nLastLevelCacheMisses = buffer[1 + i]; break;
+            case PERF_COUNTER_BRANCH_MISSES: values.m_nBranchMisses = buffer[1 + i]; break;
+            }
+        }
+        return true;
+    }
+
+private:
+    static const uint32_t EVENT_COUNT = 5u;
+
+    // Count the event for the calling thread, on any CPU, in user space only
+    static int openEvent(uint32_t type, uint64_t config, int groupFD) {
+        perf_event_attr attr;
+        std::memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = type;
+        attr.config = config;
+        attr.disabled = groupFD < 0 ? 1 : 0; // The group is enabled through its leader
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_GROUP;
+        return int(syscall(__NR_perf_event_open, &attr, 0, -1, groupFD, 0));
+    }
+
+    int m_nLeaderFD = -1;
+    int m_FDs[EVENT_COUNT] = {}; // m_FDs[0] is unused, the leader is m_nLeaderFD
+    uint32_t m_EventFlags[EVENT_COUNT] = {}; // Flag of each opened event, in the order of the group
+    uint32_t m_nEventCount = 0u;
+    uint32_t m_nFlags = 0u;
+};
+
+static const PerfCounterGroup& getCurrentThreadPerfCounterGroup() {
+    static thread_local PerfCounterGroup s_Group;
+    return s_Group;
+}
+
+bool readCurrentThreadPerfCounters(PerfCounterValues& values) {
+    return getCurrentThreadPerfCounterGroup().read(values);
+}
+
+uint32_t getCurrentThreadPerfCounterFlags() {
+    return getCurrentThreadPerfCounterGroup().getFlags();
+}
+
+#else
+
+bool readCurrentThreadPerfCounters(PerfCounterValues& values) {
+    return false;
+}
+
+uint32_t getCurrentThreadPerfCounterFlags() {
+    return 0u;
+}
+
+#endif
+
+}
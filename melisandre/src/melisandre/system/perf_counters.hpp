@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cstdint>
+
+namespace mls {
+
+// Values of the hardware performance counters of a thread
+struct PerfCounterValues {
+    uint64_t m_nCycles = 0u;
+    uint64_t m_nInstructions = 0u;
+    uint64_t m_nL1DataMisses = 0u; // Level 1 data cache read misses
+    uint64_t m_nLastLevelCacheMisses = 0u; // Last level cache read misses
+    uint64_t m_nBranchMisses = 0u;
+
+    PerfCounterValues& operator +=(const PerfCounterValues& rhs) {
+        m_nCycles += rhs.m_nCycles;
+        m_nInstructions += rhs.m_nInstructions;
+        m_nL1DataMisses += rhs.m_nL1DataMisses;
+        m_nLastLevelCacheMisses += rhs.m_nLastLevelCacheMisses;
+        m_nBranchMisses += rhs.m_nBranchMisses;
+        return *this;
+    }
+
+    PerfCounterValues& operator -=(const PerfCounterValues& rhs) {
+        m_nCycles -= rhs.m_nCycles;
+        m_nInstructions -= rhs.m_nInstructions;
+        m_nL1DataMisses -= rhs.m_nL1DataMisses;
+        m_nLastLevelCacheMisses -= rhs.m_nLastLevelCacheMisses;
+        m_nBranchMisses -= rhs.m_nBranchMisses;
+        return *this;
+    }
+
+    friend PerfCounterValues operator +(PerfCounterValues lhs, const PerfCounterValues& rhs) {
+        return lhs += rhs;
+    }
+
+    friend PerfCounterValues operator -(PerfCounterValues lhs, const PerfCounterValues& rhs) {
+        return lhs -= rhs;
+    }
+
+    // Instructions per cycle
+    double getIPC() const {
+        return m_nCycles ? double(m_nInstructions) / m_nCycles : 0.;
+    }
+};
+
+// Flags of the counters that can be read on this machine
+enum PerfCounterFlag {
+    PERF_COUNTER_CYCLES = 1 << 0,
+    PERF_COUNTER_INSTRUCTIONS = 1 << 1,
+    PERF_COUNTER_L1D_MISSES = 1 << 2,
+    PERF_COUNTER_LLC_MISSES = 1 << 3,
+    PERF_COUNTER_BRANCH_MISSES = 1 << 4
+};
+
+// Read the counters of the calling thread, counting in user space since the first call on this thread.
+// The counters are opened with perf_event_open on Linux, the first call of each thread opens them.
+// Return false if they are not available (other platforms, perf_event_paranoid too restrictive, virtual
+// machine without PMU...); values is then left unchanged.
+bool readCurrentThreadPerfCounters(PerfCounterValues& values);
+
+// Combination of PerfCounterFlag of the counters available to the calling thread. Counters that are
+// not available always read 0.
+uint32_t getCurrentThreadPerfCounterFlags();
+
+}
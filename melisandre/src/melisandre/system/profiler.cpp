@@ -0,0 +1,187 @@
+#include "profiler.hpp"
+#include "threads.hpp"
+
+#include <ostream>
+#include <iomanip>
+#include <chrono>
+#include <mutex>
+#include <atomic>
+#include <vector>
+#include <memory>
+
+namespace mls {
+
+struct ProfilerEvent {
+    const char* m_pName;
+    uint64_t m_nStart;
+    uint64_t m_nEnd;
+};
+
+// Events of a thread are stored in a linked list of chunks that are never moved, so that the trace can
+// be written while the thread keeps recording. m_nEventCount is published after the event is written.
+struct ProfilerEventChunk {
+    static const uint32_t EVENT_COUNT = 4096u;
+
+    ProfilerEvent m_Events[EVENT_COUNT];
+    std::atomic<uint32_t> m_nEventCount { 0u };
+    std::atomic<ProfilerEventChunk*> m_pNext { nullptr };
+};
+
+class ProfilerThreadBuffer {
+public:
+    ProfilerThreadBuffer(uint32_t threadID):
+        m_nThreadID(threadID), m_pFirstChunk(new ProfilerEventChunk), m_pLastChunk(m_pFirstChunk) {
+    }
+
+    ~ProfilerThreadBuffer() {
+        releaseChunks(m_pFirstChunk);
+    }
+
+    // Only called by the owner thread
+    void push(const ProfilerEvent& event) {
+        auto count = m_pLastChunk->m_nEventCount.load(std::memory_order_relaxed);
+        if(count == ProfilerEventChunk::EVENT_COUNT) {
+            auto chunk = new ProfilerEventChunk;
+            m_pLastChunk->m_pNext.store(chunk, std::memory_order_release);
+            m_pLastChunk = chunk;
+            count = 0u;
+        }
+        m_pLastChunk->m_Events[count] = event;
+        m_pLastChunk->m_nEventCount.store(count + 1, std::memory_order_release);
+    }
+
+    template<typename Functor>
+    void forEachEvent(const Functor& f) const {
+        for(auto chunk = m_pFirstChunk; chunk; chunk = chunk->m_pNext.load(std::memory_order_acquire)) {
+            const auto count = chunk->m_nEventCount.load(std::memory_order_acquire);
+            for(auto i = 0u; i < count; ++i) {
+                f(chunk->m_Events[i]);
+            }
+        }
+    }
+
+    void clear() {
+        releaseChunks(m_pFirstChunk->m_pNext.exchange(nullptr));
+        m_pFirstChunk->m_nEventCount = 0u;
+        m_pLastChunk = m_pFirstChunk;
+    }
+
+    uint32_t getThreadID() const {
+        return m_nThreadID;
+    }
+
+private:
+    static void releaseChunks(ProfilerEventChunk* chunk) {
+        while(chunk) {
+            auto next = chunk->m_pNext.load();
+            delete chunk;
+            chunk = next;
+        }
+    }
+
+    uint32_t m_nThreadID;
+    ProfilerEventChunk* m_pFirstChunk;
+    ProfilerEventChunk* m_pLastChunk;
+};
+
+// Buffers of all the threads that have recorded events. They are kept after the end of their thread
+// so that its events can still be written. The mutex is only locked when a thread records its first
+// event and when the trace is written or cleared.
+struct Profiler {
+    std::mutex m_Mutex;
+    std::vector<std::unique_ptr<ProfilerThreadBuffer>> m_ThreadBuffers;
+    // Reference point to convert timestamps to microseconds
+    uint64_t m_nStartTimestamp;
+    std::chrono::steady_clock::time_point m_StartTime;
+
+    Profiler():
+        m_nStartTimestamp(readProfilerTimestamp()),
+        m_StartTime(std::chrono::steady_clock::now()) {
+    }
+
+    ProfilerThreadBuffer* addThreadBuffer() {
+        std::unique_lock<std::mutex> l(m_Mutex);
+        m_ThreadBuffers.emplace_back(new ProfilerThreadBuffer(getCurrentThreadID()));
+        return m_ThreadBuffers.back().get();
+    }
+
+    // Number of timestamp ticks per microsecond, measured against the steady clock since the start
+    double getTicksPerMicrosecond() const {
+#ifdef MLS_PROFILER_USE_TSC
+        using Microseconds = std::chrono::duration<double, std::micro>;
+        // Measure on at least 10ms for a precise estimate
+        auto elapsedTime = Microseconds(std::chrono::steady_clock::now() - m_StartTime).count();
+        while(elapsedTime < 10000.) {
+            std::this_thread::yield();
+            elapsedTime = Microseconds(std::chrono::steady_clock::now() - m_StartTime).count();
+        }
+        return (readProfilerTimestamp() - m_nStartTimestamp) / elapsedTime;
+#else
+        return 1000.;
+#endif
+    }
+
+    static Profiler& getInstance() {
+        static Profiler s_Instance;
+        return s_Instance;
+    }
+};
+
+void recordProfilerEvent(const char* name, uint64_t start, uint64_t end) {
+    static thread_local ProfilerThreadBuffer* s_pThreadBuffer = Profiler::getInstance().addThreadBuffer();
+    s_pThreadBuffer->push({ name, start, end });
+}
+
+static void writeJSONString(std::ostream& out, const char* str) {
+    out << '"';
+    for(; *str; ++str) {
+        if(*str == '"' || *str == '\\') {
+            out << '\\';
+        }
+        out << *str;
+    }
+    out << '"';
+}
+
+void writeChromeTrace(std::ostream& out) {
+    auto& profiler = Profiler::getInstance();
+    const auto ticksPerMicrosecond = profiler.getTicksPerMicrosecond();
+
+    std::unique_lock<std::mutex> l(profiler.m_Mutex);
+
+    const auto flags = out.flags();
+    const auto precision = out.precision();
+    out << std::fixed << std::setprecision(3);
+
+    out << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+    auto first = true;
+    for(const auto& threadBuffer: profiler.m_ThreadBuffers) {
+        const auto threadID = threadBuffer->getThreadID();
+        out << (first ? "\n" : ",\n");
+        first = false;
+        out << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":" << threadID
+            << ",\"args\":{\"name\":\"Thread " << threadID << "\"}}";
+        threadBuffer->forEachEvent([&](const ProfilerEvent& event) {
+            // Events recorded before the profiler was created get negative timestamps
+            const auto start = (double(event.m_nStart) - double(profiler.m_nStartTimestamp)) / ticksPerMicrosecond;
+            const auto duration = double(event.m_nEnd - event.m_nStart) / ticksPerMicrosecond;
+            out << ",\n{\"name\":";
+            writeJSONString(out, event.m_pName);
+            out << ",\"ph\":\"X\",\"pid\":0,\"tid\":" << threadID << ",\"ts\":" << start << ",\"dur\":" << duration << "}";
+        });
+    }
+    out << "\n]}\n";
+
+    out.flags(flags);
+    out.precision(precision);
+}
+
+void clearProfilerEvents() {
+    auto& profiler = Profiler::getInstance();
+    std::unique_lock<std::mutex> l(profiler.m_Mutex);
+    for(auto& threadBuffer: profiler.m_ThreadBuffers) {
+        threadBuffer->clear();
+    }
+}
+
+}
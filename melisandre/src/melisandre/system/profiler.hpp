@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cstdint>
+#include <iosfwd>
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#define MLS_PROFILER_USE_TSC
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define MLS_PROFILER_USE_TSC
+#else
+#include <chrono>
+#endif
+
+namespace mls {
+
+// Timestamp used by the profiler: the time stamp counter of the CPU on x86, which is assumed to be
+// invariant (constant rate and synchronized between cores, true on every recent x86 CPU), nanoseconds
+// of a steady clock elsewhere. Converted to real time when the trace is written.
+inline uint64_t readProfilerTimestamp() {
+#ifdef MLS_PROFILER_USE_TSC
+    return __rdtsc();
+#else
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+// Append a complete event to the event buffer of the calling thread. Only the calling thread writes
+// in its buffer, so recording does not lock. name must have static storage duration (a string literal),
+// only the pointer is stored.
+void recordProfilerEvent(const char* name, uint64_t start, uint64_t end);
+
+// Write the events recorded by all threads in the Chrome trace event format, which can be opened
+// with chrome://tracing or https://ui.perfetto.dev. Events of a thread nest according to their
+// timestamps, giving the hierarchy of the profiled scopes. Can be called while other threads record.
+void writeChromeTrace(std::ostream& out);
+
+// Drop all recorded events. Must not be called while a thread records an event.
+void clearProfilerEvents();
+
+// Record the execution of a scope, use it through the MLS_PROFILE_* macros so that it is compiled out
+// when the profiler is disabled.
+class ProfilerScope {
+public:
+    explicit ProfilerScope(const char* name):
+        m_pName(name), m_nStart(readProfilerTimestamp()) {
+    }
+
+    ~ProfilerScope() {
+        recordProfilerEvent(m_pName, m_nStart, readProfilerTimestamp());
+    }
+
+    ProfilerScope(const ProfilerScope&) = delete;
+    ProfilerScope& operator =(const ProfilerScope&) = delete;
+
+private:
+    const char* m_pName;
+    uint64_t m_nStart;
+};
+
+}
+
+#define MLS_PROFILER_CONCAT_IMPL(a, b) a##b
+#define MLS_PROFILER_CONCAT(a, b) MLS_PROFILER_CONCAT_IMPL(a, b)
+
+// Profiling is enabled with the CMake option MLS_ENABLE_PROFILER; otherwise the macros expand to nothing
+#ifdef MLS_ENABLE_PROFILER
+#define MLS_PROFILE_SCOPE(name) ::mls::ProfilerScope MLS_PROFILER_CONCAT(mlsProfilerScope, __LINE__)(name)
+#define MLS_PROFILE_FUNCTION() MLS_PROFILE_SCOPE(__FUNCTION__)
+#else
+#define MLS_PROFILE_SCOPE(name)
+#define MLS_PROFILE_FUNCTION()
+#endif
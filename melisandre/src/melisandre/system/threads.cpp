@@ -1,21 +1,454 @@
 #include "threads.hpp"
 #include <unordered_map>
+#include <map>
+#include <tuple>
+#include <string>
+#include <fstream>
+#include <iostream>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#include <dirent.h>
+#include <cstdio>
+#endif
+
+#ifdef MLS_USE_LIBNUMA
+#include <numa.h>
+#endif
 
 namespace mls {
 
 ParallelProcessor ParallelProcessor::s_Instance;
 
-static std::unordered_map<std::thread::id, bool> s_ThreadFlagsMap;
-static std::mutex s_TheadFlagsMapMutex;
+// Pool and worker index of the calling thread, if it is a worker
+static thread_local const ThreadPool* s_pCurrentThreadPool = nullptr;
+static thread_local uint32_t s_nCurrentWorkerIndex = 0u;
+
+#ifdef __linux__
+
+// A logical CPU and its location in the topology of the machine
+struct LogicalCPU {
+    uint32_t m_nIndex;
+    uint32_t m_nPackage;
+    uint32_t m_nCore;
+    uint32_t m_nNumaNode;
+    uint32_t m_nCoreRank = 0u; // Rank of the core among the cores of its package
+    uint32_t m_nSMTRank = 0u; // Rank of the CPU among the hardware threads of its core
+};
+
+static uint32_t readSysfsValue(const std::string& path, uint32_t defaultValue) {
+    std::ifstream in(path);
+    uint32_t value;
+    if(in >> value) {
+        return value;
+    }
+    return defaultValue;
+}
+
+// Parse a sysfs CPU list such as "0-3,8-11"
+static std::vector<uint32_t> readSysfsCPUList(const std::string& path) {
+    std::vector<uint32_t> cpus;
+    std::ifstream in(path);
+    std::string item;
+    while(std::getline(in, item, ',')) {
+        auto separator = item.find('-');
+        try {
+            auto first = uint32_t(std::stoul(item.substr(0, separator)));
+            auto last = separator == std::string::npos ? first : uint32_t(std::stoul(item.substr(separator + 1)));
+            for(auto cpu = first; cpu <= last; ++cpu) {
+                cpus.emplace_back(cpu);
+            }
+        } catch(const std::exception&) {
+        }
+    }
+    return cpus;
+}
+
+static std::vector<LogicalCPU> getLogicalCPUs() {
+    std::unordered_map<uint32_t, uint32_t> cpuNumaNodes;
+#ifdef MLS_USE_LIBNUMA
+    const auto useLibNuma = numa_available() >= 0;
+#else
+    const auto useLibNuma = false;
+#endif
+    if(!useLibNuma) {
+        if(auto pDirectory = opendir("/sys/devices/system/node")) {
+            while(auto pEntry = readdir(pDirectory)) {
+                uint32_t node;
+                if(sscanf(pEntry->d_name, "node%u", &node) == 1) {
+                    for(auto cpu: readSysfsCPUList("/sys/devices/system/node/" + std::string(pEntry->d_name) + "/cpulist")) {
+                        cpuNumaNodes[cpu] = node;
+                    }
+                }
+            }
+            closedir(pDirectory);
+        }
+    }
+
+    cpu_set_t allowedCPUs;
+    CPU_ZERO(&allowedCPUs);
+    if(sched_getaffinity(0, sizeof(allowedCPUs), &allowedCPUs)) {
+        return {};
+    }
+
+    std::vector<LogicalCPU> cpus;
+    for(auto cpu = 0u; cpu < CPU_SETSIZE; ++cpu) {
+        if(!CPU_ISSET(cpu, &allowedCPUs)) {
+            continue;
+        }
+        const auto topologyPath = "/sys/devices/system/cpu/cpu" + std::to_string(cpu) + "/topology/";
+        LogicalCPU logicalCPU;
+        logicalCPU.m_nIndex = cpu;
+        logicalCPU.m_nPackage = readSysfsValue(topologyPath + "physical_package_id", 0u);
+        logicalCPU.m_nCore = readSysfsValue(topologyPath + "core_id", cpu);
+#ifdef MLS_USE_LIBNUMA
+        if(useLibNuma) {
+            logicalCPU.m_nNumaNode = uint32_t(std::max(0, numa_node_of_cpu(int(cpu))));
+        } else
+#endif
+        {
+            auto it = cpuNumaNodes.find(cpu);
+            logicalCPU.m_nNumaNode = it != end(cpuNumaNodes) ? (*it).second : 0u;
+        }
+        cpus.emplace_back(logicalCPU);
+    }
+
+    // Sort by location and compute the ranks of each CPU in its package and its core
+    std::sort(begin(cpus), end(cpus), [](const LogicalCPU& lhs, const LogicalCPU& rhs) {
+        return std::make_tuple(lhs.m_nPackage, lhs.m_nCore, lhs.m_nIndex) < std::make_tuple(rhs.m_nPackage, rhs.m_nCore, rhs.m_nIndex);
+    });
+    for(auto i = 1u; i < cpus.size(); ++i) {
+        const auto& previous = cpus[i - 1];
+        auto& current = cpus[i];
+        if(current.m_nPackage != previous.m_nPackage) {
+            continue;
+        }
+        if(current.m_nCore == previous.m_nCore) {
+            current.m_nCoreRank = previous.m_nCoreRank;
+            current.m_nSMTRank = previous.m_nSMTRank + 1;
+        } else {
+            current.m_nCoreRank = previous.m_nCoreRank + 1;
+        }
+    }
+
+    return cpus;
+}
+
+// Compute the set of CPUs on which each worker is allowed to run, or an empty set if it is not pinned
+static std::vector<std::vector<uint32_t>> computeWorkerCPUs(uint32_t workerCount, ThreadAffinityPolicy policy) {
+    std::vector<std::vector<uint32_t>> workerCPUs(workerCount);
+    if(policy == ThreadAffinityPolicy::None) {
+        return workerCPUs;
+    }
+
+    auto cpus = getLogicalCPUs();
+    if(cpus.empty()) {
+        return workerCPUs;
+    }
+
+    switch(policy) {
+    case ThreadAffinityPolicy::None:
+        break;
+    case ThreadAffinityPolicy::Compact:
+        // CPUs are already sorted by package, core and hardware thread
+        for(auto i = 0u; i < workerCount; ++i) {
+            workerCPUs[i].emplace_back(cpus[i % cpus.size()].m_nIndex);
+        }
+        break;
+    case ThreadAffinityPolicy::Scatter:
+        // First hardware thread of each core first, cycling over the packages
+        std::sort(begin(cpus), end(cpus), [](const LogicalCPU& lhs, const LogicalCPU& rhs) {
+            return std::make_tuple(lhs.m_nSMTRank, lhs.m_nCoreRank, lhs.m_nPackage, lhs.m_nIndex) <
+                std::make_tuple(rhs.m_nSMTRank, rhs.m_nCoreRank, rhs.m_nPackage, rhs.m_nIndex);
+        });
+        for(auto i = 0u; i < workerCount; ++i) {
+            workerCPUs[i].emplace_back(cpus[i % cpus.size()].m_nIndex);
+        }
+        break;
+    case ThreadAffinityPolicy::NumaNode: {
+        std::map<uint32_t, std::vector<uint32_t>> nodeCPUs;
+        for(const auto& cpu: cpus) {
+            nodeCPUs[cpu.m_nNumaNode].emplace_back(cpu.m_nIndex);
+        }
+        // Workers are distributed over the nodes proportionally to their number of CPUs
+        auto workerIndex = 0u;
+        for(const auto& node: nodeCPUs) {
+            auto nodeWorkerCount = (node.second.size() * workerCount + cpus.size() - 1) / cpus.size();
+            for(auto i = 0u; i < nodeWorkerCount && workerIndex < workerCount; ++i) {
+                workerCPUs[workerIndex++] = node.second;
+            }
+        }
+        break;
+    }
+    }
+
+    return workerCPUs;
+}
+
+static void pinCurrentThread(const std::vector<uint32_t>& cpus) {
+    if(cpus.empty()) {
+        return;
+    }
+
+    cpu_set_t cpuSet;
+    CPU_ZERO(&cpuSet);
+    for(auto cpu: cpus) {
+        CPU_SET(cpu, &cpuSet);
+    }
+    if(pthread_setaffinity_np(pthread_self(), sizeof(cpuSet), &cpuSet)) {
+        std::cerr << "ThreadPool: unable to set the affinity of a worker thread" << std::endl;
+        return;
+    }
+
+#ifdef MLS_USE_LIBNUMA
+    // Allocate the memory of the worker on its node, not only the pages it touches first
+    if(numa_available() >= 0) {
+        auto node = numa_node_of_cpu(int(cpus.front()));
+        if(node >= 0) {
+            numa_set_preferred(node);
+        }
+    }
+#endif
+}
+
+#else
+
+static std::vector<std::vector<uint32_t>> computeWorkerCPUs(uint32_t workerCount, ThreadAffinityPolicy policy) {
+    return std::vector<std::vector<uint32_t>>(workerCount);
+}
+
+static void pinCurrentThread(const std::vector<uint32_t>& cpus) {
+}
+
+#endif
+
+ThreadPool::ThreadPool(uint32_t workerCount, ThreadAffinityPolicy affinityPolicy):
+    m_nWorkerCount(workerCount) {
+    m_Queues.reserve(workerCount + 1);
+    for(auto i = 0u; i <= workerCount; ++i) {
+        m_Queues.emplace_back(new TaskQueue());
+    }
+
+    auto workerCPUs = computeWorkerCPUs(workerCount, affinityPolicy);
+
+    m_Workers.reserve(workerCount);
+    for(auto i = 0u; i < workerCount; ++i) {
+        m_Workers.emplace_back(&ThreadPool::workerLoop, this, i, std::move(workerCPUs[i]));
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::unique_lock<std::mutex> l(m_SleepMutex);
+        m_bStop = true;
+    }
+    m_WakeUpCondition.notify_all();
+
+    for(auto& worker: m_Workers) {
+        worker.join();
+    }
+}
 
-bool isCurrentThreadDebugFlagEnabled() {
-    std::unique_lock<std::mutex> l(s_TheadFlagsMapMutex);
-    return s_ThreadFlagsMap[std::this_thread::get_id()];
+int32_t ThreadPool::getCurrentWorkerIndex() const {
+    if(s_pCurrentThreadPool != this) {
+        return -1;
+    }
+    return int32_t(s_nCurrentWorkerIndex);
 }
 
-void setCurrentThreadDebugFlag(bool value) {
-    std::unique_lock<std::mutex> l(s_TheadFlagsMapMutex);
-    s_ThreadFlagsMap[std::this_thread::get_id()] = value;
+void ThreadPool::submit(TaskGroup& group, TaskFunction function, const void* pData, uint32_t taskCount) {
+    if(!taskCount) {
+        return;
+    }
+
+    auto workerIndex = getCurrentWorkerIndex();
+    auto queueIndex = workerIndex >= 0 ? uint32_t(workerIndex) : getWorkerCount();
+
+    // Counters are incremented before the tasks are visible so that they never go below zero
+    group.addTasks(taskCount);
+    m_nQueuedTaskCount.fetch_add(int32_t(taskCount));
+
+    {
+        auto& queue = *m_Queues[queueIndex];
+        std::unique_lock<std::mutex> l(queue.m_Mutex);
+        // Pushed in reverse order so that the owner pops the tasks in increasing order
+        for(auto i = taskCount; i > 0u; --i) {
+            Task task;
+            task.m_pFunction = function;
+            task.m_pData = pData;
+            task.m_nIndex = i - 1;
+            task.m_pGroup = &group;
+            queue.m_Tasks.emplace_back(task);
+        }
+    }
+
+    wakeUpWorkers(taskCount);
+}
+
+void ThreadPool::submitPinned(TaskGroup& group, TaskFunction function, const void* pData, uint32_t taskCount) {
+    const auto workerCount = getWorkerCount();
+    if(!workerCount) {
+        submit(group, function, pData, taskCount);
+        return;
+    }
+    if(!taskCount) {
+        return;
+    }
+
+    group.addTasks(taskCount);
+
+    // Task i goes to worker i % workerCount
+    for(auto i = 0u; i < taskCount; ++i) {
+        auto& queue = *m_Queues[i % workerCount];
+        queue.m_nPinnedTaskCount.fetch_add(1);
+
+        std::unique_lock<std::mutex> l(queue.m_Mutex);
+        Task task;
+        task.m_pFunction = function;
+        task.m_pData = pData;
+        task.m_nIndex = i;
+        task.m_pGroup = &group;
+        queue.m_PinnedTasks.emplace_back(task);
+    }
+
+    // All workers are woken up since the targeted ones cannot be notified individually
+    wakeUpWorkers(std::max(2u, taskCount));
+}
+
+void ThreadPool::wakeUpWorkers(uint32_t taskCount) {
+    // Counters are sequentially consistent: either we see the sleeping worker, or it sees the new tasks
+    if(!m_nSleepingWorkerCount.load()) {
+        return;
+    }
+    {
+        // Lock to prevent a worker from missing the notification between its check and its wait
+        std::unique_lock<std::mutex> l(m_SleepMutex);
+    }
+    if(taskCount == 1u) {
+        m_WakeUpCondition.notify_one();
+    } else {
+        m_WakeUpCondition.notify_all();
+    }
+}
+
+void ThreadPool::wait(TaskGroup& group) {
+    auto workerIndex = getCurrentWorkerIndex();
+    auto queueIndex = workerIndex >= 0 ? uint32_t(workerIndex) : getWorkerCount();
+
+    auto spinCount = 0u;
+    while(!group.done()) {
+        if(tryExecuteTask(queueIndex)) {
+            spinCount = 0u;
+        } else if(workerIndex >= 0 || ++spinCount < WAIT_SPIN_COUNT) {
+            std::this_thread::yield();
+        } else {
+            // The remaining tasks are executed by the workers, the last one wakes us up
+            std::unique_lock<std::mutex> l(group.m_Mutex);
+            group.m_DoneCondition.wait(l, [&group]() {
+                return group.done();
+            });
+        }
+    }
+    // Wait for the last task to release the group
+    std::unique_lock<std::mutex> l(group.m_Mutex);
+}
+
+bool ThreadPool::popTask(uint32_t queueIndex, Task& task) {
+    auto& queue = *m_Queues[queueIndex];
+    std::unique_lock<std::mutex> l(queue.m_Mutex);
+    if(queue.m_Tasks.empty()) {
+        return false;
+    }
+    task = queue.m_Tasks.back();
+    queue.m_Tasks.pop_back();
+    return true;
+}
+
+bool ThreadPool::popPinnedTask(uint32_t queueIndex, Task& task) {
+    auto& queue = *m_Queues[queueIndex];
+    if(queue.m_nPinnedTaskCount.load(std::memory_order_relaxed) <= 0) {
+        return false;
+    }
+    std::unique_lock<std::mutex> l(queue.m_Mutex);
+    if(queue.m_PinnedTasks.empty()) {
+        return false;
+    }
+    task = queue.m_PinnedTasks.front();
+    queue.m_PinnedTasks.pop_front();
+    queue.m_nPinnedTaskCount.fetch_sub(1, std::memory_order_relaxed);
+    return true;
+}
+
+bool ThreadPool::stealTask(uint32_t thiefIndex, Task& task) {
+    const auto queueCount = uint32_t(m_Queues.size());
+    for(auto i = 1u; i < queueCount; ++i) {
+        auto& queue = *m_Queues[(thiefIndex + i) % queueCount];
+        std::unique_lock<std::mutex> l(queue.m_Mutex, std::try_to_lock);
+        if(!l.owns_lock() || queue.m_Tasks.empty()) {
+            continue;
+        }
+        task = queue.m_Tasks.front();
+        queue.m_Tasks.pop_front();
+        return true;
+    }
+    return false;
+}
+
+bool ThreadPool::hasPendingTask(uint32_t queueIndex) const {
+    return m_nQueuedTaskCount.load() > 0 ||
+        (queueIndex < getWorkerCount() && m_Queues[queueIndex]->m_nPinnedTaskCount.load() > 0);
+}
+
+bool ThreadPool::tryExecuteTask(uint32_t queueIndex) {
+    Task task;
+    // Pinned tasks are only executed by their worker
+    if(queueIndex >= getWorkerCount() || !popPinnedTask(queueIndex, task)) {
+        if(m_nQueuedTaskCount.load(std::memory_order_relaxed) <= 0) {
+            return false;
+        }
+        if(!popTask(queueIndex, task) && !stealTask(queueIndex, task)) {
+            return false;
+        }
+        m_nQueuedTaskCount.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    task.m_pFunction(task.m_pData, task.m_nIndex);
+    task.m_pGroup->finishTask();
+
+    return true;
+}
+
+void ThreadPool::workerLoop(uint32_t workerIndex, std::vector<uint32_t> cpus) {
+    s_pCurrentThreadPool = this;
+    s_nCurrentWorkerIndex = workerIndex;
+
+    pinCurrentThread(cpus);
+
+    while(!m_bStop.load(std::memory_order_relaxed)) {
+        auto spinCount = 0u;
+        while(spinCount < WAIT_SPIN_COUNT && !tryExecuteTask(workerIndex)) {
+            std::this_thread::yield();
+            ++spinCount;
+        }
+        if(spinCount < WAIT_SPIN_COUNT) {
+            continue;
+        }
+
+        std::unique_lock<std::mutex> l(m_SleepMutex);
+        ++m_nSleepingWorkerCount;
+        m_WakeUpCondition.wait(l, [this, workerIndex]() {
+            return m_bStop.load(std::memory_order_relaxed) || hasPendingTask(workerIndex);
+        });
+        --m_nSleepingWorkerCount;
+    }
+}
+
+static std::atomic<uint32_t> s_nNextThreadID { 0u };
+
+ThreadContext::ThreadContext():
+    m_nThreadID(s_nNextThreadID++),
+    m_RandomGenerator(m_nThreadID) {
 }
 
 }
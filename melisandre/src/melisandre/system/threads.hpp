@@ -1,22 +1,159 @@
 #pragma once
 
 #include <vector>
+#include <deque>
 #include <thread>
 #include <atomic>
 #include <algorithm>
 #include <mutex>
+#include <condition_variable>
+#include <memory>
+#include <type_traits>
+#include <functional>
 #include <melisandre/types.hpp>
+#include <melisandre/system/memory.hpp>
+#include <melisandre/itertools/range.hpp>
+#include <melisandre/maths/sampling/Random.hpp>
 
 namespace mls {
 
+// Placement of the worker threads of a ThreadPool on the logical CPUs of the machine.
+// Only implemented on Linux, other platforms behave as ThreadAffinityPolicy::None.
+enum class ThreadAffinityPolicy {
+    None, // Workers are freely scheduled by the OS
+    Compact, // Worker i is pinned on the i-th logical CPU, filling cores then sockets in order
+    Scatter, // Consecutive workers are pinned on different sockets, then on different cores
+    NumaNode // Workers are spread over NUMA nodes, each one may run on any CPU of its node
+};
+
+// A pool of long-lived worker threads. Each worker owns a deque of tasks: it pops
+// from the back of its own deque and steals from the front of the other ones when
+// it runs out of work. Threads that are not workers push their tasks into a shared
+// deque that every worker can steal from.
+class ThreadPool {
+public:
+    using TaskFunction = void (*)(const void* pData, uint32_t taskIndex);
+
+    // A set of tasks that can be waited for
+    class TaskGroup {
+        std::atomic<uint32_t> m_nPendingCount { 0u };
+        // Set under m_Mutex by the last task, which then notifies m_DoneCondition: a waiting thread that
+        // sees it locks m_Mutex before returning, so the group is not destroyed while it is notified
+        std::atomic<bool> m_bDone { true };
+        std::mutex m_Mutex;
+        std::condition_variable m_DoneCondition;
+        friend class ThreadPool;
+
+        void addTasks(uint32_t taskCount) {
+            std::unique_lock<std::mutex> l(m_Mutex);
+            m_nPendingCount.fetch_add(taskCount, std::memory_order_relaxed);
+            m_bDone.store(false, std::memory_order_relaxed);
+        }
+
+        void finishTask() {
+            if(m_nPendingCount.fetch_sub(1u, std::memory_order_acq_rel) != 1u) {
+                return;
+            }
+            std::unique_lock<std::mutex> l(m_Mutex);
+            // Tasks may have been added since the decrement
+            if(!m_nPendingCount.load(std::memory_order_relaxed)) {
+                m_bDone.store(true, std::memory_order_release);
+                m_DoneCondition.notify_all();
+            }
+        }
+    public:
+        TaskGroup() = default;
+        TaskGroup(const TaskGroup&) = delete;
+        TaskGroup& operator =(const TaskGroup&) = delete;
+
+        bool done() const {
+            return m_bDone.load(std::memory_order_acquire);
+        }
+    };
+
+    explicit ThreadPool(uint32_t workerCount, ThreadAffinityPolicy affinityPolicy = ThreadAffinityPolicy::None);
+
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator =(const ThreadPool&) = delete;
+
+    uint32_t getWorkerCount() const {
+        return m_nWorkerCount;
+    }
+
+    // Push taskCount tasks function(pData, i), i in [0, taskCount[, in the group
+    void submit(TaskGroup& group, TaskFunction function, const void* pData, uint32_t taskCount);
+
+    // Same as submit, but task i can only be executed by the worker i % workerCount. Since workers
+    // are not stolen these tasks, a given task index always runs on the same CPU / NUMA node.
+    // If the pool has no worker, the tasks are executed by the threads calling wait().
+    void submitPinned(TaskGroup& group, TaskFunction function, const void* pData, uint32_t taskCount);
+
+    // Execute pending tasks on the calling thread until all tasks of the group are done. A thread that
+    // is not a worker blocks once it has found no task to execute during WAIT_SPIN_COUNT attempts. The
+    // workers never block, since they may have to execute nested or pinned tasks the group depends on.
+    void wait(TaskGroup& group);
+
+    // Return the index of the calling thread in the pool, or -1 if it is not a worker of the pool
+    int32_t getCurrentWorkerIndex() const;
+
+private:
+    // Number of failed attempts to find a task before a thread goes to sleep
+    static const uint32_t WAIT_SPIN_COUNT = 64u;
+
+    struct Task {
+        TaskFunction m_pFunction = nullptr;
+        const void* m_pData = nullptr;
+        uint32_t m_nIndex = 0u;
+        TaskGroup* m_pGroup = nullptr;
+    };
+
+    struct TaskQueue {
+        std::mutex m_Mutex;
+        std::deque<Task> m_Tasks;
+        std::deque<Task> m_PinnedTasks; // Tasks that cannot be stolen
+        std::atomic<int32_t> m_nPinnedTaskCount { 0 };
+        // Queues are allocated separately, the padding keeps the hot members of two queues on distinct cache lines
+        char m_Padding[CACHE_LINE_SIZE];
+    };
+
+    void wakeUpWorkers(uint32_t taskCount);
+
+    void workerLoop(uint32_t workerIndex, std::vector<uint32_t> cpus);
+
+    bool hasPendingTask(uint32_t queueIndex) const;
+
+    bool popPinnedTask(uint32_t queueIndex, Task& task);
+
+    bool popTask(uint32_t queueIndex, Task& task);
+
+    bool stealTask(uint32_t thiefIndex, Task& task);
+
+    // Execute one pending task if any, return false if no task has been found
+    bool tryExecuteTask(uint32_t queueIndex);
+
+    // Queues [0, workerCount[ belongs to the workers, the last one is shared by external threads
+    const uint32_t m_nWorkerCount;
+    std::vector<std::unique_ptr<TaskQueue>> m_Queues;
+    std::vector<std::thread> m_Workers;
+
+    std::atomic<int32_t> m_nQueuedTaskCount { 0 }; // Number of tasks that can be stolen
+    std::atomic<uint32_t> m_nSleepingWorkerCount { 0u };
+    std::atomic<bool> m_bStop { false };
+    std::mutex m_SleepMutex;
+    std::condition_variable m_WakeUpCondition;
+};
+
 class ParallelProcessor {
     uint32_t m_nThreadCount = std::thread::hardware_concurrency();
-    std::vector<std::thread> m_Threads;
+    ThreadAffinityPolicy m_AffinityPolicy = ThreadAffinityPolicy::None;
+    std::unique_ptr<ThreadPool> m_pThreadPool;
+    std::atomic<bool> m_bThreadPoolStarted { false };
+    std::once_flag m_ThreadPoolInitFlag;
     std::mutex m_DebugMutex;
 
-    ParallelProcessor() {
-        m_Threads.reserve(m_nThreadCount);
-    }
+    ParallelProcessor() = default;
 
 public:
     static ParallelProcessor s_Instance;
@@ -25,16 +162,35 @@ public:
         return m_nThreadCount;
     }
 
-    template<typename TaskFunctor>
-    void launchThreads(const TaskFunctor& task, uint32_t threadCount) {
-        m_Threads.clear();
-        for(auto i = 0u; i < threadCount; ++i) {
-            m_Threads.emplace_back(std::thread(task, i));
-        }
+    // The pool is started on first use. The calling thread helps the workers while
+    // it waits, so the pool only needs m_nThreadCount - 1 workers.
+    ThreadPool& getThreadPool() {
+        std::call_once(m_ThreadPoolInitFlag, [this]() {
+            m_pThreadPool.reset(new ThreadPool(std::max(1u, m_nThreadCount) - 1u, m_AffinityPolicy));
+            m_bThreadPoolStarted = true;
+        });
+        return *m_pThreadPool;
+    }
 
-        for(auto i = 0u; i < threadCount; ++i) {
-            m_Threads[i].join();
+    // Must be called before the first parallel call. Returns false if the pool is already started.
+    bool setThreadAffinityPolicy(ThreadAffinityPolicy policy) {
+        if(m_bThreadPoolStarted) {
+            return false;
         }
+        m_AffinityPolicy = policy;
+        return true;
+    }
+
+    // Run task(threadID) for each threadID in [0, threadCount[ on the pool and wait for completion.
+    // Since workers are shared, tasks must not wait for each other.
+    template<typename TaskFunctor>
+    void launchThreads(const TaskFunctor& task, uint32_t threadCount) {
+        auto& pool = getThreadPool();
+        ThreadPool::TaskGroup group;
+        pool.submit(group, [](const void* pTask, uint32_t threadID) {
+            (*static_cast<const TaskFunctor*>(pTask))(threadID);
+        }, &task, threadCount);
+        pool.wait(group);
     }
 
     // Lock the debug mutex, use this function in a scope
@@ -51,6 +207,10 @@ inline void launchThreads(const TaskFunctor& task,
     ParallelProcessor::s_Instance.launchThreads(task, threadCount);
 }
 
+inline bool setThreadAffinityPolicy(ThreadAffinityPolicy policy) {
+    return ParallelProcessor::s_Instance.setThreadAffinityPolicy(policy);
+}
+
 template<typename TaskFunctor>
 inline void processTasks(uint32_t taskCount,
                          const TaskFunctor& task,
@@ -110,13 +270,265 @@ inline void processTasksDeterminist(uint32_t taskCount,
     launchThreads(batchProcess, threadCount);
 }
 
+// Number of blocks used by processTasksPinned and firstTouchFill
+inline uint32_t getPinnedBlockCount() {
+    return std::max(1u, ParallelProcessor::s_Instance.getThreadPool().getWorkerCount());
+}
+
+// Split [0, taskCount[ in getPinnedBlockCount() contiguous blocks and call task(taskID, blockID) for each task.
+// Block blockID always runs on the same worker, so memory first touched by firstTouchFill with the same
+// count is local to the NUMA node of the worker processing it (see ThreadAffinityPolicy).
+template<typename TaskFunctor>
+inline void processTasksPinned(std::size_t taskCount, const TaskFunctor& task) {
+    const auto blockCount = getPinnedBlockCount();
+    const auto blockSize = (taskCount + blockCount - 1) / blockCount;
+
+    auto blockProcess = [&](uint32_t blockID) {
+        const auto end = std::min(taskCount, (blockID + 1) * blockSize);
+        for(auto taskID = blockID * blockSize; taskID < end; ++taskID) {
+            task(taskID, blockID);
+        }
+    };
+
+    auto& pool = ParallelProcessor::s_Instance.getThreadPool();
+    ThreadPool::TaskGroup group;
+    pool.submitPinned(group, [](const void* pBlockProcess, uint32_t blockID) {
+        (*static_cast<const decltype(blockProcess)*>(pBlockProcess))(blockID);
+    }, &blockProcess, blockCount);
+    pool.wait(group);
+}
+
+// Initialize [pData, pData + count[ with value, each block of processTasksPinned(count, ...) being written by
+// the worker that processes it. Meant for freshly allocated memory that has not been touched yet
+// (e.g. makeUniqueArray of a trivial type): the OS allocates each page on the NUMA node of its first writer.
+template<typename T>
+inline void firstTouchFill(T* pData, std::size_t count, const T& value) {
+    processTasksPinned(count, [&](std::size_t i, uint32_t blockID) {
+        pData[i] = value;
+    });
+}
+
+// Thread writing the elements of a new container (Image, Grid3D, MultiDimensionalArray). The OS allocates
+// each page on the NUMA node of its first writer.
+enum class FirstTouchPolicy {
+    CallingThread, // The elements are written by the thread constructing the container
+    PinnedWorkers // The elements are written with firstTouchFill: pages are local to the workers processing
+                  // the same elements with processTasksPinned
+};
+
+// Replace the content of vector by count copies of value, written according to firstTouch. The allocator
+// of the vector must be an UninitializedAllocator for the pages to be first touched by the workers.
+template<typename T, typename Alloc>
+inline void assignFirstTouch(std::vector<T, Alloc>& vector, std::size_t count, const T& value,
+                             FirstTouchPolicy firstTouch) {
+    if(firstTouch == FirstTouchPolicy::PinnedWorkers) {
+        vector.clear();
+        vector.resize(count);
+        firstTouchFill(vector.data(), count, value);
+    } else {
+        vector.assign(count, value);
+    }
+}
+
+// Return a grain size giving about 8 chunks per thread for a range of size elements
+inline uint32_t getDefaultGrainSize(uint32_t size) {
+    return std::max(1u, size / (8u * std::max(1u, getSystemThreadCount())));
+}
+
+namespace threads_detail {
+
+template<typename Closure>
+inline void callClosure(const void* pClosure, uint32_t) {
+    (*static_cast<const Closure*>(pClosure))();
+}
+
+// Split [begin, end[ in two halves until its size is below grainSize. The right half is pushed
+// on the pool so that idle threads can steal it while the calling thread processes the left half.
+template<typename T, typename Functor>
+void recursiveParallelFor(ThreadPool& pool, T begin, T end, T grainSize, const Functor& f) {
+    if(end - begin <= grainSize) {
+        f(Range<T>(begin, end));
+        return;
+    }
+
+    const T middle = begin + (end - begin) / 2;
+
+    auto processRightHalf = [&]() {
+        recursiveParallelFor(pool, middle, end, grainSize, f);
+    };
+    ThreadPool::TaskGroup group;
+    pool.submit(group, callClosure<decltype(processRightHalf)>, &processRightHalf, 1u);
+
+    recursiveParallelFor(pool, begin, middle, grainSize, f);
+
+    pool.wait(group);
+}
+
+template<typename T, typename Value, typename Functor, typename Combine>
+Value recursiveParallelReduce(ThreadPool& pool, T begin, T end, T grainSize, const Value& identity,
+                              const Functor& f, const Combine& combine) {
+    if(end - begin <= grainSize) {
+        return f(Range<T>(begin, end));
+    }
+
+    const T middle = begin + (end - begin) / 2;
+
+    Value rightValue = identity;
+    auto processRightHalf = [&]() {
+        rightValue = recursiveParallelReduce(pool, middle, end, grainSize, identity, f, combine);
+    };
+    ThreadPool::TaskGroup group;
+    pool.submit(group, callClosure<decltype(processRightHalf)>, &processRightHalf, 1u);
+
+    Value leftValue = recursiveParallelReduce(pool, begin, middle, grainSize, identity, f, combine);
+
+    pool.wait(group);
+
+    return combine(leftValue, rightValue);
+}
+
+}
+
+// Call f(subRange) on disjoint sub-ranges covering range, in parallel. The range is split recursively
+// until sub-ranges contain at most grainSize elements (grainSize = 0 selects getDefaultGrainSize).
+// Can be called from inside a task: nested calls share the threads of the pool.
+template<typename T, typename Functor>
+inline void parallelFor(const Range<T>& range, T grainSize, const Functor& f) {
+    const T begin = *range.begin(), end = *range.end();
+    if(begin == end) {
+        return;
+    }
+    if(!grainSize) {
+        grainSize = T(getDefaultGrainSize(uint32_t(end - begin)));
+    }
+    threads_detail::recursiveParallelFor(ParallelProcessor::s_Instance.getThreadPool(), begin, end, grainSize, f);
+}
+
+// Call left() and right() in parallel: right is pushed on the pool, where an idle thread can steal it,
+// while the calling thread executes left. Can be called from inside a task to fork recursive work.
+template<typename LeftFunctor, typename RightFunctor>
+inline void parallelInvoke(const LeftFunctor& left, const RightFunctor& right) {
+    auto& pool = ParallelProcessor::s_Instance.getThreadPool();
+    ThreadPool::TaskGroup group;
+    pool.submit(group, threads_detail::callClosure<RightFunctor>, &right, 1u);
+    left();
+    pool.wait(group);
+}
+
+// Compute combine(f(subRange_0), combine(f(subRange_1), ...)) over disjoint sub-ranges covering range,
+// in parallel. f(subRange) must return the reduction of the sub-range and combine must be associative.
+// Returns identity for an empty range.
+template<typename T, typename Value, typename Functor, typename Combine>
+inline Value parallelReduce(const Range<T>& range, const Value& identity, const Functor& f,
+                            const Combine& combine, T grainSize = T(0)) {
+    const T begin = *range.begin(), end = *range.end();
+    if(begin == end) {
+        return identity;
+    }
+    if(!grainSize) {
+        grainSize = T(getDefaultGrainSize(uint32_t(end - begin)));
+    }
+    return threads_detail::recursiveParallelReduce(ParallelProcessor::s_Instance.getThreadPool(), begin, end,
+                                                   grainSize, identity, f, combine);
+}
+
+// Reduce the values getValue(i), i in [0, count[, with a balanced binary tree. The shape of the tree
+// only depends on count, so the result does not depend on the order of evaluation. count must be > 0.
+template<typename Getter, typename Combine>
+inline auto treeReduce(std::size_t count, const Getter& getValue, const Combine& combine) -> std::decay_t<decltype(getValue(count))> {
+    using Value = std::decay_t<decltype(getValue(count))>;
+
+    struct Reducer {
+        const Getter& m_GetValue;
+        const Combine& m_Combine;
+
+        Value operator ()(std::size_t begin, std::size_t end) const {
+            if(end - begin == 1u) {
+                return m_GetValue(begin);
+            }
+            const auto middle = begin + (end - begin) / 2;
+            return m_Combine((*this)(begin, middle), (*this)(middle, end));
+        }
+    };
+    return Reducer { getValue, combine }(0u, count);
+}
+
+// Default number of elements reduced sequentially by parallelReduceDeterminist before
+// chunk values are combined. Must not depend on the number of threads.
+static const uint32_t DETERMINIST_REDUCE_CHUNK_SIZE = 4096u;
+
+// Same as parallelReduce, but bitwise reproducible for any number of threads: the range is cut in chunks
+// of chunkSize elements, each chunk is reduced with f(chunk) and the values of the chunks are combined
+// with treeReduce. For floating point sums, the result only depends on the range and on chunkSize.
+template<typename T, typename Value, typename Functor, typename Combine>
+inline Value parallelReduceDeterminist(const Range<T>& range, const Value& identity, const Functor& f,
+                                       const Combine& combine, T chunkSize = T(DETERMINIST_REDUCE_CHUNK_SIZE)) {
+    const T begin = *range.begin(), end = *range.end();
+    if(begin == end) {
+        return identity;
+    }
+
+    const T chunkCount = (end - begin + chunkSize - 1) / chunkSize;
+    std::vector<Value> chunkValues(chunkCount, identity);
+
+    parallelFor(Range<T>(T(0), chunkCount), T(0), [&](const Range<T>& chunks) {
+        for(auto chunkIndex: chunks) {
+            const T chunkBegin = begin + chunkIndex * chunkSize;
+            const T chunkEnd = std::min(T(chunkBegin + chunkSize), end);
+            chunkValues[chunkIndex] = f(Range<T>(chunkBegin, chunkEnd));
+        }
+    });
+
+    return treeReduce(chunkValues.size(), [&](std::size_t chunkIndex) {
+        return chunkValues[chunkIndex];
+    }, combine);
+}
+
 inline std::unique_lock<std::mutex> debugLock() {
     return std::unique_lock<std::mutex>(ParallelProcessor::s_Instance.m_DebugMutex);
 }
 
-bool isCurrentThreadDebugFlagEnabled();
+// Per-thread state reachable from hot code without synchronisation. Each thread owns its context, it
+// must not be shared with other threads.
+struct ThreadContext {
+    // Sequential index of the thread, attributed the first time it accesses its context
+    uint32_t m_nThreadID;
+    bool m_bDebugFlag = false;
+    // Seeded with the thread ID: different threads draw different sequences
+    RandomGenerator m_RandomGenerator;
+    // Temporary allocations, rewind it with a ScratchArenaScope
+    ScratchArena m_ScratchArena;
+
+    ThreadContext();
+
+    ThreadContext(const ThreadContext&) = delete;
+    ThreadContext& operator =(const ThreadContext&) = delete;
+};
+
+inline ThreadContext& getCurrentThreadContext() {
+    static thread_local ThreadContext s_Context;
+    return s_Context;
+}
+
+inline uint32_t getCurrentThreadID() {
+    return getCurrentThreadContext().m_nThreadID;
+}
+
+inline RandomGenerator& getCurrentThreadRandomGenerator() {
+    return getCurrentThreadContext().m_RandomGenerator;
+}
 
-void setCurrentThreadDebugFlag(bool value);
+inline ScratchArena& getCurrentThreadScratchArena() {
+    return getCurrentThreadContext().m_ScratchArena;
+}
+
+inline bool isCurrentThreadDebugFlagEnabled() {
+    return getCurrentThreadContext().m_bDebugFlag;
+}
+
+inline void setCurrentThreadDebugFlag(bool value) {
+    getCurrentThreadContext().m_bDebugFlag = value;
+}
 
 struct CurrentThreadDebugFlagRAII {
     CurrentThreadDebugFlagRAII(bool condition) {
@@ -129,30 +541,61 @@ struct CurrentThreadDebugFlagRAII {
     CurrentThreadDebugFlagRAII& operator =(const CurrentThreadDebugFlagRAII&) = delete;
 };
 
-// A Simple class to manipulate values computed over multiple
-// threads
-template<typename T, size_t MaxThreadCount>
-class ThreadsValue {
-    T m_Values[MaxThreadCount];
+// Storage for one value per thread. Each value lies on its own cache lines so that
+// threads writing their value do not invalidate the cache lines of the others.
+template<typename T>
+class PerThreadStorage {
+    struct alignas(CACHE_LINE_SIZE) Slot {
+        T m_Value;
+    };
+    std::vector<Slot, AlignedAllocator<Slot, CACHE_LINE_SIZE>> m_Slots;
 public:
+    explicit PerThreadStorage(uint32_t threadCount = getSystemThreadCount(), const T& value = T()):
+        m_Slots(threadCount, Slot { value }) {
+    }
+
+    uint32_t getThreadCount() const {
+        return uint32_t(m_Slots.size());
+    }
+
     void init(const T& value) {
-        std::fill(std::begin(m_Values), std::end(m_Values), value);
+        for(auto& slot: m_Slots) {
+            slot.m_Value = value;
+        }
     }
 
     const T& operator [](uint32_t threadIndex) const {
-        return m_Values[threadIndex];
+        return m_Slots[threadIndex].m_Value;
     }
 
     T& operator [](uint32_t threadIndex) {
-        return m_Values[threadIndex];
+        return m_Slots[threadIndex].m_Value;
     }
 
-    T sum() const {
-        T result = m_Values[0];
-        for (auto i = 1u; i < MaxThreadCount; ++i) {
-            result += m_Values[i];
+    // Combine the values of all threads with a tree reduction
+    template<typename Combine>
+    T reduce(const T& identity, const Combine& combine) const {
+        if(m_Slots.empty()) {
+            return identity;
         }
-        return result;
+        return treeReduce(m_Slots.size(), [this](std::size_t i) {
+            return m_Slots[i].m_Value;
+        }, combine);
+    }
+
+    T sum() const {
+        return reduce(T(), [](const T& lhs, const T& rhs) {
+            return lhs + rhs;
+        });
+    }
+};
+
+// A Simple class to manipulate values computed over multiple
+// threads
+template<typename T, size_t MaxThreadCount>
+class ThreadsValue: public PerThreadStorage<T> {
+public:
+    ThreadsValue(): PerThreadStorage<T>(MaxThreadCount) {
     }
 };
 
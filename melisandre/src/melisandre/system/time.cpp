@@ -1,5 +1,6 @@
 #include "time.hpp"
 #include <chrono>
+#include <iomanip>
 
 namespace mls {
 
@@ -15,4 +16,35 @@ std::string getDateString() {
     return std::string(mbstr);
 }
 
+void printTaskStatistics(std::ostream& out, const TaskTimer& timer) {
+    const auto flags = out.flags();
+    const auto precision = out.precision();
+
+    const auto hasPerfCounters = timer.isCollectingPerfCounters() && getCurrentThreadPerfCounterFlags();
+    out << std::left << std::setw(32) << "Task" << std::right << std::setw(14) << "time (ms)" << std::setw(14) << "items";
+    if(hasPerfCounters) {
+        out << std::setw(8) << "IPC" << std::setw(14) << "L1D miss/item" << std::setw(14) << "LLC miss/item"
+            << std::setw(14) << "br miss/item";
+    }
+    out << std::endl;
+
+    const auto taskStatistics = computeTaskStatistics<Microseconds>(timer);
+    for(auto taskID: range(timer.getTaskCount())) {
+        const auto& statistics = taskStatistics[taskID];
+        out << std::left << std::setw(32) << timer.getTaskName(taskID) << std::right << std::fixed
+            << std::setprecision(3) << std::setw(14) << us2ms(statistics.m_Duration)
+            << std::setw(14) << statistics.m_nItemCount;
+        if(hasPerfCounters) {
+            out << std::setprecision(2) << std::setw(8) << statistics.getIPC()
+                << std::setprecision(3) << std::setw(14) << statistics.getL1DataMissesPerItem()
+                << std::setw(14) << statistics.getLastLevelCacheMissesPerItem()
+                << std::setw(14) << statistics.getBranchMissesPerItem();
+        }
+        out << std::endl;
+    }
+
+    out.flags(flags);
+    out.precision(precision);
+}
+
 }
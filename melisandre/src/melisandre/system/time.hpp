@@ -5,9 +5,12 @@
 #include <chrono>
 #include <algorithm>
 #include <vector>
+#include <numeric>
+#include <functional>
 
-#include <melisandre/utils/MultiDimensionalArray.hpp>
-#include <melisandre/itertools/Range.hpp>
+#include <melisandre/system/threads.hpp>
+#include <melisandre/system/perf_counters.hpp>
+#include <melisandre/itertools/range.hpp>
 
 namespace mls {
 
@@ -121,26 +124,48 @@ class TaskTimer {
     using TimePoint = Clock::time_point;
     using Duration = Clock::duration;
 
+    // Durations of a thread, the aligned allocator keeps the arrays of two threads on distinct cache lines
+    using ThreadDurations = std::vector<Duration, AlignedAllocator<Duration>>;
+
+    // Hardware counters and number of processed items of a task on a thread
+    struct TaskCounters {
+        PerfCounterValues m_PerfCounters;
+        uint64_t m_nItemCount = 0u;
+    };
+    using ThreadCounters = std::vector<TaskCounters, AlignedAllocator<TaskCounters>>;
+
     std::vector<std::string> m_TaskNames;
-    MultiDimensionalArray<Duration, 2> m_TaskDurations; // Duration for each task and for each thread
+    PerThreadStorage<ThreadDurations> m_TaskDurations; // Duration for each thread and for each task
+    PerThreadStorage<ThreadCounters> m_TaskCounters; // Counters for each thread and for each task
+    bool m_bCollectPerfCounters = false;
 
 public:
     class TimerRAII {
         std::size_t m_nThreadID;
         std::size_t m_nTaskID;
         TaskTimer& m_Timer;
+        PerfCounterValues m_StartPerfCounters;
+        bool m_bHasPerfCounters = false;
         TimePoint m_StartPoint;
         bool m_bHasStoredDuration = false;
     public:
-        TimerRAII(std::size_t taskID, std::size_t threadID, TaskTimer& timer):
+        TimerRAII(std::size_t taskID, std::size_t threadID, uint64_t itemCount, TaskTimer& timer):
             m_nThreadID(threadID),
             m_nTaskID(taskID),
-            m_Timer(timer),
-            m_StartPoint(Clock::now()) {
+            m_Timer(timer) {
+            m_Timer.m_TaskCounters[uint32_t(m_nThreadID)][m_nTaskID].m_nItemCount += itemCount;
+            if(m_Timer.m_bCollectPerfCounters) {
+                m_bHasPerfCounters = readCurrentThreadPerfCounters(m_StartPerfCounters);
+            }
+            m_StartPoint = Clock::now();
         }
 
         void storeDuration() {
-            m_Timer.m_TaskDurations(m_nTaskID, m_nThreadID) += (Clock::now() - m_StartPoint);
+            m_Timer.m_TaskDurations[uint32_t(m_nThreadID)][m_nTaskID] += (Clock::now() - m_StartPoint);
+            PerfCounterValues perfCounters;
+            if(m_bHasPerfCounters && readCurrentThreadPerfCounters(perfCounters)) {
+                m_Timer.m_TaskCounters[uint32_t(m_nThreadID)][m_nTaskID].m_PerfCounters += perfCounters - m_StartPerfCounters;
+            }
             m_bHasStoredDuration = true;
         }
 
@@ -152,16 +177,22 @@ public:
     };
     friend class TimerRAII;
 
-    TaskTimer() = default;
+    TaskTimer(): m_TaskDurations(0u), m_TaskCounters(0u) {
+    }
 
-    TaskTimer(std::vector<std::string> taskNames, std::size_t threadCount):
+    // If collectPerfCounters is true, the hardware counters of the threads are also read at the start
+    // and the end of each task, see readCurrentThreadPerfCounters. The cost is two system calls per task.
+    TaskTimer(std::vector<std::string> taskNames, std::size_t threadCount, bool collectPerfCounters = false):
         m_TaskNames(std::move(taskNames)),
-        m_TaskDurations(m_TaskNames.size(), threadCount) {
-        std::fill(begin(m_TaskDurations), end(m_TaskDurations), Duration(0));
+        m_TaskDurations(uint32_t(threadCount), ThreadDurations(m_TaskNames.size(), Duration(0))),
+        m_TaskCounters(uint32_t(threadCount), ThreadCounters(m_TaskNames.size())),
+        m_bCollectPerfCounters(collectPerfCounters) {
     }
 
-    TimerRAII start(std::size_t taskID, std::size_t threadID = 0) {
-        return { taskID, threadID, *this };
+    // Time the task taskID on the thread threadID until the returned object is destroyed. itemCount is
+    // the number of items processed by the task, used to report counters per item.
+    TimerRAII start(std::size_t taskID, std::size_t threadID = 0, uint64_t itemCount = 0u) {
+        return { taskID, threadID, itemCount, *this };
     }
 
     std::size_t getTaskCount() const {
@@ -172,14 +203,42 @@ public:
         return m_TaskNames[taskID];
     }
 
+    bool isCollectingPerfCounters() const {
+        return m_bCollectPerfCounters;
+    }
+
     template<typename DurationType>
     DurationType getEllapsedTime(std::size_t taskID) const {
-        Duration taskDuration(0);
-        for(auto threadID: range(m_TaskDurations.size(1))) {
-            taskDuration += m_TaskDurations(taskID, threadID);
+        if(!m_TaskDurations.getThreadCount()) {
+            return DurationType(0);
         }
+        auto taskDuration = treeReduce(m_TaskDurations.getThreadCount(), [&](std::size_t threadID) {
+            return m_TaskDurations[uint32_t(threadID)][taskID];
+        }, std::plus<Duration>());
         return std::chrono::duration_cast<DurationType>(taskDuration);
     }
+
+    // Counters of a task on a thread
+    const PerfCounterValues& getPerfCounters(std::size_t taskID, std::size_t threadID) const {
+        return m_TaskCounters[uint32_t(threadID)][taskID].m_PerfCounters;
+    }
+
+    // Counters of a task summed over all threads
+    PerfCounterValues getPerfCounters(std::size_t taskID) const {
+        PerfCounterValues perfCounters;
+        for(auto threadID = 0u; threadID < m_TaskCounters.getThreadCount(); ++threadID) {
+            perfCounters += m_TaskCounters[threadID][taskID].m_PerfCounters;
+        }
+        return perfCounters;
+    }
+
+    uint64_t getItemCount(std::size_t taskID) const {
+        auto itemCount = uint64_t(0);
+        for(auto threadID = 0u; threadID < m_TaskCounters.getThreadCount(); ++threadID) {
+            itemCount += m_TaskCounters[threadID][taskID].m_nItemCount;
+        }
+        return itemCount;
+    }
 };
 
 template<typename DurationType>
@@ -192,4 +251,43 @@ inline std::vector<DurationType> computeTaskDurations(const TaskTimer& timer) {
     return taskDurations;
 }
 
+// Statistics of a task of a TaskTimer, summed over all threads
+template<typename DurationType>
+struct TaskStatistics {
+    DurationType m_Duration;
+    uint64_t m_nItemCount;
+    PerfCounterValues m_PerfCounters;
+
+    double getIPC() const {
+        return m_PerfCounters.getIPC();
+    }
+
+    // Per item values are 0 if no item count has been given to TaskTimer::start
+    double getL1DataMissesPerItem() const {
+        return m_nItemCount ? double(m_PerfCounters.m_nL1DataMisses) / m_nItemCount : 0.;
+    }
+
+    double getLastLevelCacheMissesPerItem() const {
+        return m_nItemCount ? double(m_PerfCounters.m_nLastLevelCacheMisses) / m_nItemCount : 0.;
+    }
+
+    double getBranchMissesPerItem() const {
+        return m_nItemCount ? double(m_PerfCounters.m_nBranchMisses) / m_nItemCount : 0.;
+    }
+};
+
+template<typename DurationType>
+inline std::vector<TaskStatistics<DurationType>> computeTaskStatistics(const TaskTimer& timer) {
+    std::vector<TaskStatistics<DurationType>> taskStatistics;
+    taskStatistics.reserve(timer.getTaskCount());
+    for(auto taskID: range(timer.getTaskCount())) {
+        taskStatistics.push_back({ timer.getEllapsedTime<DurationType>(taskID), timer.getItemCount(taskID),
+                                   timer.getPerfCounters(taskID) });
+    }
+    return taskStatistics;
+}
+
+// Print a table with, for each task, its duration and if available its IPC and misses per item
+void printTaskStatistics(std::ostream& out, const TaskTimer& timer);
+
 }
@@ -0,0 +1,322 @@
+#pragma once
+
+#include <vector>
+#include <cinttypes>
+#include <algorithm>
+#include <limits>
+
+#include "KdTree.hpp"
+
+namespace mls {
+
+/**
+ * @brief A set of points supporting insertions and removals, with the queries of KdTree.
+ *
+ * The points are stored in a logarithmic forest of static KdTrees: the level k contains up to
+ * BUFFER_CAPACITY * 2^k points, or nothing. The new points are appended to a buffer which is tested
+ * by brute force. When the buffer is full, it is merged with the first levels up to the first empty
+ * one, which is rebuilt with the live points. A point is moved by at most log(n) merges, so an
+ * insertion costs amortised O(log^2 n) with the O(n log n) build of KdTree.
+ *
+ * The removals are lazy: the removed points stay in their level until it is merged, and are skipped
+ * by the queries. When more than half of the stored points are removed, all the live points are
+ * compacted in a single level.
+ *
+ * The points are identified by the indices given to insert. Indices are expected to be dense: the
+ * storage of their state grows up to the largest index. Up to 2^32 - 1 insertions are supported
+ * between two calls to clear.
+ */
+class DynamicKdTree {
+public:
+    //! Number of inserted points tested by brute force before being merged in a KdTree
+    static const uint32_t BUFFER_CAPACITY = 64u;
+
+    explicit DynamicKdTree(KdTreeLayout layout = KdTreeLayout::PointPerNode):
+        m_Layout(layout) {
+    }
+
+    bool empty() const {
+        return !m_nLiveCount;
+    }
+
+    //! Number of live points
+    size_t size() const {
+        return m_nLiveCount;
+    }
+
+    //! Number of levels of the forest, empty or not
+    size_t getLevelCount() const {
+        return m_Levels.size();
+    }
+
+    bool contains(uint32_t index) const {
+        return index < m_ElementStamps.size() && m_ElementStamps[index] != NO_STAMP;
+    }
+
+    /**
+     * @brief Insert the point index at position. If index is already in the set, its previous
+     * position is removed.
+     */
+    void insert(uint32_t index, const Vec3f& position) {
+        if(contains(index)) {
+            --m_nLiveCount;
+            ++m_nDeadCount;
+        } else if(index >= m_ElementStamps.size()) {
+            m_ElementStamps.resize(index + 1, uint32_t(NO_STAMP));
+        }
+        m_ElementStamps[index] = ++m_nStampCounter;
+        m_Buffer.push_back(Entry { index, m_nStampCounter, position });
+        ++m_nLiveCount;
+        if(m_Buffer.size() >= BUFFER_CAPACITY) {
+            flushBuffer();
+        }
+    }
+
+    /**
+     * @brief Remove the point index.
+     * @return false if index is not in the set.
+     */
+    bool remove(uint32_t index) {
+        if(!contains(index)) {
+            return false;
+        }
+        m_ElementStamps[index] = NO_STAMP;
+        --m_nLiveCount;
+        ++m_nDeadCount;
+        if(m_nDeadCount > BUFFER_CAPACITY && m_nDeadCount > m_nLiveCount) {
+            compact();
+        }
+        return true;
+    }
+
+    /**
+     * @brief Replace the content of the set by the count points such that isValid(i), with the
+     * indices i and positions getPosition(i), in a single level.
+     */
+    template<typename PositionFunctor, typename IsValidFunctor>
+    void build(size_t count, PositionFunctor getPosition, IsValidFunctor isValid) {
+        clear();
+        std::vector<Entry> entries;
+        for(uint32_t i = 0; i < count; ++i) {
+            if(isValid(i)) {
+                entries.push_back(Entry { i, ++m_nStampCounter, getPosition(i) });
+            }
+        }
+        m_ElementStamps.assign(count, uint32_t(NO_STAMP));
+        for(const auto& entry: entries) {
+            m_ElementStamps[entry.m_nIndex] = entry.m_nStamp;
+        }
+        m_nLiveCount = uint32_t(entries.size());
+        storeLevel(std::move(entries));
+    }
+
+    template<typename PositionFunctor>
+    void build(size_t count, PositionFunctor getPosition) {
+        build(count, getPosition, [](uint32_t i) { return true; });
+    }
+
+    void clear() {
+        m_Levels.clear();
+        m_Buffer.clear();
+        m_ElementStamps.clear();
+        m_nLiveCount = m_nDeadCount = 0u;
+        m_nStampCounter = NO_STAMP;
+    }
+
+    /**
+     * @brief Search for all the points inside a ball, see KdTree::search.
+     */
+    template<typename ProcessFunctor>
+    void search(const Vec3f& point, float maxDistanceSquared, ProcessFunctor process) const {
+        searchLiveEntries(point, maxDistanceSquared, [&](const Entry& entry, float distSquared) {
+            process(entry.m_nIndex, entry.m_Position, distSquared, maxDistanceSquared);
+        });
+    }
+
+    /**
+     * @brief Search the nearest point i of a given point that match the predicate predicate(i)
+     */
+    template<typename Predicate>
+    uint32_t searchNearestNeighbour(const Vec3f& point, float& distSquared, Predicate predicate) const {
+        auto nearestIndex = std::numeric_limits<uint32_t>::max();
+        distSquared = std::numeric_limits<float>::infinity();
+        searchLiveEntries(point, distSquared, [&](const Entry& entry, float candidateDistSquared) {
+            if(predicate(entry.m_nIndex)) {
+                nearestIndex = entry.m_nIndex;
+                distSquared = candidateDistSquared;
+            }
+        });
+        return nearestIndex;
+    }
+
+    uint32_t searchNearestNeighbour(const Vec3f& point, float& distSquared) const {
+        return searchNearestNeighbour(point, distSquared, [](uint32_t idx) { return true; });
+    }
+
+    /**
+     * @brief Search the K nearest points of a given point that match the predicate predicate(i),
+     * processed by increasing distance. The neighbours are kept in a heap in the scratch arena of the
+     * thread.
+     */
+    template<typename Predicate, typename ProcessFunctor>
+    void searchKNearestNeighbours(const Vec3f& point, size_t K, Predicate predicate,
+                                  ProcessFunctor process) const {
+        if(empty() || !K) {
+            return;
+        }
+        auto& arena = getCurrentThreadScratchArena();
+        ScratchArenaScope arenaScope(arena);
+        ArenaVector<Candidate> heap(arena);
+        heap.reserve(std::min(K, size()));
+        auto compare = [](const Candidate& lhs, const Candidate& rhs) {
+            return lhs.m_fDistSquared < rhs.m_fDistSquared;
+        };
+        // Distance of the farthest neighbour once K neighbours are found
+        auto maxDistanceSquared = std::numeric_limits<float>::infinity();
+        searchLiveEntries(point, maxDistanceSquared, [&](const Entry& entry, float distSquared) {
+            if(!predicate(entry.m_nIndex)) {
+                return;
+            }
+            if(heap.size() == K) {
+                std::pop_heap(begin(heap), end(heap), compare);
+                heap.pop_back();
+            }
+            heap.push_back(Candidate { distSquared, &entry });
+            std::push_heap(begin(heap), end(heap), compare);
+            if(heap.size() == K) {
+                maxDistanceSquared = heap.front().m_fDistSquared;
+            }
+        });
+
+        std::sort_heap(begin(heap), end(heap), compare);
+        for(const auto& neighbour: heap) {
+            process(neighbour.m_pEntry->m_nIndex, neighbour.m_pEntry->m_Position, neighbour.m_fDistSquared);
+        }
+    }
+
+    template<typename ProcessFunctor>
+    void searchKNearestNeighbours(const Vec3f& point, size_t K, ProcessFunctor process) const {
+        searchKNearestNeighbours(point, K, [](uint32_t idx) { return true; }, process);
+    }
+
+private:
+    // Stamp of the points which are not in the set
+    static const uint32_t NO_STAMP = 0u;
+
+    // A point stored in the buffer or a level. The stamp is the one given to the point by its
+    // insertion: the entry is dead if the point was removed or inserted again since.
+    struct Entry {
+        uint32_t m_nIndex;
+        uint32_t m_nStamp;
+        Vec3f m_Position;
+    };
+
+    struct Level {
+        KdTree m_Tree;
+        // The entry i has the index i in m_Tree
+        std::vector<Entry> m_Entries;
+
+        explicit Level(KdTreeLayout layout):
+            m_Tree(layout) {
+        }
+    };
+
+    struct Candidate {
+        float m_fDistSquared;
+        const Entry* m_pEntry;
+    };
+
+    bool isAlive(const Entry& entry) const {
+        return m_ElementStamps[entry.m_nIndex] == entry.m_nStamp;
+    }
+
+    // Call f(entry, distSquared) for the live entries closer to point than maxDistanceSquared, which f
+    // can reduce. The largest levels are searched first, to reduce it early.
+    template<typename Functor>
+    void searchLiveEntries(const Vec3f& point, float& maxDistanceSquared, Functor f) const {
+        for(auto levelIndex = m_Levels.size(); levelIndex-- > 0u; ) {
+            const auto& level = m_Levels[levelIndex];
+            if(level.m_Entries.empty()) {
+                continue;
+            }
+            level.m_Tree.search(point, maxDistanceSquared, [&](uint32_t i, const Vec3f&, float distSquared, float& levelMaxDistanceSquared) {
+                const auto& entry = level.m_Entries[i];
+                if(isAlive(entry)) {
+                    f(entry, distSquared);
+                    levelMaxDistanceSquared = maxDistanceSquared;
+                }
+            });
+        }
+        for(const auto& entry: m_Buffer) {
+            const auto distSquared = sqr_distance(entry.m_Position, point);
+            if(distSquared < maxDistanceSquared && isAlive(entry)) {
+                f(entry, distSquared);
+            }
+        }
+    }
+
+    // Move the live entries of source at the end of destination, and forget the dead ones
+    void appendLiveEntries(std::vector<Entry>& source, std::vector<Entry>& destination) {
+        for(const auto& entry: source) {
+            if(isAlive(entry)) {
+                destination.push_back(entry);
+            } else {
+                --m_nDeadCount;
+            }
+        }
+        source.clear();
+    }
+
+    // Store entries in the first empty level which can contain them, and build its KdTree
+    void storeLevel(std::vector<Entry> entries) {
+        auto levelIndex = 0u;
+        while((size_t(BUFFER_CAPACITY) << levelIndex) < entries.size() ||
+              (levelIndex < m_Levels.size() && !m_Levels[levelIndex].m_Entries.empty())) {
+            ++levelIndex;
+        }
+        while(levelIndex >= m_Levels.size()) {
+            m_Levels.emplace_back(m_Layout);
+        }
+        auto& level = m_Levels[levelIndex];
+        level.m_Entries = std::move(entries);
+        level.m_Tree.build(level.m_Entries.size(), [&](uint32_t i) { return level.m_Entries[i].m_Position; });
+    }
+
+    // Merge the buffer with the non-empty levels preceding the first empty one
+    void flushBuffer() {
+        std::vector<Entry> entries;
+        appendLiveEntries(m_Buffer, entries);
+        for(auto& level: m_Levels) {
+            if(level.m_Entries.empty()) {
+                break;
+            }
+            appendLiveEntries(level.m_Entries, entries);
+            level.m_Tree.clear();
+        }
+        storeLevel(std::move(entries));
+    }
+
+    // Gather all the live entries in a single level
+    void compact() {
+        std::vector<Entry> entries;
+        entries.reserve(m_nLiveCount);
+        appendLiveEntries(m_Buffer, entries);
+        for(auto& level: m_Levels) {
+            appendLiveEntries(level.m_Entries, entries);
+            level.m_Tree.clear();
+        }
+        storeLevel(std::move(entries));
+    }
+
+    KdTreeLayout m_Layout;
+    std::vector<Level> m_Levels;
+    std::vector<Entry> m_Buffer;
+    // Stamp of the live entry of each index, NO_STAMP if the index is not in the set
+    std::vector<uint32_t> m_ElementStamps;
+    uint32_t m_nStampCounter = NO_STAMP;
+    uint32_t m_nLiveCount = 0u;
+    // Number of dead entries still stored in the buffer and the levels
+    uint32_t m_nDeadCount = 0u;
+};
+
+}
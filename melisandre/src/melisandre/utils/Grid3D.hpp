@@ -3,7 +3,8 @@
 #include <cstdint>
 #include <vector>
 #include <melisandre/types.hpp>
-#include <melisandre/sys/memory.hpp>
+#include <melisandre/system/memory.hpp>
+#include <melisandre/system/threads.hpp>
 
 namespace mls {
 
@@ -13,9 +14,13 @@ enum class Grid3DCutAxis {
     ZAxis = 2
 };
 
-template<typename T>
-class Grid3D: std::vector<T> {
-    typedef std::vector<T> Base;
+// A 3D grid stored in a cache line aligned buffer, or in huge pages when large with LargePageAllocator as
+// Alloc. With RowPadding::CacheLine each row along the x axis also starts on a cache line; size(), begin()
+// and end() then include the padding elements. The elements are written by the constructing thread, or by
+// the workers of processTasksPinned with FirstTouchPolicy::PinnedWorkers.
+template<typename T, typename Alloc = AlignedAllocator<T>>
+class Grid3D: std::vector<T, UninitializedAllocator<Alloc>> {
+    typedef std::vector<T, UninitializedAllocator<Alloc>> Base;
 public:
     using value_type = typename Base::value_type;
     using reference = typename Base::reference;
@@ -35,33 +40,37 @@ public:
         m_nWidth(0),
         m_nHeight(0),
         m_nDepth(0),
+        m_nRowPitch(0),
         m_nSliceSize(0) {
     }
 
-    Grid3D(size_t width, size_t height, size_t depth):
-        Base(width * height * depth),
-        m_nWidth(width),
-        m_nHeight(height),
-        m_nDepth(depth),
-        m_nSliceSize(width * height) {
+    Grid3D(size_t width, size_t height, size_t depth, RowPadding rowPadding = RowPadding::None,
+           FirstTouchPolicy firstTouch = FirstTouchPolicy::CallingThread):
+        Grid3D(width, height, depth, T(), rowPadding, firstTouch) {
     }
 
-    Grid3D(size_t width, size_t height, size_t depth, T value):
-        Base(width * height * depth, value),
+    Grid3D(size_t width, size_t height, size_t depth, T value, RowPadding rowPadding = RowPadding::None,
+           FirstTouchPolicy firstTouch = FirstTouchPolicy::CallingThread):
         m_nWidth(width),
         m_nHeight(height),
         m_nDepth(depth),
-        m_nSliceSize(width * height) {
+        m_nRowPitch(computeRowLength(width, sizeof(T), rowPadding)),
+        m_nSliceSize(m_nRowPitch * height) {
+        assignFirstTouch(static_cast<Base&>(*this), m_nSliceSize * depth, value, firstTouch);
     }
 
-    Grid3D(const Vec3u& resolution): Grid3D(resolution.x, resolution.y, resolution.z) {
+    Grid3D(const Vec3u& resolution, RowPadding rowPadding = RowPadding::None,
+           FirstTouchPolicy firstTouch = FirstTouchPolicy::CallingThread):
+        Grid3D(resolution.x, resolution.y, resolution.z, rowPadding, firstTouch) {
     }
 
-    Grid3D(const Vec3u &resolution, T value): Grid3D(resolution.x, resolution.y, resolution.z, value) {
+    Grid3D(const Vec3u &resolution, T value, RowPadding rowPadding = RowPadding::None,
+           FirstTouchPolicy firstTouch = FirstTouchPolicy::CallingThread):
+        Grid3D(resolution.x, resolution.y, resolution.z, value, rowPadding, firstTouch) {
     }
 
     uint32_t offset(uint32_t x, uint32_t y, uint32_t z) const {
-        return x + y * m_nWidth + z * m_nSliceSize;
+        return uint32_t(x + y * m_nRowPitch + z * m_nSliceSize);
     }
 
     uint32_t offset(const Vec3i& coords) const {
@@ -70,9 +79,9 @@ public:
 
     Vec3i coords(uint32_t offset) const {
         Vec3i c;
-        c.x = offset % m_nWidth;
-        c.y = ((offset - c.x) / m_nWidth) % m_nHeight;
-        c.z = ((offset - c.x - c.y * m_nWidth)) / m_nSliceSize;
+        c.x = offset % m_nRowPitch;
+        c.y = ((offset - c.x) / m_nRowPitch) % m_nHeight;
+        c.z = ((offset - c.x - c.y * m_nRowPitch)) / m_nSliceSize;
         return c;
     }
 
@@ -121,11 +130,24 @@ public:
         return Vec3u(m_nWidth, m_nHeight, m_nDepth);
     }
 
+    // Number of elements between the starts of two consecutive rows
+    size_t getRowPitch() const {
+        return m_nRowPitch;
+    }
+
+    const T* getRowPtr(uint32_t y, uint32_t z) const {
+        return data() + offset(0u, y, z);
+    }
+
+    T* getRowPtr(uint32_t y, uint32_t z) {
+        return data() + offset(0u, y, z);
+    }
+
     template<typename Functor>
     void forEach(const Functor& f) const {
-        auto idx = 0u;
         for(auto z = 0u; z < m_nDepth; ++z)  {
             for(auto y = 0u; y < m_nHeight; ++y) {
+                auto idx = offset(0u, y, z);
                 for(auto x = 0u; x < m_nWidth; ++x) {
                     f(x, y, z, (*this)[idx++]);
                 }
@@ -135,9 +157,9 @@ public:
 
     template<typename Functor>
     void forEach(const Functor& f) {
-        auto idx = 0u;
         for(auto z = 0u; z < m_nDepth; ++z)  {
             for(auto y = 0u; y < m_nHeight; ++y) {
+                auto idx = offset(0u, y, z);
                 for(auto x = 0u; x < m_nWidth; ++x) {
                     f(x, y, z, (*this)[idx++]);
                 }
@@ -147,6 +169,7 @@ public:
 
 private:
     size_t m_nWidth, m_nHeight, m_nDepth;
+    size_t m_nRowPitch;
     size_t m_nSliceSize;
 };
 
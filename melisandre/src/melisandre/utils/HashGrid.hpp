@@ -25,23 +25,68 @@
 #pragma once
 
 #include <vector>
+#include <cassert>
 #include <cmath>
+#include <cstring>
+#include <algorithm>
+#include <melisandre/types.hpp>
 #include <melisandre/maths/maths.hpp>
+#include <melisandre/maths/geometry.hpp>
+#include <melisandre/maths/morton.hpp>
+#include <melisandre/maths/simd.hpp>
+#include <melisandre/system/memory.hpp>
+#include <melisandre/system/threads.hpp>
 
 namespace mls {
 
+// Storage of the particles in a HashGrid
+enum class HashGridLayout
+{
+    // The cells store the indices of their particles, whose positions are read in the particle array
+    Indirect,
+    // The positions of the particles are copied in cell order, as structures of arrays, with the
+    // coordinates of their cell: the queries test the distances of SimdFloat4::SIZE particles at once,
+    // only read the particles they accept, and skip the particles of the other cells of the same hash
+    Reordered
+};
+
 class HashGrid
 {
 public:
+    explicit HashGrid(HashGridLayout aLayout = HashGridLayout::Indirect):
+        mLayout(aLayout)
+    {}
+
+    HashGridLayout getLayout() const
+    {
+        return mLayout;
+    }
+
+    // Use aNumCells cells for the next builds, or choose the number of cells at each build if aNumCells is 0
     void Reserve(int aNumCells) {
-        mCellEnds.resize(aNumCells);
+        mReservedCellCount = uint32_t(std::max(aNumCells, 0));
+    }
+
+    // Number of cells of the last build
+    int getCellCount() const
+    {
+        return int(mCellEnds.size());
     }
 
     // Fill the hash grid with the provided particles
     // The functions:
     // - Vec3f getPosition(const tParticle&);
     // - bool isValid(const tParticle&);
-    // must be defined. Only particles that are valid are put in the grid
+    // must be defined. Only particles that are valid are put in the grid.
+    // Unless a number of cells is reserved, the grid has AUTO_CELLS_PER_BOX_CELL cells per cell of size
+    // 2*aRadius of the bounding box of the particles, and at most one cell per valid particle. The hash
+    // table is larger than the number of occupied cells, so few cells share a bucket.
+    // The build is parallel. getPosition and isValid are called once per particle, while computing the
+    // bounding box. The cell key of each particle is then computed once, and the particles are sorted by
+    // key with a parallel radix sort: a few counting sorts of BUILD_RADIX_MAX_BITS bits of the key, each
+    // with per-chunk histograms and a parallel scatter. The order of the particles in a cell is the order
+    // of their indices, whatever the number of threads. The Reordered layout then copies the positions
+    // and cell coordinates of the particles in this order.
     template<typename tParticle>
     void build(
         const tParticle* aParticles,
@@ -53,73 +98,87 @@ public:
         mCellSize    = mRadius * 2.f;
         mInvCellSize = 1.f / mCellSize;
 
-        mBBoxMin = Vec3f( 1e36f);
-        mBBoxMax = Vec3f(-1e36f);
-        // Build bounding box of the particiles
-        for(size_t i=0; i<count; i++)
-        {
-            if(isValid(aParticles[i])) {
-                const Vec3f &pos = getPosition(aParticles[i]);
-                for(int j=0; j<3; j++)
-                {
-                    mBBoxMax[j] = std::max(mBBoxMax[j], pos[j]);
-                    mBBoxMin[j] = std::min(mBBoxMin[j], pos[j]);
+        // Build bounding box of the particiles, and gather their positions for the computation of the keys
+        BuildVector<Vec3f> positions(count);
+        BuildVector<uint8_t> validFlags(count);
+        const auto bounds = parallelReduce(range(count), CellBounds(), [&](const Range<uint32_t>& subRange) {
+            CellBounds bounds;
+            for(auto i: subRange) {
+                validFlags[i] = isValid(aParticles[i]);
+                if(validFlags[i]) {
+                    positions[i] = getPosition(aParticles[i]);
+                    bounds.grow(positions[i]);
+                    ++bounds.mCount;
                 }
             }
-        }
+            return bounds;
+        }, [](const CellBounds& lhs, const CellBounds& rhs) {
+            auto bounds = lhs;
+            bounds.grow(rhs);
+            return bounds;
+        }, BUILD_GRAIN_SIZE);
+        mBBoxMin = bounds.mMin;
+        mBBoxMax = bounds.mMax;
         auto center = (mBBoxMin + mBBoxMax) / 2.f;
         // For numerical stability at the border of the scene:
         mBBoxMin = center + 1.1f * (mBBoxMin - center);
         mBBoxMax = center + 1.1f * (mBBoxMax - center);
 
-        mIndices.resize(count);
-        memset(&mCellEnds[0], 0, mCellEnds.size() * sizeof(int));
-
-        // set mCellEnds[x] to number of particles within x
-        for(size_t i=0; i<count; i++)
-        {
-            if(isValid(aParticles[i])) {
-                const Vec3f &pos = getPosition(aParticles[i]);
-                mCellEnds[GetCellIndex(pos)]++;
+        const auto validCount = bounds.mCount;
+        mCellEnds.resize(mReservedCellCount ? mReservedCellCount : ComputeCellCount(validCount));
+
+        // Cell key in the high bits, particle index in the low bits. The invalid particles get the key
+        // cellCount, which sorts them after all the others.
+        const auto cellCount = uint32_t(mCellEnds.size());
+        BuildVector<uint64_t> keys(count), sortBuffer(count);
+        parallelFor(range(count), BUILD_GRAIN_SIZE, [&](const Range<uint32_t>& subRange) {
+            for(auto i: subRange) {
+                const auto cellKey = validFlags[i] ? uint32_t(GetCellIndex(positions[i])) : cellCount;
+                keys[i] = (uint64_t(cellKey) << 32) | i;
             }
-        }
+        });
 
-        // run exclusive prefix sum to really get the cell starts
-        // mCellEnds[x] is now where the cell starts
-        int sum = 0;
-        for(size_t i=0; i<mCellEnds.size(); i++)
-        {
-            int temp = mCellEnds[i];
-            mCellEnds[i] = sum;
-            sum += temp;
+        // Least significant digit first: each pass is stable, so the particles end sorted by key, then index
+        auto keyBitCount = 1u;
+        while(keyBitCount < 32u && (cellCount >> keyBitCount)) {
+            ++keyBitCount;
         }
-
-        for(size_t i=0; i<count; i++)
-        {
-            if(isValid(aParticles[i])) {
-                const Vec3f &pos = getPosition(aParticles[i]);
-                const int targetIdx = mCellEnds[GetCellIndex(pos)]++;
-                mIndices[targetIdx] = int(i);
-            }
+        const auto passCount = (keyBitCount + BUILD_RADIX_MAX_BITS - 1) / BUILD_RADIX_MAX_BITS;
+        const auto digitBitCount = (keyBitCount + passCount - 1) / passCount;
+        auto pKeys = keys.data(), pBuffer = sortBuffer.data();
+        for(auto pass = 0u; pass < passCount; ++pass) {
+            CountingSortPass(pKeys, pBuffer, count, 32u + pass * digitBitCount, digitBitCount);
+            std::swap(pKeys, pBuffer);
         }
 
-        // now mCellEnds[x] points to the index right after the last
-        // element of cell x
-
-        //// DEBUG
-        //for(size_t i=0; i<aParticles.size(); i++)
-        //{
-        //    const Vec3f &pos  = aParticles[i].GetPosition();
-        //    Vec2i range = GetCellRange(GetCellIndex(pos));
-        //    bool found = false;
-        //    for(;range.x < range.y; range.x++)
-        //    {
-        //        if(mIndices[range.x] == i)
-        //            found = true;
-        //    }
-        //    if(!found)
-        //        printf("Error at particle %d\n", i);
-        //}
+        // The end of the cell c is the number of particles of key <= c: each boundary between two keys of
+        // the sorted particles sets the end of the cells between them
+        mIndices.resize(validCount);
+        const auto reorder = mLayout == HashGridLayout::Reordered;
+        // The positions are padded so that the last particles can be loaded by a full SimdFloat4
+        for(auto& coordinates: mPositions) {
+            coordinates.resize(reorder ? validCount + SimdFloat4::SIZE - 1 : 0u);
+        }
+        mCellCoords.resize(reorder ? validCount : 0u);
+        parallelFor(range(validCount + 1), BUILD_GRAIN_SIZE, [&](const Range<uint32_t>& subRange) {
+            for(auto i: subRange) {
+                const auto firstCell = i ? uint32_t(pKeys[i - 1] >> 32) : 0u;
+                const auto lastCell = i < validCount ? uint32_t(pKeys[i] >> 32) : cellCount;
+                for(auto cell = firstCell; cell < lastCell; ++cell) {
+                    mCellEnds[cell] = int(i);
+                }
+                if(i < validCount) {
+                    const auto index = uint32_t(pKeys[i]);
+                    mIndices[i] = int(index);
+                    if(reorder) {
+                        for(auto axis = 0u; axis < 3u; ++axis) {
+                            mPositions[axis][i] = positions[index][axis];
+                        }
+                        mCellCoords[i] = PackCellCoords(GetCellCoords(positions[index]));
+                    }
+                }
+            }
+        });
     }
 
     // Apply the function aFunc on each particle located in the ball of radius aRadius
@@ -130,6 +189,21 @@ public:
         const Vec3f& queryPos,
         const tFunc& aFunc) const
     {
+        return process(aParticles, queryPos, mRadius, aFunc);
+    }
+
+    // Apply the function aFunc on each particle located in the ball of radius aQueryRadius, which must
+    // not exceed the radius of the build, around the queried position. Only the cells that the ball
+    // overlaps are read: with a radius r, a query reads (1 + r / aRadius)^3 cells on average, up to 8.
+    template<typename tParticle, typename tFunc>
+    int process(
+        const tParticle* aParticles,
+        const Vec3f& queryPos,
+        float aQueryRadius,
+        const tFunc& aFunc) const
+    {
+        assert(aQueryRadius <= mRadius);
+
         const Vec3f distMin = queryPos - mBBoxMin;
         const Vec3f distMax = mBBoxMax - queryPos;
         for(int i=0; i<3; i++)
@@ -145,33 +219,55 @@ public:
             std::floor(cellPt.y),
             std::floor(cellPt.z));
 
-        const int  px = int(coordF.x);
-        const int  py = int(coordF.y);
-        const int  pz = int(coordF.z);
-
-        const Vec3f fractCoord = cellPt - coordF;
+        const Vec3i cellCoords(int(coordF.x), int(coordF.y), int(coordF.z));
 
-        const int  pxo = px + (fractCoord.x < 0.5f ? -1 : +1);
-        const int  pyo = py + (fractCoord.y < 0.5f ? -1 : +1);
-        const int  pzo = pz + (fractCoord.z < 0.5f ? -1 : +1);
+        // Distances of the query to the lower and upper sides of its cell. The cells are twice as large as
+        // the radius of the build, so the ball overlaps at most one neighbour cell along each axis.
+        const Vec3f lowerDist = mCellSize * (cellPt - coordF);
+        Vec3i neighbourCoords = cellCoords;
+        int neighbourAxes = 0;
+        for(int i=0; i<3; i++)
+        {
+            if(lowerDist[i] <= aQueryRadius) {
+                neighbourCoords[i] -= 1;
+                neighbourAxes |= 1 << i;
+            } else if(mCellSize - lowerDist[i] <= aQueryRadius) {
+                neighbourCoords[i] += 1;
+                neighbourAxes |= 1 << i;
+            }
+        }
 
+        const float querySqrRadius = sqr(aQueryRadius);
         int found = 0;
 
+        // Cells already walked by the Indirect layout: several of the neighbour cells can share a hash,
+        // mostly when the grid is sized automatically for a few particles
+        int visitedCells[8];
+        int visitedCount = 0;
+
+        // Bit i of j selects the neighbour along the axis i
         for(int j=0; j<8; j++)
         {
-            Vec2i activeRange;
-            switch(j)
-            {
-            case 0: activeRange = GetCellRange(GetCellIndex(Vec3i(px , py , pz ))); break;
-            case 1: activeRange = GetCellRange(GetCellIndex(Vec3i(px , py , pzo))); break;
-            case 2: activeRange = GetCellRange(GetCellIndex(Vec3i(px , pyo, pz ))); break;
-            case 3: activeRange = GetCellRange(GetCellIndex(Vec3i(px , pyo, pzo))); break;
-            case 4: activeRange = GetCellRange(GetCellIndex(Vec3i(pxo, py , pz ))); break;
-            case 5: activeRange = GetCellRange(GetCellIndex(Vec3i(pxo, py , pzo))); break;
-            case 6: activeRange = GetCellRange(GetCellIndex(Vec3i(pxo, pyo, pz ))); break;
-            case 7: activeRange = GetCellRange(GetCellIndex(Vec3i(pxo, pyo, pzo))); break;
+            if(j & ~neighbourAxes) {
+                continue;
+            }
+            const Vec3i coords(
+                j & 1 ? neighbourCoords.x : cellCoords.x,
+                j & 2 ? neighbourCoords.y : cellCoords.y,
+                j & 4 ? neighbourCoords.z : cellCoords.z);
+            const int cellIndex = GetCellIndex(coords);
+            Vec2i activeRange = GetCellRange(cellIndex);
+
+            if(mLayout == HashGridLayout::Reordered) {
+                found += ProcessReorderedCell(aParticles, queryPos, querySqrRadius, activeRange, PackCellCoords(coords), aFunc);
+                continue;
             }
 
+            if(std::find(visitedCells, visitedCells + visitedCount, cellIndex) != visitedCells + visitedCount) {
+                continue;
+            }
+            visitedCells[visitedCount++] = cellIndex;
+
             for(; activeRange.x < activeRange.y; activeRange.x++)
             {
                 const int particleIndex   = mIndices[activeRange.x];
@@ -180,7 +276,7 @@ public:
                 const float distSqr =
                     sqr_length(queryPos - getPosition(particle));
 
-                if(distSqr <= mRadiusSqr) {
+                if(distSqr <= querySqrRadius) {
                     aFunc(particle);
                     ++found;
                 }
@@ -189,8 +285,216 @@ public:
         return found;
     }
 
+    // Apply aFunc(queryIndex, particle) on each particle located in the ball of radius aRadius around
+    // each of the aQueryCount queried positions. The queries are processed in parallel, in the Morton
+    // order of their positions in the grid, so that consecutive queries read the same cells. The calls
+    // for a query are made by a single thread, but the calls for different queries are concurrent.
+    // If aFoundCounts is not null, it receives the result of process for each query.
+    template<typename tParticle, typename tFunc>
+    void processBatch(
+        const tParticle* aParticles,
+        const Vec3f* aQueryPositions,
+        uint32_t aQueryCount,
+        const tFunc& aFunc,
+        int* aFoundCounts = nullptr) const
+    {
+        processBatch(aParticles, aQueryPositions, nullptr, aQueryCount, aFunc, aFoundCounts);
+    }
+
+    // Same as above, with the radius aQueryRadii[i] for the query i, which must not exceed the radius
+    // of the build. aQueryRadii can be null to use the radius of the build for all the queries.
+    template<typename tParticle, typename tFunc>
+    void processBatch(
+        const tParticle* aParticles,
+        const Vec3f* aQueryPositions,
+        const float* aQueryRadii,
+        uint32_t aQueryCount,
+        const tFunc& aFunc,
+        int* aFoundCounts = nullptr) const
+    {
+        // Morton code in the high bits, query index in the low bits, sorted like the cell keys of the build
+        const BBox3f bound(mBBoxMin, mBBoxMax);
+        BuildVector<uint64_t> keys(aQueryCount), sortBuffer(aQueryCount);
+        parallelFor(range(aQueryCount), BUILD_GRAIN_SIZE, [&](const Range<uint32_t>& subRange) {
+            for(auto i: subRange) {
+                keys[i] = (uint64_t(computeMortonCode(aQueryPositions[i], bound)) << 32) | i;
+            }
+        });
+        auto pKeys = keys.data(), pBuffer = sortBuffer.data();
+        for(auto pass = 0u; pass < 3u; ++pass) {
+            CountingSortPass(pKeys, pBuffer, aQueryCount, 32u + pass * MORTON_BITS_PER_AXIS, MORTON_BITS_PER_AXIS);
+            std::swap(pKeys, pBuffer);
+        }
+
+        parallelFor(range(aQueryCount), PROCESS_BATCH_GRAIN_SIZE, [&](const Range<uint32_t>& subRange) {
+            for(auto i: subRange) {
+                const auto query = uint32_t(pKeys[i]);
+                const auto queryRadius = aQueryRadii ? aQueryRadii[query] : mRadius;
+                const auto found = process(aParticles, aQueryPositions[query], queryRadius, [&](const tParticle& aParticle) {
+                    aFunc(query, aParticle);
+                });
+                if(aFoundCounts) {
+                    aFoundCounts[query] = found;
+                }
+            }
+        });
+    }
+
 private:
 
+    // Temporary arrays proportional to the number of particles or queries. They are allocated on the heap
+    // and freed when build or processBatch returns. Their elements are first written by the parallel loops.
+    template<typename T>
+    using BuildVector = std::vector<T, UninitializedAllocator<std::allocator<T>>>;
+
+    // Number of particles processed by a task of the build
+    static const uint32_t BUILD_GRAIN_SIZE = 1u << 14;
+    // Maximal number of bits of the cell keys sorted by a counting sort of the build
+    static const uint32_t BUILD_RADIX_MAX_BITS = 11u;
+    // Number of cells of an automatically sized grid per cell of the bounding box of the particles
+    static const uint32_t AUTO_CELLS_PER_BOX_CELL = 4u;
+    // Number of queries processed by a task of processBatch
+    static const uint32_t PROCESS_BATCH_GRAIN_SIZE = 1u << 8;
+
+    struct CellBounds
+    {
+        Vec3f mMin = Vec3f( 1e36f);
+        Vec3f mMax = Vec3f(-1e36f);
+        uint32_t mCount = 0u;
+
+        void grow(const Vec3f& aPoint)
+        {
+            mMin = min(mMin, aPoint);
+            mMax = max(mMax, aPoint);
+        }
+
+        void grow(const CellBounds& aOther)
+        {
+            mMin = min(mMin, aOther.mMin);
+            mMax = max(mMax, aOther.mMax);
+            mCount += aOther.mCount;
+        }
+    };
+
+    // Stable sort of the count keys of aSource in aDestination by their digitBitCount bits starting at
+    // the bit shift. Each chunk of BUILD_GRAIN_SIZE keys counts its digits, then scatters its keys after
+    // those of the previous chunks with the same digit.
+    static void CountingSortPass(
+        const uint64_t* aSource,
+        uint64_t* aDestination,
+        uint32_t count,
+        uint32_t shift,
+        uint32_t digitBitCount)
+    {
+        const auto digitCount = 1u << digitBitCount;
+        const auto digitMask = uint64_t(digitCount - 1);
+        const auto chunkCount = (count + BUILD_GRAIN_SIZE - 1) / BUILD_GRAIN_SIZE;
+        auto getChunk = [&](uint32_t chunkIndex) {
+            return range(chunkIndex * BUILD_GRAIN_SIZE, std::min((chunkIndex + 1) * BUILD_GRAIN_SIZE, count));
+        };
+
+        BuildVector<uint32_t> offsets(size_t(chunkCount) * digitCount);
+        parallelFor(range(chunkCount), 1u, [&](const Range<uint32_t>& chunks) {
+            for(auto chunkIndex: chunks) {
+                auto histogram = offsets.data() + size_t(chunkIndex) * digitCount;
+                std::fill(histogram, histogram + digitCount, 0u);
+                for(auto i: getChunk(chunkIndex)) {
+                    ++histogram[(aSource[i] >> shift) & digitMask];
+                }
+            }
+        });
+
+        // Exclusive prefix sum in the order (digit, chunk): the histograms become the offsets of the chunks
+        auto sum = 0u;
+        for(auto digit = 0u; digit < digitCount; ++digit) {
+            for(auto chunkIndex = 0u; chunkIndex < chunkCount; ++chunkIndex) {
+                auto& offset = offsets[size_t(chunkIndex) * digitCount + digit];
+                const auto chunkDigitCount = offset;
+                offset = sum;
+                sum += chunkDigitCount;
+            }
+        }
+
+        parallelFor(range(chunkCount), 1u, [&](const Range<uint32_t>& chunks) {
+            for(auto chunkIndex: chunks) {
+                auto chunkOffsets = offsets.data() + size_t(chunkIndex) * digitCount;
+                for(auto i: getChunk(chunkIndex)) {
+                    aDestination[chunkOffsets[(aSource[i] >> shift) & digitMask]++] = aSource[i];
+                }
+            }
+        });
+    }
+
+    // Apply aFunc on the particles of the range of a cell of the Reordered layout that are in the cell
+    // aCellCoords and in the ball of squared radius aQuerySqrRadius around queryPos. The distances are
+    // tested SimdFloat4::SIZE particles at a time, and the cells of the accepted particles are checked
+    // afterwards: the particles of the other cells of the same hash are rare.
+    template<typename tParticle, typename tFunc>
+    int ProcessReorderedCell(
+        const tParticle* aParticles,
+        const Vec3f& queryPos,
+        float aQuerySqrRadius,
+        const Vec2i& activeRange,
+        uint32_t aCellCoords,
+        const tFunc& aFunc) const
+    {
+        // Local copies, which the calls to aFunc cannot modify
+        const float* positionsX = mPositions[0].data();
+        const float* positionsY = mPositions[1].data();
+        const float* positionsZ = mPositions[2].data();
+        const uint32_t* cellCoords = mCellCoords.data();
+        const int* indices = mIndices.data();
+        const SimdFloat4 queryX(queryPos.x), queryY(queryPos.y), queryZ(queryPos.z);
+        const SimdFloat4 radiusSqr(aQuerySqrRadius);
+
+        int found = 0;
+        for(int i = activeRange.x; i < activeRange.y; i += int(SimdFloat4::SIZE))
+        {
+            const SimdFloat4 deltaX = SimdFloat4::load(positionsX + i) - queryX;
+            const SimdFloat4 deltaY = SimdFloat4::load(positionsY + i) - queryY;
+            const SimdFloat4 deltaZ = SimdFloat4::load(positionsZ + i) - queryZ;
+            const SimdFloat4 distSqr = deltaX * deltaX + deltaY * deltaY + deltaZ * deltaZ;
+
+            uint32_t mask = lessEqualMask(distSqr, radiusSqr);
+            if(activeRange.y - i < int(SimdFloat4::SIZE)) {
+                mask &= getLowBitsMask(uint32_t(activeRange.y - i));
+            }
+            for(; mask; mask &= mask - 1)
+            {
+                const int particle = i + int(findLowestSetBit(mask));
+                // Skip the particles of the other cells with the same hash
+                if(cellCoords[particle] == aCellCoords) {
+                    aFunc(aParticles[indices[particle]]);
+                    ++found;
+                }
+            }
+        }
+        return found;
+    }
+
+    // Identifier of the cell of coordinates aCoord, made of 11, 11 and 10 bits of its coordinates. Cells
+    // whose coordinates differ by multiples of 2^11 or 2^10 share an identifier, which only costs distance
+    // tests of particles out of range.
+    static uint32_t PackCellCoords(const Vec3i &aCoord)
+    {
+        return (uint32_t(aCoord.x) & 0x7ffu) |
+            ((uint32_t(aCoord.y) & 0x7ffu) << 11) |
+            ((uint32_t(aCoord.z) & 0x3ffu) << 22);
+    }
+
+    // Number of cells chosen by the build of aValidCount particles in the bounding box, at least 1 and
+    // at most 2^30, such that the cell indices and the key of the invalid particles fit in an int
+    uint32_t ComputeCellCount(uint32_t aValidCount) const
+    {
+        double boxCellCount = 1.0;
+        for(int i=0; i<3; i++)
+        {
+            boxCellCount *= std::max(1.0, std::ceil(double(mBBoxMax[i] - mBBoxMin[i]) * mInvCellSize));
+        }
+        const double cellCount = std::min(double(aValidCount), double(AUTO_CELLS_PER_BOX_CELL) * boxCellCount);
+        return uint32_t(std::max(1.0, std::min(cellCount, double(1u << 30))));
+    }
+
     Vec2i GetCellRange(int aCellIndex) const
     {
         if(aCellIndex == 0) return Vec2i(0, mCellEnds[0]);
@@ -207,7 +511,7 @@ private:
             (z * 83492791)) % uint32_t(mCellEnds.size()));
     }
 
-    int GetCellIndex(const Vec3f &aPoint) const
+    Vec3i GetCellCoords(const Vec3f &aPoint) const
     {
         const Vec3f distMin = aPoint - mBBoxMin;
 
@@ -216,17 +520,27 @@ private:
             std::floor(mInvCellSize * distMin.y),
             std::floor(mInvCellSize * distMin.z));
 
-        const Vec3i coordI  = Vec3i(int(coordF.x), int(coordF.y), int(coordF.z));
+        return Vec3i(int(coordF.x), int(coordF.y), int(coordF.z));
+    }
 
-        return GetCellIndex(coordI);
+    int GetCellIndex(const Vec3f &aPoint) const
+    {
+        return GetCellIndex(GetCellCoords(aPoint));
     }
 
 private:
 
+    HashGridLayout mLayout;
+    // Number of cells given to Reserve, 0 to choose it at each build
+    uint32_t mReservedCellCount = 0u;
     Vec3f mBBoxMin;
     Vec3f mBBoxMax;
     std::vector<int> mIndices;
     std::vector<int> mCellEnds;
+    // Positions of the particles in cell order along each axis, and identifiers of their cells, for the
+    // Reordered layout
+    std::vector<float> mPositions[3];
+    std::vector<uint32_t> mCellCoords;
 
     float mRadius;
     float mRadiusSqr;
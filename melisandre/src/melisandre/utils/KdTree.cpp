@@ -0,0 +1,169 @@
+#include "KdTree.hpp"
+
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+namespace mls {
+
+static const char KDTREE_FILE_MAGIC[8] = { 'M', 'L', 'S', 'K', 'D', 'T', 'R', '\0' };
+// Increment when the content of the files or the layout of the nodes changes
+static const uint32_t KDTREE_FILE_VERSION = 2u;
+// Written in the byte order of the machine, so that it is read as another value with the other byte order
+static const uint32_t KDTREE_FILE_BYTE_ORDER_MARK = 0x01020304u;
+// Alignment of the sections in the file. The mapping starts on a page, so the mapped arrays are aligned on
+// cache lines like the arrays of a built KdTree.
+static const uint64_t KDTREE_FILE_SECTION_ALIGNMENT = 64u;
+
+struct KdTreeFileHeader {
+    char m_Magic[8];
+    uint32_t m_nByteOrderMark;
+    uint32_t m_nVersion;
+    uint32_t m_nLayout;
+    // Type of the KdTree: number and size of the coordinates of the points
+    uint32_t m_nDimension;
+    uint32_t m_nScalarSize;
+    uint32_t m_nNodeCount;
+    // Number of items of the Bucketed layout, 0 for the PointPerNode layout
+    uint32_t m_nItemCount;
+    // Sizes of the stored structures, which depend on how the compiler lays out their bit fields
+    uint32_t m_nNodeSize;
+    uint32_t m_nNodeDataSize;
+};
+
+// Offsets of the sections following the header: the nodes, then the node data for the PointPerNode
+// layout, or the coordinates and indices of the items for the Bucketed layout
+struct KdTreeFileSections {
+    uint64_t m_nNodesOffset;
+    uint64_t m_nNodesDataOffset;
+    uint64_t m_nItemCoordinatesOffset;
+    uint64_t m_nItemIndicesOffset;
+    uint64_t m_nFileSize;
+};
+
+static uint64_t getItemCoordinatesSize(const KdTreeFileHeader& header) {
+    return header.m_nItemCount ?
+                uint64_t(header.m_nDimension) * getKdTreeItemStride(header.m_nItemCount) * header.m_nScalarSize : 0u;
+}
+
+static KdTreeFileSections computeFileSections(const KdTreeFileHeader& header) {
+    KdTreeFileSections sections = {};
+    auto offset = uint64_t(sizeof(header));
+    auto addSection = [&](uint64_t size) {
+        const auto sectionOffset = roundUpToMultiple(offset, KDTREE_FILE_SECTION_ALIGNMENT);
+        offset = sectionOffset + size;
+        return sectionOffset;
+    };
+    sections.m_nNodesOffset = addSection(uint64_t(header.m_nNodeCount) * header.m_nNodeSize);
+    if(header.m_nLayout == uint32_t(KdTreeLayout::Bucketed)) {
+        sections.m_nItemCoordinatesOffset = addSection(getItemCoordinatesSize(header));
+        sections.m_nItemIndicesOffset = addSection(uint64_t(header.m_nItemCount) * sizeof(uint32_t));
+    } else {
+        sections.m_nNodesDataOffset = addSection(uint64_t(header.m_nNodeCount) * header.m_nNodeDataSize);
+    }
+    sections.m_nFileSize = offset;
+    return sections;
+}
+
+bool writeKdTreeFile(const std::string& filepath, const KdTreeFileContent& content) {
+    std::ofstream out(filepath, std::ios_base::binary);
+    if(!out) {
+        std::cerr << "Unable to open file " << filepath << std::endl;
+        return false;
+    }
+
+    KdTreeFileHeader header;
+    std::memcpy(header.m_Magic, KDTREE_FILE_MAGIC, sizeof(header.m_Magic));
+    header.m_nByteOrderMark = KDTREE_FILE_BYTE_ORDER_MARK;
+    header.m_nVersion = KDTREE_FILE_VERSION;
+    header.m_nLayout = uint32_t(content.m_Layout);
+    header.m_nDimension = content.m_nDimension;
+    header.m_nScalarSize = content.m_nScalarSize;
+    header.m_nNodeCount = content.m_nNodeCount;
+    header.m_nItemCount = content.m_Layout == KdTreeLayout::Bucketed ? content.m_nItemCount : 0u;
+    header.m_nNodeSize = content.m_nNodeSize;
+    header.m_nNodeDataSize = content.m_nNodeDataSize;
+    const auto sections = computeFileSections(header);
+
+    auto position = uint64_t(0);
+    auto writeSection = [&](uint64_t offset, const void* pData, uint64_t size) {
+        static const char padding[KDTREE_FILE_SECTION_ALIGNMENT] = {};
+        out.write(padding, std::streamsize(offset - position));
+        out.write(static_cast<const char*>(pData), std::streamsize(size));
+        position = offset + size;
+    };
+    writeSection(0u, &header, sizeof(header));
+    writeSection(sections.m_nNodesOffset, content.m_pNodes, uint64_t(header.m_nNodeCount) * header.m_nNodeSize);
+    if(content.m_Layout == KdTreeLayout::Bucketed) {
+        writeSection(sections.m_nItemCoordinatesOffset, content.m_pItemCoordinates, getItemCoordinatesSize(header));
+        writeSection(sections.m_nItemIndicesOffset, content.m_pItemIndices, uint64_t(header.m_nItemCount) * sizeof(uint32_t));
+    } else {
+        writeSection(sections.m_nNodesDataOffset, content.m_pNodesData, uint64_t(header.m_nNodeCount) * header.m_nNodeDataSize);
+    }
+
+    if(!out) {
+        std::cerr << "Unable to write the KdTree in " << filepath << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool mapKdTreeFile(const std::string& filepath, KdTreeFileContent& content, Shared<MappedFile>& file) {
+    auto mappedFile = makeShared<MappedFile>();
+    if(!mappedFile->open(FilePath(filepath))) {
+        std::cerr << "Unable to map file " << filepath << std::endl;
+        return false;
+    }
+    if(mappedFile->size() < sizeof(KdTreeFileHeader)) {
+        std::cerr << filepath << " is not a KdTree file" << std::endl;
+        return false;
+    }
+    const auto pData = static_cast<const char*>(mappedFile->data());
+    KdTreeFileHeader header;
+    std::memcpy(&header, pData, sizeof(header));
+    if(std::memcmp(header.m_Magic, KDTREE_FILE_MAGIC, sizeof(header.m_Magic))) {
+        std::cerr << filepath << " is not a KdTree file" << std::endl;
+        return false;
+    }
+    if(header.m_nByteOrderMark != KDTREE_FILE_BYTE_ORDER_MARK) {
+        std::cerr << "The KdTree file " << filepath << " was written with another byte order" << std::endl;
+        return false;
+    }
+    // The sizes of the nodes depend on the type of the points, so the type is checked first
+    if(header.m_nVersion == KDTREE_FILE_VERSION &&
+            (header.m_nDimension != content.m_nDimension || header.m_nScalarSize != content.m_nScalarSize)) {
+        std::cerr << "The KdTree file " << filepath << " contains points of " << header.m_nDimension
+                  << " coordinates of " << header.m_nScalarSize << " bytes, instead of " << content.m_nDimension
+                  << " coordinates of " << content.m_nScalarSize << " bytes" << std::endl;
+        return false;
+    }
+    if(header.m_nVersion != KDTREE_FILE_VERSION || header.m_nLayout > uint32_t(KdTreeLayout::Bucketed) ||
+            header.m_nNodeSize != content.m_nNodeSize || header.m_nNodeDataSize != content.m_nNodeDataSize) {
+        std::cerr << "The KdTree file " << filepath << " was written with an incompatible version" << std::endl;
+        return false;
+    }
+    const auto sections = computeFileSections(header);
+    if(sections.m_nFileSize > mappedFile->size()) {
+        std::cerr << "The KdTree file " << filepath << " is truncated" << std::endl;
+        return false;
+    }
+
+    content.m_Layout = KdTreeLayout(header.m_nLayout);
+    content.m_nNodeCount = header.m_nNodeCount;
+    content.m_nItemCount = header.m_nItemCount;
+    content.m_pNodes = pData + sections.m_nNodesOffset;
+    if(content.m_Layout == KdTreeLayout::Bucketed) {
+        content.m_pItemCoordinates = pData + sections.m_nItemCoordinatesOffset;
+        content.m_pItemIndices = pData + sections.m_nItemIndicesOffset;
+    } else {
+        content.m_pNodesData = pData + sections.m_nNodesDataOffset;
+    }
+    if(content.m_pCheckNodes && !content.m_pCheckNodes(content)) {
+        std::cerr << "The KdTree file " << filepath << " is corrupted" << std::endl;
+        return false;
+    }
+    file = mappedFile;
+    return true;
+}
+
+}
@@ -3,39 +3,59 @@
 #include <vector>
 #include <cinttypes>
 #include <algorithm>
+#include <limits>
+#include <cassert>
+#include <string>
+#include <numeric>
+#include <type_traits>
 
-#include <melisandre/common.hpp>
+#include <melisandre/types.hpp>
 #include <melisandre/maths/maths.hpp>
-#include <melisandre/maths/BBox.hpp>
+#include <melisandre/maths/aabb.hpp>
+#include <melisandre/maths/geometry.hpp>
+#include <melisandre/maths/simd.hpp>
+#include <melisandre/maths/morton.hpp>
+#include <melisandre/system/memory.hpp>
+#include <melisandre/system/files.hpp>
+#include <melisandre/system/threads.hpp>
 
 namespace mls {
 
 /**
- * @brief The KdNode struct represents a node of a KdTree.
+ * @brief The KdNodeND struct represents a node of a KdTreeND of points of Dimension coordinates of
+ * type Scalar.
  */
-struct KdNode {
+template<typename Scalar, uint32_t Dimension>
+struct KdNodeND {
+    //! Number of bits of the split axis, enough to also encode NO_SPLIT_AXIS
+    static const uint32_t SPLIT_AXIS_BIT_COUNT = Dimension < 4u ? 2u : Dimension < 8u ? 3u : 4u;
+
     static const uint32_t NO_NODE = uint32_t(-1);//std::numeric_limits<uint32_t>::max(); visual studo numeric_limits::max() is not constant expr
-    static const uint32_t NO_RIGHT_CHILD = (1 << 29) - 1;
-    static const uint32_t NO_SPLIT_AXIS = 3;
+    static const uint32_t NO_RIGHT_CHILD = (1u << (31u - SPLIT_AXIS_BIT_COUNT)) - 1u;
+    static const uint32_t NO_SPLIT_AXIS = (1u << SPLIT_AXIS_BIT_COUNT) - 1u;
 
-    //! The coordinate of the node along the split axis
-    float m_fSplitPosition;
-    //! The split axis in [0,3[
-    uint32_t m_nSplitAxis: 2;
+    union {
+        //! The coordinate of the node along the split axis
+        Scalar m_fSplitPosition;
+        //! For the leaves of the Bucketed layout, the index of the first item of the bucket
+        uint32_t m_nFirstItem;
+    };
+    //! The split axis in [0,Dimension[
+    uint32_t m_nSplitAxis: SPLIT_AXIS_BIT_COUNT;
     //! A boolean indicating if the node has a left child
     bool m_bHasLeftChild: 1;
     //! The index of the right child of the node in the KdTree array
-    uint32_t m_nRightChildIndex: 29;
+    uint32_t m_nRightChildIndex: 31u - SPLIT_AXIS_BIT_COUNT;
 
     /**
      * @brief setAsInnerNode set the members to represent an inner node.
      * @param splitPosition The coordinate of the node along the split axis
-     * @param splitAxis The split axis in [0,3[
+     * @param splitAxis The split axis in [0,Dimension[
      *
      * @remark The members m_bHasLeftChild and m_nRightChildIndex must be set by the caller
      * after calling this method.
      */
-    void setAsInnerNode(float splitPosition, uint32_t splitAxis) {
+    void setAsInnerNode(Scalar splitPosition, uint32_t splitAxis) {
         m_fSplitPosition = splitPosition;
         m_nSplitAxis = splitAxis;
         m_nRightChildIndex = NO_RIGHT_CHILD;
@@ -50,30 +70,313 @@ struct KdNode {
         m_nRightChildIndex = NO_RIGHT_CHILD;
         m_bHasLeftChild = false;
     }
+
+    /**
+     * @brief setAsBucket set the members to represent a leaf of the Bucketed layout, containing the
+     * items [firstItem, firstItem + itemCount[. A leaf has no right child, so m_nRightChildIndex
+     * stores the item count.
+     */
+    void setAsBucket(uint32_t firstItem, uint32_t itemCount) {
+        m_nFirstItem = firstItem;
+        m_nSplitAxis = NO_SPLIT_AXIS;
+        m_nRightChildIndex = itemCount;
+        m_bHasLeftChild = false;
+    }
+
+    bool isLeaf() const {
+        return m_nSplitAxis == NO_SPLIT_AXIS;
+    }
+
+    uint32_t getBucketItemCount() const {
+        return m_nRightChildIndex;
+    }
+
+    bool hasRightChild() const {
+        return !isLeaf() && m_nRightChildIndex != NO_RIGHT_CHILD;
+    }
+};
+
+/**
+ * @brief The memory layout of a KdTree.
+ */
+enum class KdTreeLayout {
+    //! Each node stores one element, the median of its subtree
+    PointPerNode,
+    //! Inner nodes only store a split, the elements are stored in leaves of at most
+    //! KdTree::MAX_BUCKET_SIZE elements, as structures of arrays tested with SIMD instructions
+    Bucketed
+};
+
+/**
+ * @brief Approximation allowed to the nearest neighbour queries of a KdTree, to stop proving that
+ * far branches can be pruned.
+ */
+struct KdTreeApproximation {
+    //! The distance of each neighbour found is at most (1 + m_fEpsilon) times the distance of the
+    //! exact neighbour of the same rank: a branch is pruned if (1 + m_fEpsilon) times its distance
+    //! exceeds the current search radius
+    float m_fEpsilon = 0.f;
+    //! Maximal number of leaves visited by a query before it stops, 0 for no limit
+    uint32_t m_nMaxVisitedLeafCount = 0u;
+};
+
+/**
+ * @brief Point of a KdTreeND with more coordinates than the glm vectors, such as a position
+ * concatenated with a scaled normal.
+ */
+template<typename Scalar, uint32_t Dimension>
+struct KdVector {
+    Scalar m_Coords[Dimension];
+
+    Scalar& operator [](uint32_t axis) {
+        return m_Coords[axis];
+    }
+
+    const Scalar& operator [](uint32_t axis) const {
+        return m_Coords[axis];
+    }
+};
+
+/**
+ * @brief KdPointType<Scalar, Dimension>::type is the type of the points of a KdTreeND: the glm vector
+ * of the dimension when there is one, a KdVector otherwise.
+ */
+template<typename Scalar, uint32_t Dimension>
+struct KdPointType {
+    using type = KdVector<Scalar, Dimension>;
+};
+
+template<typename Scalar>
+struct KdPointType<Scalar, 1u> {
+    using type = tcoords1<Scalar>;
+};
+
+template<typename Scalar>
+struct KdPointType<Scalar, 2u> {
+    using type = tcoords2<Scalar>;
+};
+
+template<typename Scalar>
+struct KdPointType<Scalar, 3u> {
+    using type = tcoords3<Scalar>;
 };
 
-class KdTree
+template<typename Scalar>
+struct KdPointType<Scalar, 4u> {
+    using type = tcoords4<Scalar>;
+};
+
+/**
+ * @brief Number of coordinates stored along each axis for the itemCount items of a Bucketed KdTreeND:
+ * padded so that the last bucket can be loaded by SIMD batches, and rounded so that the coordinates
+ * of each axis start on a cache line.
+ */
+inline size_t getKdTreeItemStride(size_t itemCount) {
+    return roundUpToMultiple(itemCount + SimdFloat4::SIZE - 1, 16u);
+}
+
+/**
+ * @brief The arrays of a KdTreeND and the description of its type, as stored in a snapshot file.
+ */
+struct KdTreeFileContent {
+    KdTreeLayout m_Layout = KdTreeLayout::PointPerNode;
+    uint32_t m_nDimension = 0u;
+    uint32_t m_nScalarSize = 0u;
+    // Sizes of the stored structures, which depend on how the compiler lays out their bit fields
+    uint32_t m_nNodeSize = 0u;
+    uint32_t m_nNodeDataSize = 0u;
+    uint32_t m_nNodeCount = 0u;
+    //! Number of items of the Bucketed layout, 0 for the PointPerNode layout
+    uint32_t m_nItemCount = 0u;
+    const void* m_pNodes = nullptr;
+    //! Node data of the PointPerNode layout
+    const void* m_pNodesData = nullptr;
+    //! Coordinates of the items of the Bucketed layout, getKdTreeItemStride(m_nItemCount) per axis
+    const void* m_pItemCoordinates = nullptr;
+    const void* m_pItemIndices = nullptr;
+    //! Returns false if the nodes of the content reference nodes or items outside of their arrays
+    bool (*m_pCheckNodes)(const KdTreeFileContent& content) = nullptr;
+};
+
+/**
+ * @brief Write content in a snapshot file, with a versioned header tagged with the byte order of the
+ * machine and the type of the KdTree, followed by its arrays.
+ * @return false if the file cannot be written.
+ */
+bool writeKdTreeFile(const std::string& filepath, const KdTreeFileContent& content);
+
+/**
+ * @brief Map a file written by writeKdTreeFile in memory. The dimension, scalar size and node sizes
+ * of content must describe the expected type of KdTree, and its m_pCheckNodes, if any, is called on the
+ * mapped nodes; the other members are set to the counts of the file and to its arrays, valid as long as
+ * file is not released.
+ * @return false if the file cannot be mapped, was written by a machine with another byte order or
+ * another version of the format, contains another type of KdTree or nodes rejected by m_pCheckNodes.
+ */
+bool mapKdTreeFile(const std::string& filepath, KdTreeFileContent& content, Shared<MappedFile>& file);
+
+/**
+ * @brief A KdTree of elements identified by indices, at points of Dimension coordinates of type Scalar.
+ * Points are compared with the euclidean distance, so the coordinates must be scaled to weight them:
+ * for instance, a position concatenated with a normal scaled by the tolerated position offset per
+ * radian of normal deviation prunes the neighbours of dissimilar orientation in the tree itself.
+ */
+template<typename Scalar, uint32_t Dimension>
+class KdTreeND
 {
+    static_assert(std::is_floating_point<Scalar>::value, "KdTreeND requires floating point coordinates");
+    static_assert(Dimension > 0u && Dimension < 16u, "KdTreeND supports 1 to 15 dimensions");
 public:
+    using Point = typename KdPointType<Scalar, Dimension>::type;
+    using KdNode = KdNodeND<Scalar, Dimension>;
+
+    /**
+     * @brief Results of a batch of queries in compressed sparse row format: the results of the query i
+     * are at the positions [m_Offsets[i], m_Offsets[i + 1][ of m_Indices and m_DistancesSquared. The
+     * arrays are reused without allocation by the next batches when they are large enough.
+     */
+    struct BatchResults {
+        std::vector<uint32_t> m_Offsets;
+        std::vector<uint32_t> m_Indices;
+        std::vector<Scalar> m_DistancesSquared;
+
+        size_t getQueryCount() const {
+            return m_Offsets.empty() ? 0u : m_Offsets.size() - 1u;
+        }
+
+        uint32_t getResultCount(size_t query) const {
+            return m_Offsets[query + 1] - m_Offsets[query];
+        }
+
+    private:
+        friend class KdTreeND;
+
+        // Results (index, distSquared) of each chunk of queries of searchBatch, kept for the next batches
+        std::vector<std::vector<std::pair<uint32_t, Scalar>>> m_ChunkResults;
+    };
+
+    //! Maximal number of elements in a leaf of the Bucketed layout; leaves contain at least half of it
+    static const uint32_t MAX_BUCKET_SIZE = 16u;
+
+    explicit KdTreeND(KdTreeLayout layout = KdTreeLayout::PointPerNode):
+        m_Layout(layout) {
+    }
+
+    KdTreeND(const KdTreeND& other) {
+        *this = other;
+    }
+
+    KdTreeND(KdTreeND&& other) noexcept {
+        *this = std::move(other);
+    }
+
+    KdTreeND& operator =(const KdTreeND& other) {
+        m_Layout = other.m_Layout;
+        m_Nodes = other.m_Nodes;
+        m_NodesData = other.m_NodesData;
+        m_ItemCoordinates = other.m_ItemCoordinates;
+        m_ItemIndices = other.m_ItemIndices;
+        m_MappedFile = other.m_MappedFile;
+        bindViews(other);
+        return *this;
+    }
+
+    KdTreeND& operator =(KdTreeND&& other) noexcept {
+        if(this == &other) {
+            return *this;
+        }
+        m_Layout = other.m_Layout;
+        m_Nodes = std::move(other.m_Nodes);
+        m_NodesData = std::move(other.m_NodesData);
+        m_ItemCoordinates = std::move(other.m_ItemCoordinates);
+        m_ItemIndices = std::move(other.m_ItemIndices);
+        m_MappedFile = std::move(other.m_MappedFile);
+        bindViews(other);
+        other.clear();
+        return *this;
+    }
+
+    KdTreeLayout getLayout() const {
+        return m_Layout;
+    }
+
     bool empty() const {
-        return m_Nodes.empty();
+        return !m_nNodeCount;
     }
 
     size_t size() const {
-        return m_Nodes.size();
+        return m_Layout == KdTreeLayout::Bucketed ? m_nItemCount : m_nNodeCount;
+    }
+
+    /**
+     * @brief Write the KdTree in a binary file that can be mapped by map. The file starts with a
+     * versioned header tagged with the byte order of the machine and the type of the KdTree, followed
+     * by the arrays of the tree.
+     * @return false if the file cannot be written.
+     */
+    bool save(const std::string& filepath) const {
+        auto content = getFileDescription();
+        content.m_Layout = m_Layout;
+        content.m_nNodeCount = m_nNodeCount;
+        content.m_pNodes = m_pNodes;
+        if(m_Layout == KdTreeLayout::Bucketed) {
+            content.m_nItemCount = m_nItemCount;
+            content.m_pItemCoordinates = m_pItemCoordinates;
+            content.m_pItemIndices = m_pItemIndices;
+        } else {
+            content.m_pNodesData = m_pNodesData;
+        }
+        return writeKdTreeFile(filepath, content);
+    }
+
+    /**
+     * @brief Map a file written by save in memory and query it directly, without copying it. The
+     * KdTree takes the layout of the file. The mapping is shared by the copies of the KdTree and
+     * released by clear or the next build.
+     * @return false, with an empty KdTree, if the file cannot be mapped or was written by a machine
+     * with another byte order, another version of the format or another type of KdTree, or if its
+     * nodes reference nodes or items outside of the file.
+     */
+    bool map(const std::string& filepath) {
+        clear();
+        auto content = getFileDescription();
+        Shared<MappedFile> file;
+        if(!mapKdTreeFile(filepath, content, file)) {
+            return false;
+        }
+        m_Layout = content.m_Layout;
+        m_MappedFile = file;
+        m_pNodes = static_cast<const KdNode*>(content.m_pNodes);
+        m_nNodeCount = content.m_nNodeCount;
+        m_pNodesData = static_cast<const NodeData*>(content.m_pNodesData);
+        m_pItemCoordinates = static_cast<const Scalar*>(content.m_pItemCoordinates);
+        m_pItemIndices = static_cast<const uint32_t*>(content.m_pItemIndices);
+        m_nItemCount = content.m_nItemCount;
+        return true;
+    }
+
+    //! Returns true if the KdTree is mapped from a file
+    bool isMapped() const {
+        return m_MappedFile != nullptr;
     }
 
     /**
      * @brief build the KdTree.
      * @param count The number of elements to put in the KdTree.
-     * @param getPosition A functor such that getPosition(i) is the 3D position of the element i.
+     * @param getPosition A functor such that getPosition(i) is the Point of the element i.
+     * It is called once per valid element, from several threads.
      * @param isValid A functor such that isValid(i) returns true if the element i must be included in the KdTree
+     *
+     * @remark The build is parallel: the positions are gathered in a contiguous array, the large
+     * subtrees are built as tasks of the thread pool and the largest nodes are split with a parallel
+     * binned selection. The tree only depends on the set of elements, not on the number of threads.
      */
     template<typename PositionFunctor, typename IsValidFunctor>
     void build(size_t count, PositionFunctor getPosition, IsValidFunctor isValid) {
         clear();
 
-        // Extract valid indices
+        // Extract valid indices. The buffers of the build are proportional to the number of elements: they
+        // are allocated on the heap and freed at the end of the build, not kept by the scratch arena.
         std::vector<uint32_t> indices;
         indices.reserve(count);
         for(uint32_t i = 0; i < count; ++i) {
@@ -81,12 +384,51 @@ public:
                 indices.push_back(i);
             }
         }
+        if(indices.empty()) {
+            return;
+        }
+
+        const auto itemCount = uint32_t(indices.size());
+        std::vector<BuildItem> items(itemCount);
+        parallelFor(range(itemCount), 0u, [&](const Range<uint32_t>& subRange) {
+            for(auto i: subRange) {
+                items[i].m_Position = getPosition(indices[i]);
+                items[i].m_nIndex = indices[i];
+            }
+        });
+
+        // Destination of the parallel partitions
+        std::vector<BuildItem> buffer;
+        if(itemCount >= PARALLEL_PARTITION_MIN_SIZE) {
+            buffer.resize(itemCount);
+        }
+
+        if(m_Layout == KdTreeLayout::Bucketed) {
+            m_Nodes.resize(2 * computeBucketCount(itemCount) - 1);
+            buildBucketedSubtree(0u, items.data(), buffer.data(), itemCount, 0u);
+
+            // The buckets are contiguous ranges of items, stored as structures of arrays. The coordinates
+            // are padded so that the last bucket can be loaded by SIMD batches.
+            const auto stride = getKdTreeItemStride(itemCount);
+            m_ItemCoordinates.resize(Dimension * stride, Scalar(0));
+            m_ItemIndices.resize(itemCount);
+            parallelFor(range(itemCount), 0u, [&](const Range<uint32_t>& subRange) {
+                for(auto i: subRange) {
+                    for(auto axis = 0u; axis < Dimension; ++axis) {
+                        m_ItemCoordinates[axis * stride + i] = items[i].m_Position[axis];
+                    }
+                    m_ItemIndices[i] = items[i].m_nIndex;
+                }
+            });
+            bindStorage();
+            return;
+        }
 
-        m_Nodes.resize(indices.size());
-        m_NodesData.resize(indices.size());
-        uint32_t nextFreeNode = 1;
+        m_Nodes.resize(itemCount);
+        m_NodesData.resize(itemCount);
 
-        recursiveBuild(0, 0, indices.size(), indices.data(), getPosition, nextFreeNode);
+        buildSubtree(0u, items.data(), buffer.data(), itemCount);
+        bindStorage();
     }
 
     template<typename PositionFunctor>
@@ -98,59 +440,94 @@ public:
      * @brief Search for all the elements inside a ball.
      * @param point The center of the ball.
      * @param maxDistanceSquared The squared radius of the ball.
-     * @param f A functor with sign (uint32_t idx, Vec3f position, float distSquared, float& maxDistSquared)
+     * @param f A functor with sign (uint32_t idx, Point position, Scalar distSquared, Scalar& maxDistSquared)
      * which is called for each element in the ball. The functor can modify the maximum distance squared.
      */
     template<typename ProcessFunctor>
-    void search(const Vec3f& point, float maxDistanceSquared, ProcessFunctor process) const {
+    void search(const Point& point, Scalar maxDistanceSquared, ProcessFunctor process) const {
         if(empty()) {
             return;
         }
-        recursiveSearch(0, point, maxDistanceSquared, process);
+        traverse(point, maxDistanceSquared, [&](uint32_t id, Scalar distSquared) {
+            process(getElementIndex(id), getElementPosition(id), distSquared, maxDistanceSquared);
+        });
     }
 
     /**
-     * @brief Search the nearest neighbor i of a given point that match the predicate predicate(i)
+     * @brief Search the nearest neighbor i of a given point that match the predicate predicate(i),
+     * with the allowed approximation.
      */
     template<typename Predicate>
-    uint32_t searchNearestNeighbour(const Vec3f& point, float& distSquared, Predicate predicate) const {
-        distSquared = std::numeric_limits<float>::infinity();
+    uint32_t searchNearestNeighbour(const Point& point, Scalar& distSquared, Predicate predicate,
+                                    const KdTreeApproximation& approximation) const {
+        distSquared = std::numeric_limits<Scalar>::infinity();
         if(empty()) {
             return std::numeric_limits<uint32_t>::max();
         }
-        uint32_t nodeIndex = recursiveSearchNearestNeighbour(0, point, distSquared, predicate);
-        if(nodeIndex == KdNode::NO_NODE) {
-            return std::numeric_limits<uint32_t>::max();
-        }
-        return m_NodesData[nodeIndex].m_nIndex;
+        auto nearestIndex = std::numeric_limits<uint32_t>::max();
+        traverse(point, distSquared, [&](uint32_t id, Scalar candidateDistSquared) {
+            const auto index = getElementIndex(id);
+            if(predicate(index)) {
+                nearestIndex = index;
+                distSquared = candidateDistSquared;
+            }
+        }, approximation);
+        return nearestIndex;
+    }
+
+    /**
+     * @brief Search the nearest neighbor i of a given point that match the predicate predicate(i)
+     */
+    template<typename Predicate>
+    uint32_t searchNearestNeighbour(const Point& point, Scalar& distSquared, Predicate predicate) const {
+        return searchNearestNeighbour(point, distSquared, predicate, KdTreeApproximation());
     }
 
-    uint32_t searchNearestNeighbour(const Vec3f& point, float& distSquared) const {
+    uint32_t searchNearestNeighbour(const Point& point, Scalar& distSquared) const {
         return searchNearestNeighbour(point, distSquared,
                                       [](uint32_t idx) { return true; });
     }
 
     /**
-     * @brief Search the nearest neighbors of a given point that match the predicate predicate(i)
+     * @brief Search the nearest neighbors of a given point that match the predicate predicate(i),
+     * with the allowed approximation.
+     * @remark The neighbours are processed by increasing distance when K <= 32. The search does not
+     * allocate memory, except in the scratch arena of the thread for larger K.
      */
     template<typename Predicate, typename ProcessFunctor>
-    void searchKNearestNeighbours(const Vec3f& point, size_t K, Predicate predicate,
-                                 ProcessFunctor process) const {
+    void searchKNearestNeighbours(const Point& point, size_t K, Predicate predicate,
+                                  ProcessFunctor process, const KdTreeApproximation& approximation) const {
         if(empty() || !K) {
             return;
         }
-        std::vector<std::pair<uint32_t, float>> heap;
-        float distSquared = std::numeric_limits<float>::infinity();
-        recursiveSearchKNearestNeighbours(0, point, K, predicate, distSquared, heap);
-
-        for(const auto& value: heap) {
-            process(m_NodesData[value.first].m_nIndex, m_NodesData[value.first].m_Position,
-                    value.second);
+        // Dispatch to a neighbour list of compile time capacity
+        if(K <= 8u) {
+            SortedNeighbourList<8u> neighbours(static_cast<uint32_t>(K));
+            collectKNearestNeighbours(point, predicate, neighbours, process, approximation);
+        } else if(K <= MAX_SORTED_NEIGHBOUR_COUNT) {
+            SortedNeighbourList<MAX_SORTED_NEIGHBOUR_COUNT> neighbours(static_cast<uint32_t>(K));
+            collectKNearestNeighbours(point, predicate, neighbours, process, approximation);
+        } else {
+            auto& arena = getCurrentThreadScratchArena();
+            ScratchArenaScope arenaScope(arena);
+            ArenaVector<Neighbour> buffer(arena);
+            buffer.resize(std::min(K, size()));
+            NeighbourHeap neighbours(buffer.data(), uint32_t(buffer.size()));
+            collectKNearestNeighbours(point, predicate, neighbours, process, approximation);
         }
     }
 
+    /**
+     * @brief Search the nearest neighbors of a given point that match the predicate predicate(i)
+     */
+    template<typename Predicate, typename ProcessFunctor>
+    void searchKNearestNeighbours(const Point& point, size_t K, Predicate predicate,
+                                 ProcessFunctor process) const {
+        searchKNearestNeighbours(point, K, predicate, process, KdTreeApproximation());
+    }
+
     template<typename ProcessFunctor>
-    void searchKNearestNeighbours(const Vec3f& point, size_t K,
+    void searchKNearestNeighbours(const Point& point, size_t K,
                                  ProcessFunctor process) const {
         searchKNearestNeighbours(point, K, [](uint32_t idx) { return true; }, process);
     }
@@ -158,246 +535,859 @@ public:
     /**
      * @brief traverse the KdTree in a depth first order.
      * @param f A functor with sign (uint32_t parent, uint32_t child) which is called for each
-     * traversed edge in the order of traversal.
+     * traversed edge in the order of traversal. parent and child are the elements stored in the nodes
+     * with the PointPerNode layout, and the node indices with the Bucketed layout.
      */
     template<typename Functor>
     void depthFirstTraversal(Functor f) const {
         if(empty()) {
             return;
         }
-        recursiveDepthFirstTraversal(0, f);
+        // Stack of the edges (parent, child) to traverse, the next one on top
+        std::pair<uint32_t, uint32_t> stack[MAX_TRAVERSAL_DEPTH];
+        auto stackSize = 0u;
+        auto pushChildren = [&](uint32_t nodeIndex) {
+            const KdNode& node = m_pNodes[nodeIndex];
+            if(node.hasRightChild()) {
+                stack[stackSize++] = std::make_pair(nodeIndex, uint32_t(node.m_nRightChildIndex));
+            }
+            if(node.m_bHasLeftChild) {
+                stack[stackSize++] = std::make_pair(nodeIndex, nodeIndex + 1);
+            }
+            assert(stackSize <= MAX_TRAVERSAL_DEPTH);
+        };
+        pushChildren(0u);
+        while(stackSize) {
+            const auto edge = stack[--stackSize];
+            if(m_Layout == KdTreeLayout::Bucketed) {
+                f(edge.first, edge.second);
+            } else {
+                f(m_pNodesData[edge.first].m_nIndex, m_pNodesData[edge.second].m_nIndex);
+            }
+            pushChildren(edge.second);
+        }
+    }
+
+    /**
+     * @brief Search for the elements inside the balls of squared radius maxDistanceSquared centered
+     * on count points. The queries are processed in parallel, in Morton order for coherence.
+     * @remark The results of each chunk of BATCH_GRAIN_SIZE consecutive queries are gathered in a
+     * buffer of the chunk, then copied at their offsets once all the queries are processed. The buffers
+     * of the chunks are kept in results, so the next batches reuse them.
+     */
+    void searchBatch(const Point* points, size_t count, Scalar maxDistanceSquared, BatchResults& results) const {
+        results.m_Offsets.assign(count + 1, 0u);
+        if(empty() || !count) {
+            results.m_Indices.clear();
+            results.m_DistancesSquared.clear();
+            return;
+        }
+        auto& arena = getCurrentThreadScratchArena();
+        ScratchArenaScope arenaScope(arena);
+        const auto order = sortQueries(arena, points, uint32_t(count));
+
+        // Results (index, distSquared) of the queries of each chunk, in the order of the queries
+        const auto chunkCount = uint32_t((count + BATCH_GRAIN_SIZE - 1) / BATCH_GRAIN_SIZE);
+        auto& chunkResults = results.m_ChunkResults;
+        if(chunkResults.size() < chunkCount) {
+            chunkResults.resize(chunkCount);
+        }
+        auto getChunkQueries = [&](uint32_t chunk) {
+            return range(chunk * BATCH_GRAIN_SIZE, std::min(uint32_t(count), (chunk + 1) * BATCH_GRAIN_SIZE));
+        };
+        parallelFor(range(chunkCount), 1u, [&](const Range<uint32_t>& chunks) {
+            for(auto chunk: chunks) {
+                auto& chunkResult = chunkResults[chunk];
+                chunkResult.clear();
+                for(auto i: getChunkQueries(chunk)) {
+                    const auto query = order[i];
+                    const auto resultBegin = chunkResult.size();
+                    traverse(points[query], maxDistanceSquared, [&](uint32_t id, Scalar distSquared) {
+                        chunkResult.emplace_back(getElementIndex(id), distSquared);
+                    });
+                    results.m_Offsets[query + 1] = uint32_t(chunkResult.size() - resultBegin);
+                }
+            }
+        });
+
+        std::partial_sum(begin(results.m_Offsets), end(results.m_Offsets), begin(results.m_Offsets));
+        results.m_Indices.resize(results.m_Offsets.back());
+        results.m_DistancesSquared.resize(results.m_Offsets.back());
+
+        parallelFor(range(chunkCount), 1u, [&](const Range<uint32_t>& chunks) {
+            for(auto chunk: chunks) {
+                auto pResult = chunkResults[chunk].data();
+                for(auto i: getChunkQueries(chunk)) {
+                    const auto query = order[i];
+                    for(auto offset = results.m_Offsets[query]; offset < results.m_Offsets[query + 1]; ++offset, ++pResult) {
+                        results.m_Indices[offset] = pResult->first;
+                        results.m_DistancesSquared[offset] = pResult->second;
+                    }
+                }
+            }
+        });
+    }
+
+    /**
+     * @brief Search the K nearest neighbours of count points, in parallel and in Morton order. Each
+     * query has min(K, size()) results, sorted by increasing distance when K <= 32. The results missed
+     * by a query limited in visited leaves have the index std::numeric_limits<uint32_t>::max().
+     */
+    void kNearestBatch(const Point* points, size_t count, size_t K, BatchResults& results,
+                       const KdTreeApproximation& approximation = KdTreeApproximation()) const {
+        const auto resultCount = uint32_t(std::min(K, size()));
+        results.m_Offsets.resize(count + 1);
+        for(auto i = 0u; i <= count; ++i) {
+            results.m_Offsets[i] = i * resultCount;
+        }
+        results.m_Indices.resize(count * resultCount);
+        results.m_DistancesSquared.resize(count * resultCount);
+        if(!resultCount || !count) {
+            return;
+        }
+        auto& arena = getCurrentThreadScratchArena();
+        ScratchArenaScope arenaScope(arena);
+        const auto order = sortQueries(arena, points, uint32_t(count));
+
+        processBatch(order, [&](uint32_t query) {
+            auto offset = results.m_Offsets[query];
+            searchKNearestNeighbours(points[query], K, [](uint32_t index) { return true; },
+                                     [&](uint32_t index, const Point& position, Scalar distSquared) {
+                results.m_Indices[offset] = index;
+                results.m_DistancesSquared[offset] = distSquared;
+                ++offset;
+            }, approximation);
+            // A query limited in visited leaves can find less than K neighbours
+            for(; offset < results.m_Offsets[query + 1]; ++offset) {
+                results.m_Indices[offset] = std::numeric_limits<uint32_t>::max();
+                results.m_DistancesSquared[offset] = std::numeric_limits<Scalar>::infinity();
+            }
+        });
+    }
+
+    /**
+     * @brief Search the nearest neighbour of count points, in parallel and in Morton order. Each query
+     * has one result, none if the KdTree is empty.
+     */
+    void nearestBatch(const Point* points, size_t count, BatchResults& results,
+                      const KdTreeApproximation& approximation = KdTreeApproximation()) const {
+        const auto resultCount = empty() ? 0u : 1u;
+        results.m_Offsets.resize(count + 1);
+        for(auto i = 0u; i <= count; ++i) {
+            results.m_Offsets[i] = i * resultCount;
+        }
+        results.m_Indices.resize(count * resultCount);
+        results.m_DistancesSquared.resize(count * resultCount);
+        if(!resultCount || !count) {
+            return;
+        }
+        auto& arena = getCurrentThreadScratchArena();
+        ScratchArenaScope arenaScope(arena);
+        const auto order = sortQueries(arena, points, uint32_t(count));
+
+        processBatch(order, [&](uint32_t query) {
+            results.m_Indices[query] = searchNearestNeighbour(points[query], results.m_DistancesSquared[query],
+                                                              [](uint32_t index) { return true; }, approximation);
+        });
     }
 
     void clear() {
         m_Nodes.clear();
         m_NodesData.clear();
+        m_ItemCoordinates.clear();
+        m_ItemIndices.clear();
+        m_MappedFile = nullptr;
+        bindStorage();
     }
 private:
-    template<typename PositionFunctor>
-    void recursiveBuild(uint32_t nodeIndex, uint32_t start, uint32_t end, uint32_t* indices,
-                        PositionFunctor getPosition, uint32_t& nextFreeNode) {
-        if(start + 1 == end) {
-            // One node to process, it's a  leaf
-            m_Nodes[nodeIndex].setAsLeaf();
+    // Capacity of the traversal stacks. The median splits keep the tree less than 32 levels deep.
+    static const uint32_t MAX_TRAVERSAL_DEPTH = 64u;
+    // Largest K for which the k nearest neighbours are kept in a sorted array rather than a heap
+    static const uint32_t MAX_SORTED_NEIGHBOUR_COUNT = 32u;
+    // Number of consecutive queries of a batch processed by a task, in Morton order
+    static const uint32_t BATCH_GRAIN_SIZE = 64u;
 
-            m_NodesData[nodeIndex].m_nIndex = indices[start];
-            m_NodesData[nodeIndex].m_Position = getPosition(indices[start]);
+    // Element identifier and squared distance of a neighbour
+    using Neighbour = std::pair<uint32_t, Scalar>;
 
-            return;
+    // The K nearest neighbours found so far, sorted by increasing distance in an array of fixed capacity. For
+    // small K, shifting the farthest neighbours to insert a new one is faster than the updates of a heap.
+    template<uint32_t Capacity>
+    class SortedNeighbourList {
+    public:
+        explicit SortedNeighbourList(uint32_t K): m_nK(K) {
+            assert(K > 0u && K <= Capacity);
         }
 
-        // Compute the bounding box of the data
-        BBox3f bound;
-        for(uint32_t i = start; i != end; ++i) {
-            bound += getPosition(indices[i]);
+        // Squared distance below which a neighbour must be inserted: the one of the farthest neighbour
+        // once K neighbours are found
+        const Scalar& getMaxDistSquared() const {
+            return m_fMaxDistSquared;
         }
-        // The split axis is the one with maximal extent for the data
-        uint32_t splitAxis = maxComponent(abs(bound.size()));
-        uint32_t splitIndex = (start + end) / 2;
-        // Reorganize the pointers such that the middle element is the middle element on the split axis
-        std::nth_element(indices + start, indices + splitIndex, indices + end,
-                         [splitAxis, &getPosition](uint32_t lhs, uint32_t rhs) -> bool {
-                            float v1 = getPosition(lhs)[splitAxis];
-                            float v2 = getPosition(rhs)[splitAxis];
-                            return v1 == v2 ? lhs < rhs : v1 < v2;
-                         });
-        float splitPosition = getPosition(indices[splitIndex])[splitAxis];
-        m_Nodes[nodeIndex].setAsInnerNode(splitPosition, splitAxis);
-        m_NodesData[nodeIndex].m_nIndex = indices[splitIndex];
-        m_NodesData[nodeIndex].m_Position = getPosition(indices[splitIndex]);
-
-        // Build the left subtree
-        if(start < splitIndex) {
-            m_Nodes[nodeIndex].m_bHasLeftChild = true;
-            uint32_t childIndex = nextFreeNode++;
-            recursiveBuild(childIndex, start, splitIndex, indices, getPosition, nextFreeNode);
-        }
-
-        // Build the right subtree
-        if(splitIndex + 1 < end) {
-            m_Nodes[nodeIndex].m_nRightChildIndex = nextFreeNode++;
-            recursiveBuild(m_Nodes[nodeIndex].m_nRightChildIndex, splitIndex + 1, end, indices, getPosition, nextFreeNode);
+
+        void insert(uint32_t id, Scalar distSquared) {
+            // When the list is full, the farthest neighbour is replaced
+            auto i = m_nCount < m_nK ? m_nCount++ : m_nCount - 1;
+            for(; i > 0u && m_Neighbours[i - 1].second > distSquared; --i) {
+                m_Neighbours[i] = m_Neighbours[i - 1];
+            }
+            m_Neighbours[i] = Neighbour(id, distSquared);
+            if(m_nCount == m_nK) {
+                m_fMaxDistSquared = m_Neighbours[m_nCount - 1].second;
+            }
+        }
+
+        uint32_t size() const {
+            return m_nCount;
+        }
+
+        const Neighbour& operator [](uint32_t i) const {
+            return m_Neighbours[i];
+        }
+
+    private:
+        Neighbour m_Neighbours[Capacity];
+        uint32_t m_nK;
+        uint32_t m_nCount = 0u;
+        Scalar m_fMaxDistSquared = std::numeric_limits<Scalar>::infinity();
+    };
+
+    // The K nearest neighbours found so far, in a max-heap stored in a buffer of K neighbours
+    class NeighbourHeap {
+    public:
+        NeighbourHeap(Neighbour* pNeighbours, uint32_t K): m_pNeighbours(pNeighbours), m_nK(K) {
+            assert(K > 0u);
+        }
+
+        const Scalar& getMaxDistSquared() const {
+            return m_fMaxDistSquared;
+        }
+
+        void insert(uint32_t id, Scalar distSquared) {
+            if(m_nCount == m_nK) {
+                std::pop_heap(m_pNeighbours, m_pNeighbours + m_nCount, compare);
+                --m_nCount;
+            }
+            m_pNeighbours[m_nCount++] = Neighbour(id, distSquared);
+            std::push_heap(m_pNeighbours, m_pNeighbours + m_nCount, compare);
+            if(m_nCount == m_nK) {
+                m_fMaxDistSquared = m_pNeighbours[0].second;
+            }
+        }
+
+        uint32_t size() const {
+            return m_nCount;
+        }
+
+        const Neighbour& operator [](uint32_t i) const {
+            return m_pNeighbours[i];
+        }
+
+    private:
+        static bool compare(const Neighbour& lhs, const Neighbour& rhs) {
+            return lhs.second < rhs.second;
         }
+
+        Neighbour* m_pNeighbours;
+        uint32_t m_nK;
+        uint32_t m_nCount = 0u;
+        Scalar m_fMaxDistSquared = std::numeric_limits<Scalar>::infinity();
+    };
+
+    // Element copied with its position for the build, to partition contiguous data
+    struct BuildItem {
+        Point m_Position;
+        uint32_t m_nIndex;
+    };
+
+    // Subtrees with at least this number of elements are built in parallel
+    static const uint32_t PARALLEL_BUILD_MIN_SIZE = 1u << 12;
+    // Nodes with at least this number of elements are split with parallelSelect
+    static const uint32_t PARALLEL_PARTITION_MIN_SIZE = 1u << 16;
+    static const uint32_t PARTITION_BIN_COUNT = 1024u;
+
+    // Strict total order along axis; the index breaks ties so that the tree does not depend on the
+    // order of the items
+    static bool isBefore(const BuildItem& lhs, const BuildItem& rhs, uint32_t axis) {
+        Scalar v1 = lhs.m_Position[axis];
+        Scalar v2 = rhs.m_Position[axis];
+        return v1 == v2 ? lhs.m_nIndex < rhs.m_nIndex : v1 < v2;
     }
 
-    template<typename ProcessFunctor>
-    void recursiveSearch(uint32_t nodeIndex, const Vec3f& point, float& maxDistanceSquared, ProcessFunctor process) const {
-        const KdNode& node = m_Nodes[nodeIndex];
-        uint32_t axis = node.m_nSplitAxis;
-        if(axis != 3) {
-            float distSquared = sqr(point[axis] - node.m_fSplitPosition);
-            if(point[axis] <= node.m_fSplitPosition) {
-                if(node.m_bHasLeftChild) {
-                    recursiveSearch(nodeIndex + 1, point, maxDistanceSquared, process);
-                }
-                if(distSquared < maxDistanceSquared && node.m_nRightChildIndex < m_Nodes.size()) {
-                    recursiveSearch(node.m_nRightChildIndex, point, maxDistanceSquared, process);
+    // Bounding box of points, which can have more coordinates than the glm vectors used by aabb
+    struct Bound {
+        Scalar m_Lower[Dimension];
+        Scalar m_Upper[Dimension];
+
+        Bound() {
+            std::fill(m_Lower, m_Lower + Dimension, std::numeric_limits<Scalar>::max());
+            std::fill(m_Upper, m_Upper + Dimension, std::numeric_limits<Scalar>::lowest());
+        }
+
+        void grow(const Point& point) {
+            for(auto axis = 0u; axis < Dimension; ++axis) {
+                m_Lower[axis] = std::min(m_Lower[axis], point[axis]);
+                m_Upper[axis] = std::max(m_Upper[axis], point[axis]);
+            }
+        }
+
+        void grow(const Bound& other) {
+            for(auto axis = 0u; axis < Dimension; ++axis) {
+                m_Lower[axis] = std::min(m_Lower[axis], other.m_Lower[axis]);
+                m_Upper[axis] = std::max(m_Upper[axis], other.m_Upper[axis]);
+            }
+        }
+
+        Scalar getExtent(uint32_t axis) const {
+            return m_Upper[axis] - m_Lower[axis];
+        }
+
+        uint32_t getMaxExtentAxis() const {
+            auto maxAxis = 0u;
+            for(auto axis = 1u; axis < Dimension; ++axis) {
+                if(getExtent(axis) > getExtent(maxAxis)) {
+                    maxAxis = axis;
                 }
-            } else {
-                if(node.m_nRightChildIndex < m_Nodes.size()) {
-                    recursiveSearch(node.m_nRightChildIndex, point, maxDistanceSquared, process);
+            }
+            return maxAxis;
+        }
+    };
+
+    static Scalar computeDistanceSquared(const Point& lhs, const Point& rhs) {
+        auto distSquared = sqr(lhs[0] - rhs[0]);
+        for(auto axis = 1u; axis < Dimension; ++axis) {
+            distSquared += sqr(lhs[axis] - rhs[axis]);
+        }
+        return distSquared;
+    }
+
+    template<typename PositionFunctor>
+    static Bound computeBound(uint32_t count, PositionFunctor getPosition) {
+        auto computeSubRangeBound = [&getPosition](const Range<uint32_t>& subRange) {
+            Bound bound;
+            for(auto i: subRange) {
+                bound.grow(getPosition(i));
+            }
+            return bound;
+        };
+        if(count < PARALLEL_BUILD_MIN_SIZE) {
+            return computeSubRangeBound(range(count));
+        }
+        return parallelReduce(range(count), Bound(), computeSubRangeBound, [](const Bound& lhs, const Bound& rhs) {
+            auto bound = lhs;
+            bound.grow(rhs);
+            return bound;
+        });
+    }
+
+    // Same result as std::nth_element(items, items + k, items + count) with isBefore, for large arrays:
+    // the items are counted in bins along axis to find the bin of the k-th item, then the items are
+    // scattered in buffer before, in and after this bin. Only the items of this bin are then sorted
+    // with nth_element.
+    static void parallelSelect(BuildItem* items, BuildItem* buffer, uint32_t count, uint32_t k,
+                               uint32_t axis, Scalar lower, Scalar upper) {
+        const auto scale = PARTITION_BIN_COUNT / (upper - lower);
+        if(!(scale < std::numeric_limits<Scalar>::infinity())) {
+            // All items have the same coordinate
+            std::nth_element(items, items + k, items + count, [axis](const BuildItem& lhs, const BuildItem& rhs) {
+                return isBefore(lhs, rhs, axis);
+            });
+            return;
+        }
+        // Monotonic in the position, so that the bins are ordered like the items
+        auto getBin = [&](const BuildItem& item) {
+            return std::min(uint32_t((item.m_Position[axis] - lower) * scale), PARTITION_BIN_COUNT - 1);
+        };
+
+        const auto chunkSize = std::max(getDefaultGrainSize(count), PARALLEL_BUILD_MIN_SIZE);
+        const auto chunkCount = (count + chunkSize - 1) / chunkSize;
+        auto getChunk = [&](uint32_t chunkIndex) {
+            return Range<uint32_t>(chunkIndex * chunkSize, std::min((chunkIndex + 1) * chunkSize, count));
+        };
+
+        std::vector<uint32_t> histograms(chunkCount * PARTITION_BIN_COUNT, 0u);
+        parallelFor(range(chunkCount), 1u, [&](const Range<uint32_t>& chunks) {
+            for(auto chunkIndex: chunks) {
+                auto histogram = histograms.data() + chunkIndex * PARTITION_BIN_COUNT;
+                for(auto i: getChunk(chunkIndex)) {
+                    ++histogram[getBin(items[i])];
                 }
-                if(distSquared < maxDistanceSquared && node.m_bHasLeftChild) {
-                    recursiveSearch(nodeIndex + 1, point, maxDistanceSquared, process);
+            }
+        });
+
+        // Find the bin containing the k-th item
+        std::vector<uint32_t> binCounts(PARTITION_BIN_COUNT, 0u);
+        for(auto chunkIndex = 0u; chunkIndex < chunkCount; ++chunkIndex) {
+            for(auto bin = 0u; bin < PARTITION_BIN_COUNT; ++bin) {
+                binCounts[bin] += histograms[chunkIndex * PARTITION_BIN_COUNT + bin];
+            }
+        }
+        auto splitBin = 0u, beforeCount = 0u;
+        while(beforeCount + binCounts[splitBin] <= k) {
+            beforeCount += binCounts[splitBin++];
+        }
+        const auto splitBinCount = binCounts[splitBin];
+
+        // Offsets of each chunk in the three parts of buffer
+        std::vector<uint32_t> offsets(3 * chunkCount);
+        auto offsetBefore = 0u, offsetIn = beforeCount, offsetAfter = beforeCount + splitBinCount;
+        for(auto chunkIndex = 0u; chunkIndex < chunkCount; ++chunkIndex) {
+            auto histogram = histograms.data() + chunkIndex * PARTITION_BIN_COUNT;
+            offsets[3 * chunkIndex] = offsetBefore;
+            offsets[3 * chunkIndex + 1] = offsetIn;
+            offsets[3 * chunkIndex + 2] = offsetAfter;
+            auto chunkBeforeCount = std::accumulate(histogram, histogram + splitBin, 0u);
+            offsetBefore += chunkBeforeCount;
+            offsetIn += histogram[splitBin];
+            const auto chunk = getChunk(chunkIndex);
+            offsetAfter += *chunk.end() - *chunk.begin() - chunkBeforeCount - histogram[splitBin];
+        }
+
+        parallelFor(range(chunkCount), 1u, [&](const Range<uint32_t>& chunks) {
+            for(auto chunkIndex: chunks) {
+                auto offset = offsets.data() + 3 * chunkIndex;
+                for(auto i: getChunk(chunkIndex)) {
+                    auto bin = getBin(items[i]);
+                    buffer[offset[(bin > splitBin) + (bin >= splitBin)]++] = items[i];
                 }
             }
+        });
+        parallelFor(range(count), 0u, [&](const Range<uint32_t>& subRange) {
+            std::copy(buffer + *subRange.begin(), buffer + *subRange.end(), items + *subRange.begin());
+        });
+
+        auto binItems = items + beforeCount;
+        std::nth_element(binItems, binItems + (k - beforeCount), binItems + splitBinCount,
+                         [axis](const BuildItem& lhs, const BuildItem& rhs) {
+            return isBefore(lhs, rhs, axis);
+        });
+    }
+
+    // Reorganize the items such that the item splitIndex is the middle element on the split axis,
+    // which is the axis of maximal extent of the items. Return the split axis.
+    static uint32_t splitItems(BuildItem* items, BuildItem* buffer, uint32_t count, uint32_t splitIndex) {
+        // Compute the bounding box of the data
+        Bound bound = computeBound(count, [items](uint32_t i) { return items[i].m_Position; });
+        // The split axis is the one with maximal extent for the data
+        uint32_t splitAxis = bound.getMaxExtentAxis();
+        if(count >= PARALLEL_PARTITION_MIN_SIZE) {
+            parallelSelect(items, buffer, count, splitIndex, splitAxis,
+                           bound.m_Lower[splitAxis], bound.m_Upper[splitAxis]);
+        } else {
+            std::nth_element(items, items + splitIndex, items + count,
+                             [splitAxis](const BuildItem& lhs, const BuildItem& rhs) {
+                return isBefore(lhs, rhs, splitAxis);
+            });
+        }
+        return splitAxis;
+    }
+
+    // Compute the number of buckets of the Bucketed subtrees of count and count + 1 items. The halves of
+    // these sizes also differ by at most one, which avoids a recursion on both children.
+    static void computeBucketCounts(uint32_t count, uint32_t& bucketCount, uint32_t& nextBucketCount) {
+        if(count + 1 <= MAX_BUCKET_SIZE) {
+            bucketCount = nextBucketCount = 1u;
+            return;
         }
-        float distSquared = sqr_distance(m_NodesData[nodeIndex].m_Position, point);
-        if(distSquared < maxDistanceSquared) {
-            process(m_NodesData[nodeIndex].m_nIndex, m_NodesData[nodeIndex].m_Position, distSquared, maxDistanceSquared);
+        uint32_t halfBucketCount, nextHalfBucketCount; // For count / 2 and count / 2 + 1 items
+        computeBucketCounts(count / 2, halfBucketCount, nextHalfBucketCount);
+        if(count % 2 == 0) {
+            bucketCount = count <= MAX_BUCKET_SIZE ? 1u : 2 * halfBucketCount;
+            nextBucketCount = halfBucketCount + nextHalfBucketCount;
+        } else {
+            bucketCount = count <= MAX_BUCKET_SIZE ? 1u : halfBucketCount + nextHalfBucketCount;
+            nextBucketCount = 2 * nextHalfBucketCount;
         }
     }
 
-    template<typename Functor>
-    void recursiveDepthFirstTraversal(uint32_t nodeIndex, Functor f) const {
-        const KdNode& node = m_Nodes[nodeIndex];
+    static uint32_t computeBucketCount(uint32_t count) {
+        uint32_t bucketCount, nextBucketCount;
+        computeBucketCounts(count, bucketCount, nextBucketCount);
+        return bucketCount;
+    }
 
-        if(node.m_bHasLeftChild) {
-            f(m_NodesData[nodeIndex].m_nIndex, m_NodesData[nodeIndex + 1].m_nIndex);
-            recursiveDepthFirstSearch(nodeIndex + 1, f);
+    // Build the subtree of the Bucketed layout for the count items, starting at firstItem, in the node
+    // nodeIndex. Same depth first order as buildSubtree; the right child follows the 2 * bucketCount - 1
+    // nodes of the left subtree.
+    void buildBucketedSubtree(uint32_t nodeIndex, BuildItem* items, BuildItem* buffer, uint32_t count,
+                              uint32_t firstItem) {
+        if(count <= MAX_BUCKET_SIZE) {
+            m_Nodes[nodeIndex].setAsBucket(firstItem, count);
+            return;
         }
 
-        if(node.m_nRightChildIndex < m_Nodes.size()) {
-            f(m_NodesData[nodeIndex].m_nIndex, m_NodesData[node.m_nRightChildIndex].m_nIndex);
-            recursiveDepthFirstSearch(node.m_nRightChildIndex, f);
+        // The median goes to the right subtree: the left items are before it on the split axis, the
+        // right ones after it
+        uint32_t splitIndex = count / 2;
+        uint32_t splitAxis = splitItems(items, buffer, count, splitIndex);
+        auto& node = m_Nodes[nodeIndex];
+        node.setAsInnerNode(items[splitIndex].m_Position[splitAxis], splitAxis);
+        node.m_bHasLeftChild = true;
+        const auto rightChildIndex = nodeIndex + 2 * computeBucketCount(splitIndex);
+        node.m_nRightChildIndex = rightChildIndex;
+
+        auto buildLeftSubtree = [=]() {
+            buildBucketedSubtree(nodeIndex + 1, items, buffer, splitIndex, firstItem);
+        };
+        auto buildRightSubtree = [=]() {
+            buildBucketedSubtree(rightChildIndex, items + splitIndex, buffer ? buffer + splitIndex : nullptr,
+                                 count - splitIndex, firstItem + splitIndex);
+        };
+        if(count >= PARALLEL_BUILD_MIN_SIZE) {
+            parallelInvoke(buildLeftSubtree, buildRightSubtree);
+        } else {
+            buildLeftSubtree();
+            buildRightSubtree();
         }
     }
 
-    template<typename Predicate>
-    uint32_t recursiveSearchNearestNeighbour(uint32_t nodeIndex, const Vec3f& point,
-                                             float& distSquared, Predicate predicate) const {
-        auto node = m_Nodes[nodeIndex];
-        uint32_t index = m_NodesData[nodeIndex].m_nIndex;
+    // Build the subtree of the count items in the node nodeIndex. The nodes are stored in depth first
+    // order, so the left child of the node is nodeIndex + 1 and its right child is stored after the
+    // nodes of the left subtree, one per item. buffer is a scratch array of count items.
+    void buildSubtree(uint32_t nodeIndex, BuildItem* items, BuildItem* buffer, uint32_t count) {
+        if(count == 1u) {
+            // One node to process, it's a  leaf
+            m_Nodes[nodeIndex].setAsLeaf();
 
-        float candidateDistSquared = sqr_distance(point, m_NodesData[nodeIndex].m_Position);
+            m_NodesData[nodeIndex].m_nIndex = items[0].m_nIndex;
+            m_NodesData[nodeIndex].m_Position = items[0].m_Position;
 
-        // If the node is a leaf, end of the recursion
-        if(node.m_nSplitAxis == 3) {
-            if(candidateDistSquared < distSquared && predicate(index)) {
-                distSquared = candidateDistSquared;
-                return nodeIndex;
-            }
-            return KdNode::NO_NODE;
+            return;
         }
 
-        // If the node is inner, find a neighbour in the side of the point
-        uint32_t currentBestMatch = KdNode::NO_NODE;
-        uint8_t axis = node.m_nSplitAxis;
+        uint32_t splitIndex = count / 2;
+        uint32_t splitAxis = splitItems(items, buffer, count, splitIndex);
+        const auto& splitItem = items[splitIndex];
+        m_Nodes[nodeIndex].setAsInnerNode(splitItem.m_Position[splitAxis], splitAxis);
+        m_NodesData[nodeIndex].m_nIndex = splitItem.m_nIndex;
+        m_NodesData[nodeIndex].m_Position = splitItem.m_Position;
 
-        bool isAtLeft = (point[axis] <= node.m_fSplitPosition);
+        // splitIndex > 0 since count > 1: there is always a left subtree
+        m_Nodes[nodeIndex].m_bHasLeftChild = true;
+        auto buildLeftSubtree = [=]() {
+            buildSubtree(nodeIndex + 1, items, buffer, splitIndex);
+        };
 
-        // Left side
-        if(isAtLeft && node.m_bHasLeftChild) {
-            currentBestMatch = recursiveSearchNearestNeighbour(nodeIndex + 1, point, distSquared, predicate);
+        const auto rightCount = count - splitIndex - 1;
+        if(!rightCount) {
+            buildLeftSubtree();
+            return;
         }
-        // Right side
-        else if(!isAtLeft && node.m_nRightChildIndex < m_Nodes.size()) {
-            currentBestMatch = recursiveSearchNearestNeighbour(node.m_nRightChildIndex, point, distSquared, predicate);
+        const auto rightChildIndex = nodeIndex + 1 + splitIndex;
+        m_Nodes[nodeIndex].m_nRightChildIndex = rightChildIndex;
+        auto buildRightSubtree = [=]() {
+            buildSubtree(rightChildIndex, items + splitIndex + 1, buffer ? buffer + splitIndex + 1 : nullptr, rightCount);
+        };
+
+        if(count >= PARALLEL_BUILD_MIN_SIZE) {
+            parallelInvoke(buildLeftSubtree, buildRightSubtree);
+        } else {
+            buildLeftSubtree();
+            buildRightSubtree();
         }
+    }
+
+    // Coordinates of the items of the Bucketed layout along axis
+    const Scalar* getItemCoordinates(uint32_t axis) const {
+        return m_pItemCoordinates + axis * getKdTreeItemStride(m_nItemCount);
+    }
 
-        // Test the current node against the actual best match
-        if(candidateDistSquared < distSquared && predicate(index)) {
-            currentBestMatch = nodeIndex;
-            distSquared = candidateDistSquared;
+    Point getItemPosition(uint32_t item) const {
+        Point position;
+        for(auto axis = 0u; axis < Dimension; ++axis) {
+            position[axis] = getItemCoordinates(axis)[item];
         }
+        return position;
+    }
 
-        uint32_t candidate = KdNode::NO_NODE;
-        float axisDistSquared = sqr(point[axis] - node.m_fSplitPosition);
+    // Call f(item, distSquared) for each item of the bucket whose squared distance to point is less than
+    // maxDistanceSquared. The distances of float coordinates are computed by SIMD batches.
+    // maxDistanceSquared is read again before each call, so that f can reduce it.
+    template<typename Functor>
+    void processBucket(const KdNode& bucket, const Point& point, const Scalar& maxDistanceSquared, Functor f) const {
+        processBucket(bucket, point, maxDistanceSquared, f, std::is_same<Scalar, float>());
+    }
 
-        // If the separation axis is closer to the point that the actual best match
-        // we must search the other side
-        if(axisDistSquared < distSquared) {
-            if(isAtLeft && node.m_nRightChildIndex < m_Nodes.size()) {
-                candidate = recursiveSearchNearestNeighbour(node.m_nRightChildIndex, point, distSquared, predicate);
+    template<typename Functor>
+    void processBucket(const KdNode& bucket, const Point& point, const Scalar& maxDistanceSquared, Functor f,
+                       std::false_type) const {
+        const auto itemCount = bucket.getBucketItemCount();
+        for(auto item = bucket.m_nFirstItem; item < bucket.m_nFirstItem + itemCount; ++item) {
+            auto distSquared = sqr(getItemCoordinates(0)[item] - point[0]);
+            for(auto axis = 1u; axis < Dimension; ++axis) {
+                distSquared += sqr(getItemCoordinates(axis)[item] - point[axis]);
             }
-            else if(!isAtLeft && node.m_bHasLeftChild) {
-                candidate = recursiveSearchNearestNeighbour(nodeIndex + 1, point, distSquared, predicate);
+            if(distSquared < maxDistanceSquared) {
+                f(item, distSquared);
             }
         }
+    }
+
+    template<typename Functor>
+    void processBucket(const KdNode& bucket, const Point& point, const Scalar& maxDistanceSquared, Functor f,
+                       std::true_type) const {
+        const Scalar* coordinates[Dimension];
+        SimdFloat4 pointCoordinates[Dimension];
+        for(auto axis = 0u; axis < Dimension; ++axis) {
+            coordinates[axis] = getItemCoordinates(axis);
+            pointCoordinates[axis] = SimdFloat4(point[axis]);
+        }
+        const auto itemCount = bucket.getBucketItemCount();
+        for(auto i = 0u; i < itemCount; i += SimdFloat4::SIZE) {
+            const auto item = bucket.m_nFirstItem + i;
+            auto delta = SimdFloat4::load(coordinates[0] + item) - pointCoordinates[0];
+            auto distSquared = delta * delta;
+            for(auto axis = 1u; axis < Dimension; ++axis) {
+                delta = SimdFloat4::load(coordinates[axis] + item) - pointCoordinates[axis];
+                distSquared = distSquared + delta * delta;
+            }
 
-        if(candidate != KdNode::NO_NODE) {
-            currentBestMatch = candidate;
+            auto mask = lessThanMask(distSquared, SimdFloat4(maxDistanceSquared));
+            if(itemCount - i < SimdFloat4::SIZE) {
+                mask &= getLowBitsMask(itemCount - i);
+            }
+            if(!mask) {
+                continue;
+            }
+            float distancesSquared[SimdFloat4::SIZE];
+            distSquared.store(distancesSquared);
+            for(; mask; mask &= mask - 1) {
+                const auto lane = findLowestSetBit(mask);
+                if(distancesSquared[lane] < maxDistanceSquared) {
+                    f(item + lane, distancesSquared[lane]);
+                }
+            }
         }
+    }
 
-        return currentBestMatch;
+    // The elements reached by a traversal are identified by their node with the PointPerNode layout, and by
+    // their item with the Bucketed layout
+    uint32_t getElementIndex(uint32_t id) const {
+        return m_Layout == KdTreeLayout::Bucketed ? m_pItemIndices[id] : m_pNodesData[id].m_nIndex;
     }
 
-    static bool compare(const std::pair<uint32_t, float>& node1,
-                        const std::pair<uint32_t, float>& node2) {
-        return node1.second < node2.second;
+    Point getElementPosition(uint32_t id) const {
+        return m_Layout == KdTreeLayout::Bucketed ? getItemPosition(id) : m_pNodesData[id].m_Position;
     }
 
-    template<typename Predicate>
-    void recursiveSearchKNearestNeighbours(uint32_t nodeIndex, const Vec3f& point, size_t K, Predicate predicate,
-                                           float& distSquared, std::vector<std::pair<uint32_t, float>>& heap) const {
-        auto node = m_Nodes[nodeIndex];
-        uint32_t index = m_NodesData[nodeIndex].m_nIndex;
-
-        float candidateDistSquared = sqr_distance(point, m_NodesData[nodeIndex].m_Position);
-
-        // If the node is a leaf, end of the recursion
-        if(node.m_nSplitAxis == 3) {
-            if((heap.size() < K || candidateDistSquared < distSquared) && predicate(index)) {
-                heap.push_back(std::make_pair(nodeIndex, candidateDistSquared));
-                std::push_heap(heap.begin(), heap.end(), compare);
-
-                if(heap.size() > K) {
-                    std::pop_heap(heap.begin(), heap.end(), compare);
-                    heap.pop_back();
+    // Visit the nodes which can contain elements closer to point than maxDistanceSquared, the nearest child
+    // first, and call f(id, distSquared) for each of these elements. f can reduce maxDistanceSquared, the
+    // far children are pruned when popped from the stack. With an approximation, the distances of the far
+    // children are scaled by (1 + epsilon)^2 and the traversal stops after the maximal number of leaves.
+    template<typename Functor>
+    void traverse(const Point& point, const Scalar& maxDistanceSquared, Functor f,
+                  const KdTreeApproximation& approximation = KdTreeApproximation()) const {
+        struct StackEntry {
+            uint32_t m_nNodeIndex;
+            Scalar m_fAxisDistSquared;
+        };
+        // A traversal stacks at most one far child per level of the current path
+        StackEntry stack[MAX_TRAVERSAL_DEPTH];
+        auto stackSize = 0u;
+        auto nodeIndex = 0u;
+        const auto pruningScale = sqr(Scalar(1) + Scalar(approximation.m_fEpsilon));
+        auto remainingLeafCount = approximation.m_nMaxVisitedLeafCount ?
+                    approximation.m_nMaxVisitedLeafCount : std::numeric_limits<uint32_t>::max();
+        while(true) {
+            const KdNode& node = m_pNodes[nodeIndex];
+            if(m_Layout == KdTreeLayout::Bucketed) {
+                if(node.isLeaf()) {
+                    processBucket(node, point, maxDistanceSquared, f);
+                }
+            } else {
+                const auto distSquared = computeDistanceSquared(m_pNodesData[nodeIndex].m_Position, point);
+                if(distSquared < maxDistanceSquared) {
+                    f(nodeIndex, distSquared);
                 }
+            }
+            if(node.isLeaf() && !--remainingLeafCount) {
+                return;
+            }
 
-                distSquared = heap.front().second;
+            auto nearChild = KdNode::NO_NODE;
+            if(!node.isLeaf()) {
+                const auto axisDistance = point[node.m_nSplitAxis] - node.m_fSplitPosition;
+                const auto leftChild = node.m_bHasLeftChild ? nodeIndex + 1 : KdNode::NO_NODE;
+                const auto rightChild = node.hasRightChild() ? uint32_t(node.m_nRightChildIndex) : KdNode::NO_NODE;
+                nearChild = axisDistance <= Scalar(0) ? leftChild : rightChild;
+                const auto farChild = axisDistance <= Scalar(0) ? rightChild : leftChild;
+                if(farChild != KdNode::NO_NODE) {
+                    assert(stackSize < MAX_TRAVERSAL_DEPTH);
+                    stack[stackSize++] = { farChild, pruningScale * sqr(axisDistance) };
+                }
             }
-            return;
+            if(nearChild != KdNode::NO_NODE) {
+                nodeIndex = nearChild;
+                continue;
+            }
+            // Continue with the last far child still closer than maxDistanceSquared
+            do {
+                if(!stackSize) {
+                    return;
+                }
+                --stackSize;
+            } while(stack[stackSize].m_fAxisDistSquared >= maxDistanceSquared);
+            nodeIndex = stack[stackSize].m_nNodeIndex;
         }
+    }
 
-        uint8_t axis = node.m_nSplitAxis;
-
-        bool isAtLeft = (point[axis] <= node.m_fSplitPosition);
+    // Return the indices of the queries sorted along a Z-order curve of their first three coordinates, such
+    // that consecutive queries traverse the same nodes
+    static ArenaVector<uint32_t> sortQueries(ScratchArena& arena, const Point* points, uint32_t count) {
+        const auto bound = computeBound(count, [points](uint32_t i) { return points[i]; });
+        const auto maxCoord = Scalar((1u << MORTON_BITS_PER_AXIS) - 1u);
+        auto getMortonCode = [&](const Point& point) {
+            auto coords = uint3(0u);
+            for(auto axis = 0u; axis < std::min(Dimension, 3u); ++axis) {
+                const auto extent = bound.getExtent(axis);
+                if(extent > Scalar(0)) {
+                    coords[axis] = uint32_t(clamp(maxCoord * (point[axis] - bound.m_Lower[axis]) / extent, Scalar(0), maxCoord));
+                }
+            }
+            return computeMortonCode(coords);
+        };
+        // The Morton code in the high bits, the query index in the low bits
+        ArenaVector<uint64_t> keys(arena);
+        keys.resize(count);
+        parallelFor(range(count), 0u, [&](const Range<uint32_t>& subRange) {
+            for(auto i: subRange) {
+                keys[i] = (uint64_t(getMortonCode(points[i])) << 32) | i;
+            }
+        });
+        std::sort(begin(keys), end(keys));
 
-        // Left side
-        if(isAtLeft && node.m_bHasLeftChild) {
-            recursiveSearchKNearestNeighbours(nodeIndex + 1, point, K, predicate, distSquared, heap);
-        }
-        // Right side
-        else if(!isAtLeft && node.m_nRightChildIndex < m_Nodes.size()) {
-            recursiveSearchKNearestNeighbours(node.m_nRightChildIndex, point, K, predicate, distSquared, heap);
+        ArenaVector<uint32_t> order(arena);
+        order.resize(count);
+        for(auto i = 0u; i < count; ++i) {
+            order[i] = uint32_t(keys[i]);
         }
+        return order;
+    }
 
-        // Test the current node against the actual best match
-        if((heap.size() < K || candidateDistSquared < distSquared) && predicate(index)) {
-            heap.push_back(std::make_pair(nodeIndex, candidateDistSquared));
-            std::push_heap(heap.begin(), heap.end(), compare);
-
-            if(heap.size() > K) {
-                std::pop_heap(heap.begin(), heap.end(), compare);
-                heap.pop_back();
+    // Call f(query) for each query of order, in parallel
+    template<typename Functor>
+    static void processBatch(const ArenaVector<uint32_t>& order, const Functor& f) {
+        parallelFor(range(uint32_t(order.size())), BATCH_GRAIN_SIZE, [&](const Range<uint32_t>& subRange) {
+            for(auto i: subRange) {
+                f(order[i]);
             }
+        });
+    }
 
-            distSquared = heap.front().second;
+    template<typename Predicate, typename Neighbours, typename ProcessFunctor>
+    void collectKNearestNeighbours(const Point& point, Predicate predicate, Neighbours& neighbours,
+                                   ProcessFunctor process, const KdTreeApproximation& approximation) const {
+        traverse(point, neighbours.getMaxDistSquared(), [&](uint32_t id, Scalar distSquared) {
+            if(predicate(getElementIndex(id))) {
+                neighbours.insert(id, distSquared);
+            }
+        }, approximation);
+        for(auto i = 0u; i < neighbours.size(); ++i) {
+            const auto& neighbour = neighbours[i];
+            process(getElementIndex(neighbour.first), getElementPosition(neighbour.first), neighbour.second);
         }
+    }
 
-        float axisDistSquared = sqr(point[axis] - node.m_fSplitPosition);
+    // Point the arrays read by the queries to the storage of the KdTree
+    void bindStorage() {
+        m_pNodes = m_Nodes.data();
+        m_nNodeCount = uint32_t(m_Nodes.size());
+        m_pNodesData = m_NodesData.data();
+        m_pItemCoordinates = m_ItemCoordinates.data();
+        m_pItemIndices = m_ItemIndices.data();
+        m_nItemCount = uint32_t(m_ItemIndices.size());
+    }
 
-        // If the separation axis is closer to the point than the actual best match
-        // we must search the other side
-        if(heap.size() < K || axisDistSquared < distSquared) {
-            if(isAtLeft && node.m_nRightChildIndex < m_Nodes.size()) {
-                recursiveSearchKNearestNeighbours(node.m_nRightChildIndex, point, K, predicate, distSquared, heap);
-            }
-            else if(!isAtLeft && node.m_bHasLeftChild) {
-                recursiveSearchKNearestNeighbours(nodeIndex + 1, point, K, predicate, distSquared, heap);
-            }
+    // Point the arrays read by the queries to the mapped file shared with source, or to the storage
+    void bindViews(const KdTreeND& source) {
+        if(!m_MappedFile) {
+            bindStorage();
+            return;
         }
+        m_pNodes = source.m_pNodes;
+        m_nNodeCount = source.m_nNodeCount;
+        m_pNodesData = source.m_pNodesData;
+        m_pItemCoordinates = source.m_pItemCoordinates;
+        m_pItemIndices = source.m_pItemIndices;
+        m_nItemCount = source.m_nItemCount;
     }
 
     struct NodeData {
         uint32_t m_nIndex;
-        Vec3f m_Position;
+        Point m_Position;
     };
 
-    std::vector<KdNode> m_Nodes;
-    std::vector<NodeData> m_NodesData;
+    // Type of the KdTree, checked when a snapshot file is mapped
+    static KdTreeFileContent getFileDescription() {
+        KdTreeFileContent content;
+        content.m_nDimension = Dimension;
+        content.m_nScalarSize = sizeof(Scalar);
+        content.m_nNodeSize = sizeof(KdNode);
+        content.m_nNodeDataSize = sizeof(NodeData);
+        content.m_pCheckNodes = &checkFileNodes;
+        return content;
+    }
+
+    // Check the nodes of a mapped file before they are traversed: the children follow their parent in the
+    // node array, no deeper than the traversal stacks, and the buckets are inside the item arrays
+    static bool checkFileNodes(const KdTreeFileContent& content) {
+        const auto pNodes = static_cast<const KdNode*>(content.m_pNodes);
+        const auto nodeCount = content.m_nNodeCount;
+        // Depth of each node, set when its parents are checked
+        std::vector<uint8_t> depths(nodeCount, 0u);
+        auto checkChild = [&](uint32_t parent, uint32_t child) {
+            if(child <= parent || child >= nodeCount || depths[parent] + 1u >= MAX_TRAVERSAL_DEPTH) {
+                return false;
+            }
+            depths[child] = std::max(depths[child], uint8_t(depths[parent] + 1u));
+            return true;
+        };
+        for(auto i = 0u; i < nodeCount; ++i) {
+            const auto& node = pNodes[i];
+            if(node.isLeaf()) {
+                if(content.m_Layout == KdTreeLayout::Bucketed &&
+                        uint64_t(node.m_nFirstItem) + node.getBucketItemCount() > content.m_nItemCount) {
+                    return false;
+                }
+                continue;
+            }
+            if(node.m_nSplitAxis >= Dimension ||
+                    (node.m_bHasLeftChild && !checkChild(i, i + 1u)) ||
+                    (node.hasRightChild() && !checkChild(i, node.m_nRightChildIndex))) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Large trees are stored in huge pages to reduce the TLB misses of the traversals
+    std::vector<KdNode, LargePageAllocator<KdNode>> m_Nodes;
+    std::vector<NodeData, LargePageAllocator<NodeData>> m_NodesData;
+
+    KdTreeLayout m_Layout;
+    // Items of the buckets of the Bucketed layout: coordinates along each axis, getKdTreeItemStride(itemCount)
+    // per axis, and element indices
+    std::vector<Scalar, LargePageAllocator<Scalar>> m_ItemCoordinates;
+    std::vector<uint32_t, LargePageAllocator<uint32_t>> m_ItemIndices;
+
+    // Set when the KdTree is mapped from a file instead of built
+    Shared<MappedFile> m_MappedFile;
+
+    // Arrays read by the queries: the storage above or the sections of the mapped file
+    const KdNode* m_pNodes = nullptr;
+    uint32_t m_nNodeCount = 0u;
+    const NodeData* m_pNodesData = nullptr;
+    const Scalar* m_pItemCoordinates = nullptr;
+    const uint32_t* m_pItemIndices = nullptr;
+    uint32_t m_nItemCount = 0u;
 };
 
+//! The KdTree of 3D positions
+using KdTree = KdTreeND<float, 3u>;
+using KdNode = KdTree::KdNode;
+using KdTreeBatchResults = KdTree::BatchResults;
+
+//! KdTree of positions concatenated with scaled normals, see KdTreeND
+using KdTree6f = KdTreeND<float, 6u>;
+
 }
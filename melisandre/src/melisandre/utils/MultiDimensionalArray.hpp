@@ -3,21 +3,30 @@
 #include <vector>
 #include <array>
 
+#include <melisandre/system/memory.hpp>
+#include <melisandre/system/threads.hpp>
+
 namespace mls {
 
 template<typename T, std::size_t Dimension, typename Alloc>
 class MultiDimensionalArray;
 
-template<typename T, typename Alloc = std::allocator<T>>
+template<typename T, typename Alloc = AlignedAllocator<T>>
 using Array2d = MultiDimensionalArray<T, 2, Alloc>;
 
-template<typename T, typename Alloc = std::allocator<T>>
+template<typename T, typename Alloc = AlignedAllocator<T>>
 using Array3d = MultiDimensionalArray<T, 3, Alloc>;
 
-// A multidimensional array stored contiguously in memory
-template<typename T, std::size_t Dimension, typename Alloc = std::allocator<T>>
-class MultiDimensionalArray: std::vector<T, Alloc> {
-    using Container = std::vector<T, Alloc>;
+// A multidimensional array stored contiguously in memory, by default aligned on a cache line. Use
+// LargePageAllocator as Alloc to store large arrays in huge pages.
+// The rows (along the first dimension) can be padded to also start on cache lines, so that vectorized
+// loops over a row have aligned loads. In that case size(), begin() and end() include the padding
+// elements; use getRowPitch() or offset() to address the elements.
+// The elements are value-initialized by the constructing thread, or by the workers of processTasksPinned
+// when constructed with FirstTouchPolicy::PinnedWorkers.
+template<typename T, std::size_t Dimension, typename Alloc = AlignedAllocator<T>>
+class MultiDimensionalArray: std::vector<T, UninitializedAllocator<Alloc>> {
+    using Container = std::vector<T, UninitializedAllocator<Alloc>>;
 public:
     static const std::size_t dimension = Dimension;
 
@@ -35,9 +44,21 @@ public:
 
     template<typename... Us>
     MultiDimensionalArray(std::size_t size0, Us&&... sizes):
-        Container(totalSize(size0, std::forward<Us>(sizes)...)) {
+        MultiDimensionalArray(RowPadding::None, size0, std::forward<Us>(sizes)...) {
+    }
+
+    template<typename... Us>
+    MultiDimensionalArray(RowPadding rowPadding, std::size_t size0, Us&&... sizes):
+        MultiDimensionalArray(rowPadding, FirstTouchPolicy::CallingThread, size0, std::forward<Us>(sizes)...) {
+    }
+
+    template<typename... Us>
+    MultiDimensionalArray(RowPadding rowPadding, FirstTouchPolicy firstTouch, std::size_t size0, Us&&... sizes):
+        m_RowPadding(rowPadding) {
         checkDimension(size0, sizes...);
-        setSizes(0u, 1u, size0, std::forward<Us>(sizes)...);
+        setSizes(0u, 1u, size0, sizes...);
+        assignFirstTouch(static_cast<Container&>(*this), totalSize(m_nRowPitch, std::forward<Us>(sizes)...), T(),
+                         firstTouch);
     }
 
 //    template<typename U, typename Alloc2>
@@ -50,13 +71,12 @@ public:
 
     //MultiDimensionalArray& operator =(MultiDimensionalArray<T, dimension, Alloc>&&) = default;
 
-    template<typename... Us>
-    void resize(Us&&... sizes) {
-        static_assert(sizeof...(sizes) == dimension, "Number of size arguments should be the same as the dimension of the MultiBuffer.");
-        if(!sameSize(0u, std::forward<Us>(sizes)...)) {
-            Container::clear();
-            Container::resize(totalSize(std::forward<Us>(sizes)...));
-            setSizes(0u, 1u, std::forward<Us>(sizes)...);
+    template<typename U, typename... Us>
+    void resize(U&& size0, Us&&... sizes) {
+        static_assert(sizeof...(sizes) + 1 == dimension, "Number of size arguments should be the same as the dimension of the MultiBuffer.");
+        if(!sameSize(0u, size0, sizes...)) {
+            setSizes(0u, 1u, size0, sizes...);
+            Container::assign(totalSize(m_nRowPitch, std::forward<Us>(sizes)...), T());
         }
     }
 
@@ -98,6 +118,15 @@ public:
         return m_nSizes[dimensionIndex];
     }
 
+    RowPadding getRowPadding() const {
+        return m_RowPadding;
+    }
+
+    // Number of elements between the starts of two consecutive rows
+    std::size_t getRowPitch() const {
+        return m_nRowPitch;
+    }
+
 private:
     template<typename... Us>
     void checkDimension(Us&&... sizes) {
@@ -139,11 +168,15 @@ private:
     inline void setSizes(std::size_t index, std::size_t stride, U&& s1, Us&&... s) {
         m_nSizes[index] = s1;
         m_nStrides[index] = stride;
-        setSizes(index + 1, stride * s1, std::forward<Us>(s)...);
+        // Only the rows are padded
+        const auto length = index ? std::size_t(s1) : (m_nRowPitch = computeRowLength(s1, sizeof(T), m_RowPadding));
+        setSizes(index + 1, stride * length, std::forward<Us>(s)...);
     }
 
     std::array<std::size_t, dimension> m_nSizes = { { 0 } };
     std::array<std::size_t, dimension> m_nStrides = { { 0 } };
+    std::size_t m_nRowPitch = 0u;
+    RowPadding m_RowPadding = RowPadding::None;
 };
 
 }